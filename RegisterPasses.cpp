@@ -2,11 +2,44 @@
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "UnitDependence.h"
+#include "UnitFuncSpec.h"
+#include "UnitFuse.h"
+#include "UnitInterchange.h"
+#include "UnitLCSSA.h"
 #include "UnitLICM.h"
+#include "UnitLoopDelete.h"
+#include "UnitLoopIdiom.h"
 #include "UnitLoopInfo.h"
+#include "UnitLoopSimplify.h"
+#include "UnitMemoize.h"
+#include "UnitParRecurse.h"
+#include "UnitParallelize.h"
+#include "UnitReassoc.h"
+#include "UnitRotate.h"
 #include "UnitSCCP.h"
+#include "UnitSLP.h"
+#include "UnitStrengthReduce.h"
+#include "UnitTRE.h"
+#include "UnitTile.h"
+#include "UnitUnroll.h"
+#include "UnitUnswitch.h"
+#include "UnitVectorize.h"
 
-/// Registers the three passes for this project with LLVM's pass mananger
+/// Matches pipeline elements of the form "PassName" or "PassName<a;b=c>" and
+/// splits out the parameters of the latter
+static bool parsePassName(StringRef Name, StringRef PassName, SmallVectorImpl<StringRef>& Params) {
+  if (!Name.consume_front(PassName))
+    return false;
+  if (Name.empty())
+    return true;
+  if (!Name.consume_front("<") || !Name.consume_back(">"))
+    return false;
+  Name.split(Params, ';', -1, /*KeepEmpty=*/false);
+  return true;
+}
+
+/// Registers the passes for this project with LLVM's pass mananger
 llvm::PassPluginLibraryInfo getUnitProjectPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "CS426 Unit Project", LLVM_VERSION_STRING,
           [](PassBuilder& PB) {
@@ -15,6 +48,11 @@ llvm::PassPluginLibraryInfo getUnitProjectPluginInfo() {
               [](FunctionAnalysisManager &FAM) {
                 FAM.registerPass([&]{ return cs426::UnitLoopAnalysis(); });
               });
+            // Register Dependence Analysis
+            PB.registerAnalysisRegistrationCallback(
+              [](FunctionAnalysisManager &FAM) {
+                FAM.registerPass([&]{ return cs426::UnitDependenceAnalysis(); });
+              });
             // Register LICM
             PB.registerPipelineParsingCallback(
               [](StringRef Name, FunctionPassManager& FPM,
@@ -29,12 +67,295 @@ llvm::PassPluginLibraryInfo getUnitProjectPluginInfo() {
             PB.registerPipelineParsingCallback(
               [](StringRef Name, FunctionPassManager& FPM,
                  ArrayRef<PassBuilder::PipelineElement>) {
-                if (Name == "unit-sccp") {
-                  FPM.addPass(cs426::UnitSCCP());
+                SmallVector<StringRef> Params;
+                if (!parsePassName(Name, "unit-sccp", Params))
+                  return false;
+                bool TrackKnownBits = false;
+                for (StringRef Param : Params) {
+                  if (Param == "known-bits")
+                    TrackKnownBits = true;
+                  else
+                    return false;
+                }
+                FPM.addPass(cs426::UnitSCCP(TrackKnownBits));
+                return true;
+              });
+            // Register Loop Unrolling
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                SmallVector<StringRef> Params;
+                if (!parsePassName(Name, "unit-unroll", Params))
+                  return false;
+                cs426::UnitUnroll Pass;
+                for (StringRef Param : Params) {
+                  if (Param.consume_front("full-threshold=")) {
+                    if (Param.getAsInteger(10, Pass.m_FullThreshold))
+                      return false;
+                  } else if (Param.consume_front("partial-factor=")) {
+                    if (Param.getAsInteger(10, Pass.m_PartialFactor))
+                      return false;
+                  } else if (Param.consume_front("partial-threshold=")) {
+                    if (Param.getAsInteger(10, Pass.m_PartialThreshold))
+                      return false;
+                  } else {
+                    return false;
+                  }
+                }
+                FPM.addPass(std::move(Pass));
+                return true;
+              });
+            // Register Loop Unswitching
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                SmallVector<StringRef> Params;
+                if (!parsePassName(Name, "unit-unswitch", Params))
+                  return false;
+                cs426::UnitUnswitch Pass;
+                for (StringRef Param : Params) {
+                  if (!Param.consume_front("budget=") || Param.getAsInteger(10, Pass.m_Budget))
+                    return false;
+                }
+                FPM.addPass(std::move(Pass));
+                return true;
+              });
+            // Register Strength Reduction
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "unit-strength-reduce") {
+                  FPM.addPass(cs426::UnitStrengthReduce());
                   return true;
                 }
                 return false;
               });
+            // Register Loop Interchange
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "unit-interchange") {
+                  FPM.addPass(cs426::UnitInterchange());
+                  return true;
+                }
+                return false;
+              });
+            // Register Loop Tiling
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                SmallVector<StringRef> Params;
+                if (!parsePassName(Name, "unit-tile", Params))
+                  return false;
+                cs426::UnitTile Pass;
+                for (StringRef Param : Params) {
+                  if (Param.consume_front("l1=")) {
+                    if (Param.getAsInteger(10, Pass.m_L1Size))
+                      return false;
+                  } else if (Param.consume_front("l2=")) {
+                    if (Param.getAsInteger(10, Pass.m_L2Size))
+                      return false;
+                  } else {
+                    return false;
+                  }
+                }
+                FPM.addPass(std::move(Pass));
+                return true;
+              });
+            // Register Loop Vectorization
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                SmallVector<StringRef> Params;
+                if (!parsePassName(Name, "unit-vectorize", Params))
+                  return false;
+                cs426::UnitVectorize Pass;
+                for (StringRef Param : Params) {
+                  if (!Param.consume_front("width=") || Param.getAsInteger(10, Pass.m_Width))
+                    return false;
+                }
+                FPM.addPass(std::move(Pass));
+                return true;
+              });
+            // Register SLP Vectorization
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "unit-slp") {
+                  FPM.addPass(cs426::UnitSLP());
+                  return true;
+                }
+                return false;
+              });
+            // Register Loop Fusion
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "unit-fuse") {
+                  FPM.addPass(cs426::UnitFuse());
+                  return true;
+                }
+                return false;
+              });
+            // Register Loop Deletion
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "unit-loop-delete") {
+                  FPM.addPass(cs426::UnitLoopDelete());
+                  return true;
+                }
+                return false;
+              });
+            // Register Reduction Reassociation
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                SmallVector<StringRef> Params;
+                if (!parsePassName(Name, "unit-reassoc", Params))
+                  return false;
+                cs426::UnitReassoc Pass;
+                for (StringRef Param : Params) {
+                  if (!Param.consume_front("acc=") || Param.getAsInteger(10, Pass.m_Accumulators))
+                    return false;
+                }
+                FPM.addPass(std::move(Pass));
+                return true;
+              });
+            // Register Loop Idiom Recognition
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "unit-loop-idiom") {
+                  FPM.addPass(cs426::UnitLoopIdiom());
+                  return true;
+                }
+                return false;
+              });
+            // Register Loop Rotation
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "unit-rotate") {
+                  FPM.addPass(cs426::UnitRotate());
+                  return true;
+                }
+                return false;
+              });
+            // Register Loop Simplification
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "unit-loop-simplify") {
+                  FPM.addPass(cs426::UnitLoopSimplify());
+                  return true;
+                }
+                return false;
+              });
+            // Register Loop-Closed SSA
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "unit-lcssa") {
+                  FPM.addPass(cs426::UnitLCSSA());
+                  return true;
+                }
+                return false;
+              });
+            // Register Dependence Printer
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "print<unit-deps>") {
+                  FPM.addPass(cs426::UnitDependencePrinter());
+                  return true;
+                }
+                return false;
+              });
+            // Register Loop Parallelization
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, ModulePassManager& MPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                SmallVector<StringRef> Params;
+                if (!parsePassName(Name, "unit-parallelize", Params))
+                  return false;
+                cs426::UnitParallelize Pass;
+                for (StringRef Param : Params) {
+                  if (!Param.consume_front("threshold=") || Param.getAsInteger(10, Pass.m_Threshold))
+                    return false;
+                }
+                MPM.addPass(std::move(Pass));
+                return true;
+              });
+            // Register Recursive Fork-Join Parallelization
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, ModulePassManager& MPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                SmallVector<StringRef> Params;
+                if (!parsePassName(Name, "unit-par-recurse", Params))
+                  return false;
+                cs426::UnitParRecurse Pass;
+                for (StringRef Param : Params) {
+                  if (!Param.consume_front("cutoff=") || Param.getAsInteger(10, Pass.m_Cutoff))
+                    return false;
+                }
+                MPM.addPass(std::move(Pass));
+                return true;
+              });
+            // Register Memoization
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, ModulePassManager& MPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                SmallVector<StringRef> Params;
+                if (!parsePassName(Name, "unit-memoize", Params))
+                  return false;
+                cs426::UnitMemoize Pass;
+                for (StringRef Param : Params) {
+                  if (Param.consume_front("size=")) {
+                    if (Param.getAsInteger(10, Pass.m_TableSize))
+                      return false;
+                  } else if (Param.consume_front("fan-out=")) {
+                    if (Param.getAsInteger(10, Pass.m_MinFanOut))
+                      return false;
+                  } else {
+                    return false;
+                  }
+                }
+                MPM.addPass(std::move(Pass));
+                return true;
+              });
+            // Register Tail Recursion Elimination
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, FunctionPassManager& FPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                if (Name == "unit-tre") {
+                  FPM.addPass(cs426::UnitTRE());
+                  return true;
+                }
+                return false;
+              });
+            // Register Function Specialization
+            PB.registerPipelineParsingCallback(
+              [](StringRef Name, ModulePassManager& MPM,
+                 ArrayRef<PassBuilder::PipelineElement>) {
+                SmallVector<StringRef> Params;
+                if (!parsePassName(Name, "unit-func-spec", Params))
+                  return false;
+                cs426::UnitFuncSpec Pass;
+                for (StringRef Param : Params) {
+                  if (Param.consume_front("budget=")) {
+                    if (Param.getAsInteger(10, Pass.m_Budget))
+                      return false;
+                  } else if (Param.consume_front("max-clones=")) {
+                    if (Param.getAsInteger(10, Pass.m_MaxClones))
+                      return false;
+                  } else {
+                    return false;
+                  }
+                }
+                MPM.addPass(std::move(Pass));
+                return true;
+              });
           }};
 }
 
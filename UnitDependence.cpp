@@ -0,0 +1,184 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="print<unit-deps>"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "UnitDependence.h"
+
+using namespace llvm;
+using namespace cs426;
+
+AnalysisKey UnitDependenceAnalysis::Key;
+
+UnitDependenceInfo::UnitDependenceInfo(Function& F, const UnitLoopInfo& Loops, AAResults& AA)
+    : m_AA(AA), m_DL(F.getParent()->getDataLayout()), m_AllLoops(Loops.getLoops(F)) {
+  for (const UnitLoop& L : m_AllLoops)
+    m_LoopOfHeader[L.m_Header] = &L;
+}
+
+const NestDependences& UnitDependenceInfo::getDependences(BasicBlock* Header) {
+  const UnitLoop* L = m_LoopOfHeader.at(Header);
+  while (L->m_ParentHeader)
+    L = m_LoopOfHeader.at(L->m_ParentHeader);
+  auto [It, Inserted] = m_Nests.try_emplace(L->m_Header);
+  if (Inserted)
+    analyzeNest(*L, It->second);
+  return It->second;
+}
+
+bool UnitDependenceInfo::isLoopCarried(BasicBlock* Header) {
+  const UnitLoop& L = *m_LoopOfHeader.at(Header);
+  const NestDependences& Nest = getDependences(Header);
+  if (any_of(Nest.m_Unknown, [&](Instruction* I) { return L.contains(I->getParent()); }))
+    return true;
+  return any_of(Nest.m_Deps, [&](const Dependence& Dep) { return isCarriedBy(Dep, L); });
+}
+
+bool cs426::isCarriedBy(const Dependence& Dep, const UnitLoop& L) {
+  unsigned Level = L.m_Depth - 1;
+  if (Dep.m_Dirs.size() <= Level || !L.contains(Dep.m_Src->getParent()))
+    return false;
+  bool OuterEqual = std::all_of(Dep.m_Dirs.begin(), Dep.m_Dirs.begin() + Level, [](unsigned D) { return D & DirEQ; });
+  return OuterEqual && (Dep.m_Dirs[Level] & (DirLT | DirGT));
+}
+
+bool UnitDependenceInfo::invalidate(Function& F, const PreservedAnalyses& PA,
+                                    FunctionAnalysisManager::Invalidator& Inv) {
+  auto PAC = PA.getChecker<UnitDependenceAnalysis>();
+  return !(PAC.preserved() || PAC.preservedSet<AllAnalysesOn<Function>>()) ||
+         Inv.invalidate<AAManager>(F, PA) || Inv.invalidate<UnitLoopAnalysis>(F, PA);
+}
+
+/// Collect the accesses of the nest, each described in the IVs of the loops
+/// around it, and test every pair involving a write
+void UnitDependenceInfo::analyzeNest(const UnitLoop& Outermost, NestDependences& Nest) {
+  // The loops from the outermost one down to each loop of the nest, as far
+  // as all of them are counted loops
+  std::unordered_map<const UnitLoop*, LoopNest> Chains;
+  std::unordered_map<const UnitLoop*, bool> Counted;
+  std::vector<const UnitLoop*> Work = {&Outermost};
+  while (!Work.empty()) {
+    const UnitLoop* L = Work.back();
+    Work.pop_back();
+    Nest.m_Loops.push_back(L);
+    LoopNest& Chain = Chains[L];
+    UnitInduction Ind;
+    bool Outer = !L->m_ParentHeader || Counted[m_LoopOfHeader.at(L->m_ParentHeader)];
+    Counted[L] = Outer && analyzeInduction(*L, Ind);
+    if (Counted[L]) {
+      if (L->m_ParentHeader)
+        Chain = Chains[m_LoopOfHeader.at(L->m_ParentHeader)];
+      Chain.m_Loops.push_back(L);
+      Chain.m_Inds.push_back(Ind);
+    }
+    for (auto It = L->m_SubLoopHeaders.rbegin(); It != L->m_SubLoopHeaders.rend(); ++It)
+      Work.push_back(m_LoopOfHeader.at(*It));
+  }
+
+  // Innermost loop of every block, the deepest loop containing it
+  std::unordered_map<BasicBlock*, const UnitLoop*> LoopOfBlock;
+  for (const UnitLoop* L : Nest.m_Loops) {
+    for (BasicBlock* BB : L->m_Blocks) {
+      const UnitLoop*& Innermost = LoopOfBlock[BB];
+      if (!Innermost || Innermost->m_Depth < L->m_Depth)
+        Innermost = L;
+    }
+  }
+
+  std::vector<const UnitLoop*> AccessLoops;
+  for (BasicBlock* BB : Outermost.m_Blocks) {
+    const UnitLoop* L = LoopOfBlock.at(BB);
+    for (Instruction& I : *BB) {
+      bool Simple = isa<LoadInst>(I) ? cast<LoadInst>(I).isSimple()
+                                     : isa<StoreInst>(I) && cast<StoreInst>(I).isSimple();
+      if (!Simple) {
+        if (I.mayReadOrWriteMemory())
+          Nest.m_Unknown.push_back(&I);
+        continue;
+      }
+      // Without IVs for all its loops an access is only known by its base
+      NestAccess A;
+      if (Counted.at(L)) {
+        A = getNestAccess(Chains.at(L), &I, m_DL);
+      } else {
+        A.m_Inst = &I;
+        A.m_IsWrite = isa<StoreInst>(I);
+        A.m_Base = getLoadStorePointerOperand(&I)->stripPointerCasts();
+        A.m_Subscripts.push_back(Subscript());
+      }
+      Nest.m_Accesses.push_back(A);
+      AccessLoops.push_back(L);
+    }
+  }
+
+  for (unsigned i = 0; i < Nest.m_Accesses.size(); i++) {
+    for (unsigned j = i; j < Nest.m_Accesses.size(); j++) {
+      const NestAccess& A = Nest.m_Accesses[i];
+      const NestAccess& B = Nest.m_Accesses[j];
+      if (!A.m_IsWrite && !B.m_IsWrite)
+        continue;
+      // The loops around both are the ones containing the inner of the two
+      // innermost loops' headers
+      const UnitLoop* LA = AccessLoops[i];
+      const UnitLoop* LB = AccessLoops[j];
+      unsigned Common = 0;
+      for (const UnitLoop* L : Nest.m_Loops) {
+        if (L->contains(LA->m_Header) && L->contains(LB->m_Header))
+          Common++;
+      }
+      ArrayRef<UnitInduction> IndsA, IndsB;
+      if (Counted.at(LA) && Counted.at(LB)) {
+        IndsA = Chains.at(LA).m_Inds;
+        IndsB = Chains.at(LB).m_Inds;
+      }
+      if (Optional<Dependence> Dep = testDependence(A, IndsA, B, IndsB, Common, m_AA))
+        Nest.m_Deps.push_back(*Dep);
+    }
+  }
+}
+
+/// Main function for running the dependence analysis, which only sets up
+/// the loops to analyze
+UnitDependenceInfo UnitDependenceAnalysis::run(Function& F, FunctionAnalysisManager& FAM) {
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  AAResults& AA = FAM.getResult<AAManager>(F);
+  return UnitDependenceInfo(F, Loops, AA);
+}
+
+static void printDirections(raw_ostream& OS, const Dependence& Dep) {
+  OS << "[";
+  for (unsigned l = 0; l < Dep.m_Dirs.size(); l++) {
+    unsigned D = Dep.m_Dirs[l];
+    OS << (l ? " " : "");
+    if (Dep.m_Distances[l])
+      OS << *Dep.m_Distances[l];
+    else
+      OS << (D == DirAll ? "*" : "") << (D != DirAll && (D & DirLT) ? "<" : "")
+         << (D != DirAll && (D & DirEQ) ? "=" : "") << (D != DirAll && (D & DirGT) ? ">" : "");
+  }
+  OS << "]";
+}
+
+PreservedAnalyses UnitDependencePrinter::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitDependencePrinter running on " << F.getName() << "\n";
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  UnitDependenceInfo& Deps = FAM.getResult<UnitDependenceAnalysis>(F);
+  for (const UnitLoop& L : Loops.getLoops(F)) {
+    if (L.m_ParentHeader)
+      continue;
+    const NestDependences& Nest = Deps.getDependences(L.m_Header);
+    dbgs() << "[UnitDependence] Nest " << L.m_Header->getName() << ": " << Nest.m_Accesses.size()
+           << " accesses\n";
+    for (const Dependence& Dep : Nest.m_Deps) {
+      dbgs() << "  " << *Dep.m_Src << "\n  " << *Dep.m_Dst << "\n    ";
+      printDirections(dbgs(), Dep);
+      dbgs() << "\n";
+    }
+    for (Instruction* I : Nest.m_Unknown)
+      dbgs() << "  unknown: " << *I << "\n";
+    for (const UnitLoop* Inner : Nest.m_Loops) {
+      if (!Deps.isLoopCarried(Inner->m_Header))
+        dbgs() << "  no carried dependences in " << Inner->m_Header->getName() << "\n";
+    }
+  }
+  return PreservedAnalyses::all();
+}
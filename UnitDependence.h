@@ -0,0 +1,80 @@
+#ifndef INCLUDE_UNIT_DEPENDENCE_H
+#define INCLUDE_UNIT_DEPENDENCE_H
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/IR/PassManager.h"
+#include <unordered_map>
+#include <vector>
+
+#include "UnitLoopInfo.h"
+#include "UnitLoopNest.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// The memory accesses of a loop nest of any shape and the dependences
+/// between them
+struct NestDependences {
+  // Loops of the nest, each before the loops inside it
+  std::vector<const UnitLoop*> m_Loops;
+  std::vector<NestAccess> m_Accesses;
+  // Possible dependences between two accesses of which one writes, with a
+  // direction for each loop around both
+  std::vector<Dependence> m_Deps;
+  // Instructions touching memory in some other way than plain loads and
+  // stores, which may depend on anything
+  std::vector<Instruction*> m_Unknown;
+};
+
+/// Whether Dep may relate two different iterations of L in the same iteration
+/// of the loops around L, where L is one of the loops around both accesses
+bool isCarriedBy(const Dependence& Dep, const UnitLoop& L);
+
+/// Dependences between the memory accesses in the loops of a function. The
+/// subscripts of an access are taken in the IVs of all loops around it,
+/// flattened subscripts are split into rows where that is provably right,
+/// and pairs of subscripts are compared with the ZIV, GCD, strong SIV and
+/// Banerjee tests. A nest is analyzed when one of its loops is first asked
+/// about, and kept until the function changes.
+class UnitDependenceInfo {
+public:
+  UnitDependenceInfo(Function& F, const UnitLoopInfo& Loops, AAResults& AA);
+
+  // Dependences of the outermost loop around the loop with header Header
+  const NestDependences& getDependences(BasicBlock* Header);
+
+  // Whether two different iterations of the loop with header Header may touch
+  // the same memory in the same iteration of the loops around it
+  bool isLoopCarried(BasicBlock* Header);
+
+  bool invalidate(Function& F, const PreservedAnalyses& PA, FunctionAnalysisManager::Invalidator& Inv);
+
+private:
+  void analyzeNest(const UnitLoop& Outermost, NestDependences& Nest);
+
+  AAResults& m_AA;
+  const DataLayout& m_DL;
+  std::vector<UnitLoop> m_AllLoops;
+  std::unordered_map<BasicBlock*, const UnitLoop*> m_LoopOfHeader;
+  // Analyzed nests by the header of their outermost loop
+  std::unordered_map<BasicBlock*, NestDependences> m_Nests;
+};
+
+/// Dependence Analysis Pass. Produces a UnitDependenceInfo, which analyzes
+/// the loop nests it is asked about
+class UnitDependenceAnalysis : public AnalysisInfoMixin<UnitDependenceAnalysis> {
+  friend AnalysisInfoMixin<UnitDependenceAnalysis>;
+  static AnalysisKey Key;
+
+public:
+  typedef UnitDependenceInfo Result;
+
+  UnitDependenceInfo run(Function& F, FunctionAnalysisManager& FAM);
+};
+
+/// Prints the dependences of every loop nest of a function
+struct UnitDependencePrinter : PassInfoMixin<UnitDependencePrinter> {
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_DEPENDENCE_H
@@ -0,0 +1,153 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-func-spec"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+#include "UnitFuncSpec.h"
+#include "UnitLoopInfo.h"
+#include "UnitSCCP.h"
+
+#define DEBUG_TYPE "UnitFuncSpec"
+// Define any statistics here
+STATISTIC(NumSpecializations, "Number of specialized function clones created");
+STATISTIC(NumCallSitesRedirected, "Number of call sites redirected to a clone");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// Constant value of every argument at a call site, nullptr where unknown
+typedef std::vector<Constant*> ArgConstants;
+typedef std::pair<Function*, ArgConstants> SpecKey;
+
+// A call site inside a loop stands for many dynamic calls
+const unsigned LoopCallSiteWeight = 8;
+// Calls inside a clone may only become constant once SCCP ran on it, so
+// specialization is repeated on the new call sites a bounded number of times
+const unsigned MaxRounds = 4;
+} // namespace
+
+/// The argument lattice at a call site, as the UnitSCCP solver sees it in
+/// the caller. Byval, inalloca and preallocated arguments are private copies
+/// of what the pointer passed points to, so the pointer can't replace them.
+static ArgConstants getArgConstants(CallBase* CB, const std::unordered_map<CallBase*, ArgConstants>& Lattice) {
+  auto it = Lattice.find(CB);
+  ArgConstants Args = it == Lattice.end() ? ArgConstants(CB->arg_size(), nullptr) : it->second;
+  Function* Callee = CB->getCalledFunction();
+  for (unsigned i = 0; i < Args.size(); i++) {
+    if (Callee->getArg(i)->hasPassPointeeByValueCopyAttr())
+      Args[i] = nullptr;
+  }
+  return Args;
+}
+
+static bool isSpecializable(Function& F) {
+  return !F.isDeclaration() && !F.isVarArg() && !F.hasOptNone() && !F.hasMinSize() &&
+         !F.hasFnAttribute(Attribute::NoDuplicate);
+}
+
+// Cloning only pays off if one of the constants is actually used by F
+static bool hasUsefulConstant(Function& F, const ArgConstants& Args) {
+  for (unsigned i = 0; i < Args.size(); i++) {
+    if (Args[i] && !F.getArg(i)->use_empty())
+      return true;
+  }
+  return false;
+}
+
+/// Main function for running the function specialization
+PreservedAnalyses UnitFuncSpec::run(Module& M, ModuleAnalysisManager& MAM) {
+  dbgs() << "UnitFuncSpec running on " << M.getName() << "\n";
+  FunctionAnalysisManager& FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  std::map<SpecKey, Function*> Clones;
+  std::unordered_map<Function*, unsigned> NumClones;
+  unsigned Budget = m_Budget;
+  bool Changed = false;
+
+  for (unsigned Round = 0; Round < MaxRounds; Round++) {
+    // Group the direct call sites by callee and constant arguments, in module
+    // order so the result doesn't depend on pointer values
+    std::vector<SpecKey> Keys;
+    std::map<SpecKey, std::vector<CallBase*>> CallSites;
+    std::map<SpecKey, unsigned> Hotness;
+    for (Function& Caller : M) {
+      if (Caller.isDeclaration())
+        continue;
+      UnitLoopInfo* Loops = nullptr;
+      Optional<std::unordered_map<CallBase*, ArgConstants>> Lattice;
+      for (Instruction& I : instructions(Caller)) {
+        auto* CB = dyn_cast<CallBase>(&I);
+        Function* Callee = CB ? CB->getCalledFunction() : nullptr;
+        if (!Callee || !isSpecializable(*Callee) ||
+            CB->getFunctionType() != Callee->getFunctionType())
+          continue;
+        if (!Lattice)
+          Lattice = solveCallArguments(Caller, FAM);
+        ArgConstants Args = getArgConstants(CB, *Lattice);
+        if (!hasUsefulConstant(*Callee, Args))
+          continue;
+        if (!Loops)
+          Loops = &FAM.getResult<UnitLoopAnalysis>(Caller);
+        SpecKey Key = {Callee, Args};
+        if (!CallSites.count(Key))
+          Keys.push_back(Key);
+        CallSites[Key].push_back(CB);
+        Hotness[Key] += Loops->isLoopMember(CB->getParent()) ? LoopCallSiteWeight : 1;
+      }
+    }
+
+    std::stable_sort(Keys.begin(), Keys.end(), [&](const SpecKey& A, const SpecKey& B) {
+      return Hotness[A] > Hotness[B];
+    });
+
+    bool RoundChanged = false;
+    for (SpecKey& Key : Keys) {
+      Function* F = Key.first;
+      Function*& Clone = Clones[Key];
+      if (!Clone) {
+        if (F->getInstructionCount() > Budget || NumClones[F] >= m_MaxClones)
+          continue;
+
+        ValueToValueMapTy VMap;
+        Clone = CloneFunction(F, VMap);
+        Clone->setName(F->getName() + ".spec");
+        Clone->setLinkage(GlobalValue::InternalLinkage);
+        for (unsigned i = 0; i < Key.second.size(); i++) {
+          if (Key.second[i])
+            Clone->getArg(i)->replaceAllUsesWith(Key.second[i]);
+        }
+        FAM.invalidate(*Clone, PreservedAnalyses::none());
+        PreservedAnalyses PA = UnitSCCP().run(*Clone, FAM);
+        FAM.invalidate(*Clone, PA);
+
+        // Charge what the clone costs after folding, not what it started as
+        Budget -= std::min(Budget, Clone->getInstructionCount());
+        NumClones[F]++;
+        NumSpecializations++;
+        dbgs() << "[UnitFuncSpec] Specialized " << F->getName() << " as " << Clone->getName()
+               << " for " << CallSites[Key].size() << " call site(s)\n";
+      }
+      for (CallBase* CB : CallSites[Key]) {
+        CB->setCalledFunction(Clone);
+        NumCallSitesRedirected++;
+      }
+      RoundChanged = true;
+    }
+    if (!RoundChanged)
+      break;
+    Changed = true;
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  return PreservedAnalyses::none();
+}
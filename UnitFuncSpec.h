@@ -0,0 +1,24 @@
+#ifndef INCLUDE_UNIT_FUNC_SPEC_H
+#define INCLUDE_UNIT_FUNC_SPEC_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Function Specialization Pass. Clones functions for the constant argument
+/// combinations they are most frequently called with, so UnitSCCP can fold
+/// the clones' bodies.
+struct UnitFuncSpec : PassInfoMixin<UnitFuncSpec> {
+  UnitFuncSpec(unsigned Budget = 2000, unsigned MaxClones = 4)
+      : m_Budget(Budget), m_MaxClones(MaxClones) {}
+
+  PreservedAnalyses run(Module& M, ModuleAnalysisManager& MAM);
+
+  // Upper bound on the number of instructions all clones may add
+  unsigned m_Budget;
+  // Upper bound on the number of clones made of a single function
+  unsigned m_MaxClones;
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_FUNC_SPEC_H
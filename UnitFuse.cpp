@@ -0,0 +1,187 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-fuse"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include <unordered_map>
+
+#include "UnitFuse.h"
+#include "UnitLoopInfo.h"
+#include "UnitLoopNest.h"
+
+#define DEBUG_TYPE "UnitFuse"
+// Define any statistics here
+STATISTIC(NumLoopsFused, "Number of loops fused into their predecessor");
+
+using namespace llvm;
+using namespace cs426;
+
+/// Whether the loop is a top-tested counted loop with a separate latch that
+/// only branches back, the shape the fused loop is stitched together from
+static bool isFusableLoop(const UnitLoop& L, const UnitInduction& Ind) {
+  if (!L.isInnermost() || Ind.m_ExitingBlock != L.m_Header || L.getLatch() == L.m_Header)
+    return false;
+  // The directions of the dependence test are those of the IV values, which
+  // only match the iteration order for increasing IVs
+  if (Ind.m_Next->getOpcode() != Instruction::Add || !Ind.m_Step.isStrictlyPositive())
+    return false;
+  auto* BI = dyn_cast<BranchInst>(L.getLatch()->getTerminator());
+  return BI && BI->isUnconditional() && Ind.m_InLoopSucc->getSinglePredecessor() == L.m_Header;
+}
+
+/// Whether both loops run their bodies the same number of times with the
+/// same IV values
+static bool haveSameRange(const UnitInduction& A, const UnitInduction& B) {
+  auto getContinuePred = [](const UnitInduction& Ind) {
+    return Ind.m_ExitOnTrue ? ICmpInst::getInversePredicate(Ind.m_Pred) : Ind.m_Pred;
+  };
+  return A.m_IV->getType() == B.m_IV->getType() && A.m_Start == B.m_Start && A.m_Bound == B.m_Bound &&
+         A.m_Step == B.m_Step && A.m_ComparesNext == B.m_ComparesNext && getContinuePred(A) == getContinuePred(B);
+}
+
+/// Check that Second can run its iteration i right after iteration i of
+/// First. Second may not read any value First computes, and no access of
+/// Second may touch memory that First touches in a later iteration (when
+/// one of them writes).
+static bool canFuse(const UnitLoop& First, const UnitInduction& FirstInd, const UnitLoop& Second,
+                    const UnitInduction& SecondInd, AAResults& AA, const DataLayout& DL) {
+  // Second's header runs once more than its body and goes away with its exit
+  // test, so it may hold nothing else
+  if (!SecondInd.m_Cmp->hasOneUse())
+    return false;
+  for (Instruction& I : *Second.m_Header) {
+    if (!isa<PHINode>(I) && &I != SecondInd.m_Cmp && !I.isTerminator())
+      return false;
+  }
+  for (BasicBlock* BB : Second.m_Blocks) {
+    for (Instruction& I : *BB) {
+      for (Value* Op : I.operands()) {
+        auto* OpI = dyn_cast<Instruction>(Op);
+        if (OpI && First.contains(OpI->getParent()))
+          return false;
+      }
+      // Only the header phis still dominate the exit of the fused loop
+      if (isa<PHINode>(I) && BB == Second.m_Header)
+        continue;
+      for (User* U : I.users()) {
+        if (!Second.contains(cast<Instruction>(U)->getParent()))
+          return false;
+      }
+    }
+  }
+
+  LoopNest FirstNest, SecondNest;
+  FirstNest.m_Loops.push_back(&First);
+  FirstNest.m_Inds.push_back(FirstInd);
+  SecondNest.m_Loops.push_back(&Second);
+  SecondNest.m_Inds.push_back(SecondInd);
+  if (!collectNestAccesses(FirstNest, DL) || !collectNestAccesses(SecondNest, DL))
+    return false;
+  // Both IVs take the same values, so the subscripts of the two loops are
+  // compared as if they were over the same one
+  for (const NestAccess& A : FirstNest.m_Accesses) {
+    for (const NestAccess& B : SecondNest.m_Accesses) {
+      if (!A.m_IsWrite && !B.m_IsWrite)
+        continue;
+      Optional<DirectionVector> Dirs = getDependence(FirstNest, A, B, AA);
+      if (Dirs && ((*Dirs)[0] & DirGT))
+        return false;
+    }
+  }
+  return true;
+}
+
+/// Run the body of Second after the body of First in each iteration of
+/// First, and let First's header leave to where Second's header did
+static void fuseLoops(const UnitLoop& First, const UnitInduction& FirstInd, const UnitLoop& Second,
+                      const UnitInduction& SecondInd) {
+  BasicBlock* Header = First.m_Header;
+  BasicBlock* Preheader = First.getLoopPredecessor();
+  BasicBlock* FirstLatch = First.getLatch();
+  BasicBlock* Between = FirstInd.m_ExitBlock;
+  BasicBlock* SecondHeader = Second.m_Header;
+  BasicBlock* SecondLatch = Second.getLatch();
+  BasicBlock* SecondBody = SecondInd.m_InLoopSucc;
+  BasicBlock* Exit = SecondInd.m_ExitBlock;
+
+  SecondBody->replacePhiUsesWith(SecondHeader, FirstLatch);
+
+  // First latch -> Second body, Second latch -> First header
+  FirstLatch->getTerminator()->setSuccessor(0, SecondBody);
+  SecondLatch->getTerminator()->setSuccessor(0, Header);
+  Header->replacePhiUsesWith(FirstLatch, SecondLatch);
+
+  SecondInd.m_IV->replaceAllUsesWith(FirstInd.m_IV);
+  SecondInd.m_Next->replaceAllUsesWith(FirstInd.m_Next);
+  SecondInd.m_IV->eraseFromParent();
+  Instruction* FirstNonPHI = Header->getFirstNonPHI();
+  for (PHINode& Phi : make_early_inc_range(SecondHeader->phis())) {
+    Phi.replaceIncomingBlockWith(Between, Preheader);
+    Phi.moveBefore(FirstNonPHI);
+  }
+
+  auto* HeaderBranch = cast<BranchInst>(Header->getTerminator());
+  for (unsigned i = 0; i < HeaderBranch->getNumSuccessors(); i++) {
+    if (HeaderBranch->getSuccessor(i) == Between)
+      HeaderBranch->setSuccessor(i, Exit);
+  }
+  Exit->replacePhiUsesWith(SecondHeader, Header);
+
+  Between->eraseFromParent();
+  SecondHeader->eraseFromParent();
+  SecondInd.m_Next->eraseFromParent();
+}
+
+/// Fuse the first pair of adjacent loops found in F
+static bool fuseAdjacentPair(Function& F, FunctionAnalysisManager& FAM) {
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  AAResults& AA = FAM.getResult<AAManager>(F);
+  const DataLayout& DL = F.getParent()->getDataLayout();
+
+  std::vector<UnitLoop> AllLoops = Loops.getLoops(F);
+  std::unordered_map<BasicBlock*, const UnitLoop*> LoopOfHeader;
+  for (const UnitLoop& L : AllLoops)
+    LoopOfHeader[L.m_Header] = &L;
+
+  for (const UnitLoop& Second : AllLoops) {
+    // Nothing may run between the loops: First's exit only branches to
+    // Second's header
+    BasicBlock* Between = Second.getLoopPredecessor();
+    if (!Between || Between->size() != 1 || !Between->getSinglePredecessor())
+      continue;
+    auto it = LoopOfHeader.find(Between->getSinglePredecessor());
+    if (it == LoopOfHeader.end() || it->second == &Second)
+      continue;
+    const UnitLoop& First = *it->second;
+    UnitInduction FirstInd, SecondInd;
+    if (!analyzeInduction(First, FirstInd) || !analyzeInduction(Second, SecondInd))
+      continue;
+    if (FirstInd.m_ExitBlock != Between || !First.getLoopPredecessor())
+      continue;
+    if (!isFusableLoop(First, FirstInd) || !isFusableLoop(Second, SecondInd) || !haveSameRange(FirstInd, SecondInd))
+      continue;
+    if (!canFuse(First, FirstInd, Second, SecondInd, AA, DL))
+      continue;
+
+    dbgs() << "[UnitFuse] Fusing loop " << Second.m_Header->getName() << " into " << First.m_Header->getName()
+           << "\n";
+    fuseLoops(First, FirstInd, Second, SecondInd);
+    NumLoopsFused++;
+    return true;
+  }
+  return false;
+}
+
+/// Main function for running the fusion
+PreservedAnalyses UnitFuse::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitFuse running on " << F.getName() << "\n";
+  // A fused loop may be fused again with the loop after it, so the loops are
+  // identified again after every fusion
+  bool Changed = false;
+  while (fuseAdjacentPair(F, FAM)) {
+    FAM.invalidate(F, PreservedAnalyses::none());
+    Changed = true;
+  }
+  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
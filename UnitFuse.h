@@ -0,0 +1,17 @@
+#ifndef INCLUDE_UNIT_FUSE_H
+#define INCLUDE_UNIT_FUSE_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop Fusion Pass. Merges adjacent innermost loops that run over the same
+/// range into a single loop, so data the first loop touches is reused by the
+/// second while it is still in cache, as long as no dependence between the
+/// loops would be reversed.
+struct UnitFuse : PassInfoMixin<UnitFuse> {
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_FUSE_H
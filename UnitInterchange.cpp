@@ -0,0 +1,138 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-interchange"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <numeric>
+#include <unordered_set>
+
+#include "UnitInterchange.h"
+#include "UnitLoopInfo.h"
+#include "UnitLoopNest.h"
+
+#define DEBUG_TYPE "UnitInterchange"
+// Define any statistics here
+STATISTIC(NumNestsInterchanged, "Number of loop nests reordered");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// Nests deeper than this aren't reordered, the number of permutations grows
+// too quickly
+const unsigned MaxNestDepth = 4;
+} // namespace
+
+/// Bytes of cache lines the accesses move through per iteration of the loop
+/// at every position of the permuted nest, innermost position first
+static std::vector<uint64_t> getCost(const LoopNest& Nest, const std::vector<unsigned>& Perm) {
+  std::vector<uint64_t> Cost;
+  for (unsigned Pos = Perm.size(); Pos-- > 0;) {
+    unsigned Level = Perm[Pos];
+    uint64_t Bytes = 0;
+    // A new line every iteration once the stride reaches the line size
+    for (const NestAccess& A : Nest.m_Accesses)
+      Bytes += std::min(getAccessStride(A, Level), CacheLineSize);
+    Cost.push_back(Bytes);
+  }
+  return Cost;
+}
+
+/// Reorder the nest so that position t iterates over the range of the loop
+/// at level Perm[t]. The loops keep their blocks, they just trade their
+/// ranges and the IVs the body uses.
+static void permuteNest(LoopNest& Nest, const std::vector<unsigned>& Perm) {
+  struct Range {
+    Value* m_Start;
+    APInt m_Step;
+    Value* m_Bound;
+    ICmpInst::Predicate m_ContinuePred;
+    bool m_NSW;
+    bool m_NUW;
+  };
+  std::vector<Range> Ranges;
+  std::vector<std::vector<Use*>> BodyUses;
+  for (UnitInduction& Ind : Nest.m_Inds) {
+    ICmpInst::Predicate Pred = Ind.m_ExitOnTrue ? ICmpInst::getInversePredicate(Ind.m_Pred) : Ind.m_Pred;
+    Ranges.push_back({Ind.m_Start, Ind.m_Step, Ind.m_Bound, Pred, Ind.m_Next->hasNoSignedWrap(),
+                      Ind.m_Next->hasNoUnsignedWrap()});
+    BodyUses.emplace_back();
+    for (Use& U : Ind.m_IV->uses()) {
+      if (U.getUser() != Ind.m_Next && U.getUser() != Ind.m_Cmp)
+        BodyUses.back().push_back(&U);
+    }
+  }
+
+  for (unsigned Pos = 0; Pos < Perm.size(); Pos++) {
+    UnitInduction& Ind = Nest.m_Inds[Pos];
+    const Range& R = Ranges[Perm[Pos]];
+    PHINode* IV = Ind.m_IV;
+    IV->setIncomingValueForBlock(Nest.m_Loops[Pos]->getLoopPredecessor(), R.m_Start);
+    Ind.m_Next->setOperand(Ind.m_Next->getOperand(0) == IV ? 1 : 0, ConstantInt::get(IV->getType(), R.m_Step));
+    Ind.m_Next->setHasNoSignedWrap(R.m_NSW);
+    Ind.m_Next->setHasNoUnsignedWrap(R.m_NUW);
+    Ind.m_Cmp->setOperand(0, IV);
+    Ind.m_Cmp->setOperand(1, R.m_Bound);
+    Ind.m_Cmp->setPredicate(Ind.m_ExitOnTrue ? ICmpInst::getInversePredicate(R.m_ContinuePred) : R.m_ContinuePred);
+    for (Use* U : BodyUses[Perm[Pos]])
+      U->set(IV);
+  }
+}
+
+/// Main function for running the interchange
+PreservedAnalyses UnitInterchange::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitInterchange running on " << F.getName() << "\n";
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  AAResults& AA = FAM.getResult<AAManager>(F);
+  const DataLayout& DL = F.getParent()->getDataLayout();
+
+  std::vector<UnitLoop> AllLoops = Loops.getLoops(F);
+  std::unordered_map<BasicBlock*, const UnitLoop*> LoopOfHeader;
+  for (const UnitLoop& L : AllLoops)
+    LoopOfHeader[L.m_Header] = &L;
+
+  // Outermost loops first, a nest is only reordered as a whole
+  std::unordered_set<BasicBlock*> InNest;
+  bool Changed = false;
+  for (auto it = AllLoops.rbegin(); it != AllLoops.rend(); ++it) {
+    LoopNest Nest;
+    if (InNest.count(it->m_Header) || !buildPerfectNest(*it, LoopOfHeader, MaxNestDepth, DL, Nest))
+      continue;
+    for (const UnitLoop* L : Nest.m_Loops)
+      InNest.insert(L->m_Header);
+
+    std::vector<DirectionVector> Deps = getNestDependences(Nest, AA);
+
+    std::vector<unsigned> Perm(Nest.getDepth());
+    std::iota(Perm.begin(), Perm.end(), 0);
+    std::vector<unsigned> Best = Perm;
+    std::vector<uint64_t> BestCost = getCost(Nest, Perm);
+    while (std::next_permutation(Perm.begin(), Perm.end())) {
+      std::vector<uint64_t> Cost = getCost(Nest, Perm);
+      if (Cost < BestCost && isLegalPermutation(Deps, Perm)) {
+        Best = Perm;
+        BestCost = Cost;
+      }
+    }
+    if (std::is_sorted(Best.begin(), Best.end()))
+      continue;
+
+    dbgs() << "[UnitInterchange] Reordering nest at " << it->m_Header->getName() << " to";
+    for (unsigned Level : Best)
+      dbgs() << " " << Nest.m_Inds[Level].m_IV->getName();
+    dbgs() << "\n";
+    permuteNest(Nest, Best);
+    NumNestsInterchanged++;
+    Changed = true;
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  // Only loop bounds and IV uses changed, the CFG is untouched
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  PA.preserve<UnitLoopAnalysis>();
+  return PA;
+}
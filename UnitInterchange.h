@@ -0,0 +1,16 @@
+#ifndef INCLUDE_UNIT_INTERCHANGE_H
+#define INCLUDE_UNIT_INTERCHANGE_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop Interchange Pass. Reorders the loops of perfect, rectangular loop
+/// nests so the innermost loop walks memory with the smallest stride, as far
+/// as the dependences between the memory accesses of the nest allow.
+struct UnitInterchange : PassInfoMixin<UnitInterchange> {
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_INTERCHANGE_H
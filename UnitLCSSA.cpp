@@ -0,0 +1,92 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-loop-simplify,unit-lcssa"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+
+#include "UnitLCSSA.h"
+#include "UnitLoopInfo.h"
+
+#define DEBUG_TYPE "UnitLCSSA"
+// Define any statistics here
+STATISTIC(NumLCSSAPhis, "Number of loop-closing phis inserted");
+
+using namespace llvm;
+using namespace cs426;
+
+/// Whether U is a use of its value after the loop. Phis use their incoming
+/// values at the end of the incoming block, so the phis of the exit blocks
+/// already close the loop.
+static bool isUsedOutside(const UnitLoop& L, const Use& U) {
+  auto* User = cast<Instruction>(U.getUser());
+  if (auto* Phi = dyn_cast<PHINode>(User))
+    return !L.contains(Phi->getIncomingBlock(U));
+  return !L.contains(User->getParent());
+}
+
+/// Put phis for the values of L used after it into the exit blocks they
+/// dominate, and rewrite the uses to go through them
+static bool formLCSSA(const UnitLoop& L, DominatorTree& DT) {
+  std::vector<BasicBlock*> Exits = L.getExitBlocks();
+  bool Changed = false;
+  for (BasicBlock* BB : L.m_Blocks) {
+    for (Instruction& I : *BB) {
+      if (I.getType()->isTokenTy())
+        continue;
+      std::vector<Use*> Uses;
+      for (Use& U : I.uses()) {
+        if (isUsedOutside(L, U))
+          Uses.push_back(&U);
+      }
+      if (Uses.empty())
+        continue;
+
+      SSAUpdater SSA;
+      SSA.Initialize(I.getType(), I.getName());
+      SSA.AddAvailableValue(BB, &I);
+      DenseMap<BasicBlock*, PHINode*> ExitPhis;
+      for (BasicBlock* Exit : Exits) {
+        if (!DT.dominates(BB, Exit))
+          continue;
+        PHINode* Phi = PHINode::Create(I.getType(), pred_size(Exit), I.getName() + ".lcssa", &Exit->front());
+        for (BasicBlock* Pred : predecessors(Exit))
+          Phi->addIncoming(&I, Pred);
+        SSA.AddAvailableValue(Exit, Phi);
+        ExitPhis[Exit] = Phi;
+        NumLCSSAPhis++;
+      }
+      for (Use* U : Uses) {
+        // The updater only looks at the predecessors for uses in the middle
+        // of a block, which would skip the phi at its top
+        auto* User = cast<Instruction>(U->getUser());
+        if (!isa<PHINode>(User) && ExitPhis.count(User->getParent()))
+          U->set(ExitPhis[User->getParent()]);
+        else
+          SSA.RewriteUse(*U);
+      }
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+/// Main function for running the LCSSA construction
+PreservedAnalyses UnitLCSSA::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitLCSSA running on " << F.getName() << "\n";
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  DominatorTree& DT = FAM.getResult<DominatorTreeAnalysis>(F);
+
+  // Inner loops first, so their phis are closed again for the loops around
+  bool Changed = false;
+  for (const UnitLoop& L : Loops.getLoops(F))
+    Changed |= formLCSSA(L, DT);
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  // Only phis were added
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  PA.preserve<UnitLoopAnalysis>();
+  return PA;
+}
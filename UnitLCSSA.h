@@ -0,0 +1,17 @@
+#ifndef INCLUDE_UNIT_LCSSA_H
+#define INCLUDE_UNIT_LCSSA_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop-Closed SSA Pass. Routes every value of a loop used after it through
+/// a phi in the loop's exit blocks, so transformations of the loop only
+/// have to update those phis. Works best on loops in unit-loop-simplify's
+/// form.
+struct UnitLCSSA : PassInfoMixin<UnitLCSSA> {
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_LCSSA_H
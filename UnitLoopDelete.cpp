@@ -0,0 +1,228 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-loop-delete"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "UnitLoopDelete.h"
+#include "UnitLoopInfo.h"
+
+#define DEBUG_TYPE "UnitLoopDelete"
+// Define any statistics here
+STATISTIC(NumExitValuesReplaced, "Number of loop values replaced by their closed form after the loop");
+STATISTIC(NumLoopsDeleted, "Number of loops deleted");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// Value of a header phi in iteration k (counting from 0) of its loop, which
+// is m_Init +/- m_Step * k for induction variables, and m_Init +/- the sum of
+// the first k values of m_Summed (or of its increment) for sums of those
+struct ClosedForm {
+  Value* m_Init = nullptr;
+  Value* m_Step = nullptr;
+  PHINode* m_Summed = nullptr;
+  bool m_SumsNext = false;
+  bool m_Negated = false;
+};
+
+/// Replaces the uses after a loop of its header phis and their increments by
+/// their closed forms, computed in the preheader
+class ExitValueRewriter {
+public:
+  ExitValueRewriter(const UnitLoop& L, const UnitInduction& Ind)
+      : m_Loop(L), m_Ind(Ind), m_Preheader(L.getPreheader()), m_Builder(L.getPreheader()->getTerminator()) {}
+
+  bool run();
+
+private:
+  bool isInvariant(Value* V) const {
+    auto* I = dyn_cast<Instruction>(V);
+    return !I || !m_Loop.contains(I->getParent());
+  }
+  void findClosedForms();
+  Value* getCount();
+  Value* evaluate(const ClosedForm& Form, Value* K);
+  bool replaceUsesOutside(Instruction* I, Value* V);
+
+  const UnitLoop& m_Loop;
+  const UnitInduction& m_Ind;
+  BasicBlock* m_Preheader;
+  IRBuilder<> m_Builder;
+  MapVector<PHINode*, ClosedForm> m_Forms;
+  // Iterations the loop completes before it leaves, in the IV's type
+  Value* m_Count = nullptr;
+};
+} // namespace
+
+Value* ExitValueRewriter::getCount() {
+  if (!m_Count)
+    m_Count = m_Ind.createCount(m_Builder);
+  return m_Count;
+}
+
+/// Recognize the integer header phis that step by a loop-invariant amount,
+/// and then the ones summing up those
+void ExitValueRewriter::findClosedForms() {
+  BasicBlock* Latch = m_Loop.getLatch();
+  auto getUpdate = [&](PHINode& Phi) -> std::pair<BinaryOperator*, Value*> {
+    auto* Update = dyn_cast<BinaryOperator>(Phi.getIncomingValueForBlock(Latch));
+    if (!Update || (Update->getOpcode() != Instruction::Add && Update->getOpcode() != Instruction::Sub))
+      return {nullptr, nullptr};
+    if (Update->getOperand(0) == &Phi)
+      return {Update, Update->getOperand(1)};
+    if (Update->getOpcode() == Instruction::Add && Update->getOperand(1) == &Phi)
+      return {Update, Update->getOperand(0)};
+    return {nullptr, nullptr};
+  };
+  for (PHINode& Phi : m_Loop.m_Header->phis()) {
+    auto [Update, Inc] = getUpdate(Phi);
+    if (Phi.getType()->isIntegerTy() && Update && isInvariant(Inc))
+      m_Forms[&Phi] = {Phi.getIncomingValueForBlock(m_Preheader), Inc, nullptr, false,
+                       Update->getOpcode() == Instruction::Sub};
+  }
+
+  // Sum += X, with X a recognized phi or its increment
+  for (PHINode& Phi : m_Loop.m_Header->phis()) {
+    auto [Update, Inc] = getUpdate(Phi);
+    if (!Phi.getType()->isIntegerTy() || !Update || m_Forms.count(&Phi))
+      continue;
+    PHINode* Summed = nullptr;
+    for (auto& [X, Form] : m_Forms) {
+      if (!Form.m_Summed && (Inc == X || Inc == X->getIncomingValueForBlock(Latch)))
+        Summed = X;
+    }
+    if (Summed)
+      m_Forms[&Phi] = {Phi.getIncomingValueForBlock(m_Preheader), nullptr, Summed, Inc != Summed,
+                       Update->getOpcode() == Instruction::Sub};
+  }
+}
+
+Value* ExitValueRewriter::evaluate(const ClosedForm& Form, Value* K) {
+  Type* Ty = Form.m_Init->getType();
+  Value* KTy = m_Builder.CreateZExtOrTrunc(K, Ty);
+  Value* Sum;
+  if (!Form.m_Summed) {
+    Sum = m_Builder.CreateMul(Form.m_Step, KTy);
+  } else {
+    // X(j) = XInit + XStep * j sums up to XInit * k + XStep * k * (k - 1) / 2,
+    // and k * (k - 1) needs twice the bits to be halved right modulo 2^Bits
+    const ClosedForm& X = m_Forms[Form.m_Summed];
+    Value* XStep = X.m_Negated ? m_Builder.CreateNeg(X.m_Step) : X.m_Step;
+    Value* XInit = Form.m_SumsNext ? m_Builder.CreateAdd(X.m_Init, XStep) : X.m_Init;
+    Type* WideTy = IntegerType::get(Ty->getContext(), 2 * Ty->getIntegerBitWidth());
+    // The count may be wider still, its low 2 * Bits bits are all that matter
+    Value* KWide = m_Builder.CreateZExtOrTrunc(K, WideTy);
+    Value* Pairs = m_Builder.CreateMul(KWide, m_Builder.CreateSub(KWide, ConstantInt::get(WideTy, 1)));
+    Pairs = m_Builder.CreateTrunc(m_Builder.CreateLShr(Pairs, 1), Ty);
+    Sum = m_Builder.CreateAdd(m_Builder.CreateMul(XInit, KTy), m_Builder.CreateMul(XStep, Pairs));
+  }
+  return Form.m_Negated ? m_Builder.CreateSub(Form.m_Init, Sum, "exit.val")
+                        : m_Builder.CreateAdd(Form.m_Init, Sum, "exit.val");
+}
+
+bool ExitValueRewriter::replaceUsesOutside(Instruction* I, Value* V) {
+  bool Changed = false;
+  for (Use& U : make_early_inc_range(I->uses())) {
+    auto* User = cast<Instruction>(U.getUser());
+    if (m_Loop.contains(User->getParent()))
+      continue;
+    U.set(V);
+    Changed = true;
+  }
+  return Changed;
+}
+
+/// The loop leaves in the iteration after the last passing exit test,
+/// where the phis hold their value for iteration Count and their
+/// increments (if already computed) the one for iteration Count + 1
+bool ExitValueRewriter::run() {
+  if (!m_Ind.isCountComputable())
+    return false;
+  findClosedForms();
+  bool Changed = false;
+  BasicBlock* Latch = m_Loop.getLatch();
+  for (auto& [Phi, Form] : m_Forms) {
+    auto isUsedOutside = [&](Value* V) {
+      return any_of(V->users(),
+                    [&](User* U) { return !m_Loop.contains(cast<Instruction>(U)->getParent()); });
+    };
+    auto* Update = cast<Instruction>(Phi->getIncomingValueForBlock(Latch));
+    if (isUsedOutside(Phi)) {
+      replaceUsesOutside(Phi, evaluate(Form, getCount()));
+      NumExitValuesReplaced++;
+      Changed = true;
+    }
+    if (isUsedOutside(Update)) {
+      Value* Next = m_Builder.CreateAdd(getCount(), ConstantInt::get(getCount()->getType(), 1));
+      replaceUsesOutside(Update, evaluate(Form, Next));
+      NumExitValuesReplaced++;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+/// Whether removing the loop can't be observed: it terminates, stores and
+/// calls nothing, and nothing after it uses its values
+static bool isDead(const UnitLoop& L) {
+  for (BasicBlock* BB : L.m_Blocks) {
+    for (Instruction& I : *BB) {
+      if (I.mayHaveSideEffects())
+        return false;
+      for (User* U : I.users()) {
+        if (!L.contains(cast<Instruction>(U)->getParent()))
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+static void deleteLoop(const UnitLoop& L, const UnitInduction& Ind) {
+  BasicBlock* Preheader = L.getPreheader();
+  Preheader->getTerminator()->replaceSuccessorWith(L.m_Header, Ind.m_ExitBlock);
+  Ind.m_ExitBlock->replacePhiUsesWith(Ind.m_ExitingBlock, Preheader);
+  for (BasicBlock* BB : L.m_Blocks)
+    BB->dropAllReferences();
+  for (BasicBlock* BB : L.m_Blocks)
+    BB->eraseFromParent();
+}
+
+/// Rewrite the exit values of all loops, and delete the first loop that
+/// turns out to be dead
+static bool processLoops(Function& F, FunctionAnalysisManager& FAM, bool& Changed) {
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  for (const UnitLoop& L : Loops.getLoops(F)) {
+    UnitInduction Ind;
+    if (!L.getPreheader() || !analyzeInduction(L, Ind))
+      continue;
+    ExitValueRewriter Rewriter(L, Ind);
+    if (Rewriter.run()) {
+      dbgs() << "[UnitLoopDelete] Replaced exit values of loop " << L.m_Header->getName() << "\n";
+      Changed = true;
+    }
+    if (L.isInnermost() && Ind.isCountComputable() && isDead(L)) {
+      dbgs() << "[UnitLoopDelete] Deleting loop " << L.m_Header->getName() << "\n";
+      deleteLoop(L, Ind);
+      NumLoopsDeleted++;
+      Changed = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Main function for running the loop deletion
+PreservedAnalyses UnitLoopDelete::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitLoopDelete running on " << F.getName() << "\n";
+  // Deleting a loop may leave the loop around it without effect, so the
+  // loops are identified again after every deletion
+  bool Changed = false;
+  while (processLoops(F, FAM, Changed))
+    FAM.invalidate(F, PreservedAnalyses::none());
+  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
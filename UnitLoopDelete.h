@@ -0,0 +1,17 @@
+#ifndef INCLUDE_UNIT_LOOP_DELETE_H
+#define INCLUDE_UNIT_LOOP_DELETE_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop Deletion Pass. Computes the values counted loops leave behind in
+/// their induction variables (and sums of them) in closed form in front of
+/// the loop, and deletes loops that then have no effect and are known to
+/// terminate.
+struct UnitLoopDelete : PassInfoMixin<UnitLoopDelete> {
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_LOOP_DELETE_H
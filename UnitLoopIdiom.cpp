@@ -0,0 +1,177 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-loop-idiom,unit-loop-delete"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "UnitLoopIdiom.h"
+#include "UnitLoopInfo.h"
+#include "UnitLoopNest.h"
+
+#define DEBUG_TYPE "UnitLoopIdiom"
+// Define any statistics here
+STATISTIC(NumMemsets, "Number of loops turned into memset");
+STATISTIC(NumMemcpys, "Number of loops turned into memcpy");
+
+using namespace llvm;
+using namespace cs426;
+
+/// Bytes the address of A moves per unit of the IV, None if that isn't a
+/// compile-time constant
+static Optional<int64_t> getByteStride(const NestAccess& A) {
+  int64_t Stride = 0;
+  for (const Subscript& S : A.m_Subscripts) {
+    if (!S.m_Known || (S.m_Scale && S.m_Coeffs[0]))
+      return None;
+    Stride += S.m_Coeffs[0] * (int64_t)S.m_ElemSize;
+  }
+  return Stride;
+}
+
+/// Compute V, a function of the IV inside L, in front of the loop for the
+/// IV value IVValue
+static Value* expandAt(const UnitLoop& L, Value* V, PHINode* IV, Value* IVValue, IRBuilder<>& Builder,
+                       DenseMap<Value*, Value*>& Expanded) {
+  if (V == IV)
+    return IVValue;
+  auto* I = dyn_cast<Instruction>(V);
+  if (!I || !L.contains(I->getParent()))
+    return V;
+  if (Value* E = Expanded.lookup(V))
+    return E;
+  Instruction* Clone = I->clone();
+  for (Use& U : Clone->operands())
+    U.set(expandAt(L, U.get(), IV, IVValue, Builder, Expanded));
+  // The address past the first element may lie outside the object when the
+  // loop doesn't run
+  if (auto* GEP = dyn_cast<GetElementPtrInst>(Clone))
+    GEP->setIsInBounds(false);
+  Builder.Insert(Clone, I->getName() + ".idiom");
+  Expanded[V] = Clone;
+  return Clone;
+}
+
+/// Replace the only store of L by a memset or memcpy if L stores to every
+/// address of a range once
+static bool recognizeIdiom(const UnitLoop& L, const UnitInduction& Ind, DominatorTree& DT, AAResults& AA,
+                           const DataLayout& DL) {
+  StoreInst* Store = nullptr;
+  LoadInst* Load = nullptr;
+  for (BasicBlock* BB : L.m_Blocks) {
+    for (Instruction& I : *BB) {
+      if (auto* SI = dyn_cast<StoreInst>(&I)) {
+        if (Store || !SI->isSimple())
+          return false;
+        Store = SI;
+      } else if (auto* LI = dyn_cast<LoadInst>(&I)) {
+        if (Load || !LI->isSimple())
+          return false;
+        Load = LI;
+      } else if (I.mayReadOrWriteMemory()) {
+        return false;
+      }
+    }
+  }
+  // The store runs in every iteration, and a load can only be the copied
+  // value since it would see the stored range filled early otherwise
+  if (!Store || !DT.dominates(Store->getParent(), L.getLatch()))
+    return false;
+  Value* Stored = Store->getValueOperand();
+  if (Load && (Stored != Load || !Load->hasOneUse() || Load->getParent() != Store->getParent()))
+    return false;
+
+  LoopNest Nest;
+  Nest.m_Loops.push_back(&L);
+  Nest.m_Inds.push_back(Ind);
+  if (!collectNestAccesses(Nest, DL))
+    return false;
+  uint64_t Size = DL.getTypeStoreSize(Stored->getType());
+  if (Size != DL.getTypeAllocSize(Stored->getType()))
+    return false;
+  // Consecutive iterations store to adjacent elements, in either direction
+  int64_t PerIteration = 0;
+  for (const NestAccess& A : Nest.m_Accesses) {
+    Optional<int64_t> Stride = getByteStride(A);
+    if (!Stride || !Nest.isInvariant(A.m_Base))
+      return false;
+    int64_t Step = *Stride * Ind.m_Step.getSExtValue();
+    if (std::abs(Step) != (int64_t)Size || (PerIteration && Step != PerIteration))
+      return false;
+    PerIteration = Step;
+  }
+  Value* ByteVal = nullptr;
+  if (!Load) {
+    ByteVal = Nest.isInvariant(Stored) ? isBytewiseValue(Stored, DL) : nullptr;
+    if (!ByteVal)
+      return false;
+  } else {
+    const NestAccess& Src = Nest.m_Accesses[0].m_Inst == Load ? Nest.m_Accesses[0] : Nest.m_Accesses[1];
+    const NestAccess& Dst = Nest.m_Accesses[0].m_Inst == Store ? Nest.m_Accesses[0] : Nest.m_Accesses[1];
+    if (!AA.isNoAlias(MemoryLocation::getBeforeOrAfter(Src.m_Base), MemoryLocation::getBeforeOrAfter(Dst.m_Base)))
+      return false;
+  }
+
+  // The store runs once per passing exit test, and once more if it comes
+  // before the test. The range starts at the first store, or at the last
+  // one when the loop runs downwards.
+  IRBuilder<> Builder(L.getPreheader()->getTerminator());
+  Type* IntPtrTy = DL.getIntPtrType(Builder.getContext());
+  Value* Count = Ind.createCount(Builder);
+  if (DT.dominates(Store->getParent(), Ind.m_ExitingBlock))
+    Count = Builder.CreateAdd(Count, ConstantInt::get(Count->getType(), 1), "idiom.count");
+  Value* IVValue = Ind.m_Start;
+  if (PerIteration < 0) {
+    Value* Last = Builder.CreateSub(Count, ConstantInt::get(Count->getType(), 1));
+    IVValue = Builder.CreateAdd(Ind.m_Start, Builder.CreateMul(Last, ConstantInt::get(Count->getType(), Ind.m_Step)),
+                                "idiom.iv");
+  }
+  Value* Bytes = Builder.CreateMul(Builder.CreateZExtOrTrunc(Count, IntPtrTy), ConstantInt::get(IntPtrTy, Size),
+                                   "idiom.bytes");
+  DenseMap<Value*, Value*> Expanded;
+  Value* Dst = expandAt(L, Store->getPointerOperand(), Ind.m_IV, IVValue, Builder, Expanded);
+  if (!Load) {
+    dbgs() << "[UnitLoopIdiom] Replacing loop " << L.m_Header->getName() << " by memset\n";
+    Builder.CreateMemSet(Dst, ByteVal, Bytes, Store->getAlign());
+    NumMemsets++;
+  } else {
+    dbgs() << "[UnitLoopIdiom] Replacing loop " << L.m_Header->getName() << " by memcpy\n";
+    Value* Src = expandAt(L, Load->getPointerOperand(), Ind.m_IV, IVValue, Builder, Expanded);
+    Builder.CreateMemCpy(Dst, Store->getAlign(), Src, Load->getAlign(), Bytes);
+    NumMemcpys++;
+  }
+  Store->eraseFromParent();
+  if (Load)
+    Load->eraseFromParent();
+  return true;
+}
+
+/// Main function for running the idiom recognition
+PreservedAnalyses UnitLoopIdiom::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitLoopIdiom running on " << F.getName() << "\n";
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  DominatorTree& DT = FAM.getResult<DominatorTreeAnalysis>(F);
+  AAResults& AA = FAM.getResult<AAManager>(F);
+  const DataLayout& DL = F.getParent()->getDataLayout();
+
+  bool Changed = false;
+  for (const UnitLoop& L : Loops.getLoops(F)) {
+    UnitInduction Ind;
+    if (!L.isInnermost() || !L.getPreheader() || !analyzeInduction(L, Ind) || !Ind.isCountComputable())
+      continue;
+    Changed |= recognizeIdiom(L, Ind, DT, AA, DL);
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  // Code in the preheaders and stores removed, the CFG is untouched
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  PA.preserve<UnitLoopAnalysis>();
+  return PA;
+}
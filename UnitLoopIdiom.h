@@ -0,0 +1,17 @@
+#ifndef INCLUDE_UNIT_LOOP_IDIOM_H
+#define INCLUDE_UNIT_LOOP_IDIOM_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop Idiom Recognition Pass. Replaces the store of counted loops that
+/// fill an array with a repeated byte, or copy one array to another, by a
+/// memset or memcpy in front of the loop. The loop itself is left for
+/// unit-loop-delete.
+struct UnitLoopIdiom : PassInfoMixin<UnitLoopIdiom> {
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_LOOP_IDIOM_H
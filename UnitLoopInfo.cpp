@@ -114,6 +114,312 @@ void printAllSubLoopLeadersReference(Loop* L) {
     }
 }
 
+bool UnitLoopInfo::isLoopMember(BasicBlock* BB) const {
+  return m_LoopMembers.count(BB);
+}
+
+std::vector<UnitLoop> UnitLoopInfo::getLoops(Function& F) const {
+  std::vector<UnitLoop> loops;
+  std::unordered_map<BasicBlock*, size_t> header_index;
+  for (BasicBlock& BB : F) {
+    auto it = m_HeaderLoopMeta.find(&BB);
+    if (it == m_HeaderLoopMeta.end()) {
+      continue;
+    }
+    LoopMeta* loop_meta = it->second;
+    UnitLoop L;
+    L.m_Header = &BB;
+    // Visit the back edges in predecessor order to stay deterministic
+    for (BasicBlock* pred : predecessors(&BB)) {
+      auto members = loop_meta->m_LoopMemberBlocks.find(pred);
+      if (members == loop_meta->m_LoopMemberBlocks.end() ||
+          std::find(L.m_Latches.begin(), L.m_Latches.end(), pred) != L.m_Latches.end()) {
+        continue;
+      }
+      L.m_Latches.push_back(pred);
+      L.m_BlockSet.insert(members->second.begin(), members->second.end());
+      auto parent = loop_meta->m_ParentLoopHeader.find(pred);
+      if (!L.m_ParentHeader && parent != loop_meta->m_ParentLoopHeader.end()) {
+        L.m_ParentHeader = parent->second;
+      }
+    }
+    header_index[&BB] = loops.size();
+    loops.push_back(std::move(L));
+  }
+
+  for (UnitLoop& L : loops) {
+    L.m_Blocks.push_back(L.m_Header);
+    for (BasicBlock& BB : F) {
+      if (&BB != L.m_Header && L.m_BlockSet.count(&BB)) {
+        L.m_Blocks.push_back(&BB);
+      }
+    }
+    if (L.m_ParentHeader) {
+      loops[header_index[L.m_ParentHeader]].m_SubLoopHeaders.push_back(L.m_Header);
+    }
+  }
+  for (UnitLoop& L : loops) {
+    for (BasicBlock* parent = L.m_ParentHeader; parent; parent = loops[header_index[parent]].m_ParentHeader) {
+      L.m_Depth++;
+    }
+  }
+
+  std::stable_sort(loops.begin(), loops.end(), [](const UnitLoop& A, const UnitLoop& B) {
+    return A.m_Depth > B.m_Depth;
+  });
+  return loops;
+}
+
+void UnitLoopInfo::addBlockOnEdges(BasicBlock* NewBB, ArrayRef<BasicBlock*> Preds, BasicBlock* Succ) {
+  for (auto& [header, loop_meta] : m_HeaderLoopMeta) {
+    for (auto& [back_src, member_set] : loop_meta->m_LoopMemberSets) {
+      if (member_set.count(Succ) && all_of(Preds, [&](BasicBlock* pred) { return member_set.count(pred); })) {
+        member_set.insert(NewBB);
+        loop_meta->m_LoopMemberBlocks[back_src].push_back(NewBB);
+        m_LoopMembers.insert(NewBB);
+      }
+    }
+  }
+}
+
+void UnitLoopInfo::mergeLatches(BasicBlock* Header, ArrayRef<BasicBlock*> Latches, BasicBlock* NewLatch) {
+  // The back edges of Header become one, with the members of all of them
+  LoopMeta* header_meta = m_HeaderLoopMeta.at(Header);
+  std::vector<BasicBlock*> merged;
+  std::unordered_set<BasicBlock*> merged_set;
+  BasicBlock* parent = nullptr;
+  for (BasicBlock* latch : Latches) {
+    for (BasicBlock* member : header_meta->m_LoopMemberBlocks[latch]) {
+      if (merged_set.insert(member).second) {
+        merged.push_back(member);
+      }
+    }
+    auto parent_it = header_meta->m_ParentLoopHeader.find(latch);
+    if (parent_it != header_meta->m_ParentLoopHeader.end()) {
+      parent = parent_it->second;
+      header_meta->m_ParentLoopHeader.erase(parent_it);
+    }
+    header_meta->m_LoopMemberBlocks.erase(latch);
+    header_meta->m_LoopMemberSets.erase(latch);
+  }
+  merged.push_back(NewLatch);
+  merged_set.insert(NewLatch);
+  header_meta->m_LoopMemberBlocks[NewLatch] = std::move(merged);
+  header_meta->m_LoopMemberSets[NewLatch] = std::move(merged_set);
+  m_LoopMembers.insert(NewLatch);
+  if (parent) {
+    header_meta->m_ParentLoopHeader[NewLatch] = parent;
+  }
+
+  // Loops around it get the new block too
+  for (auto& [header, loop_meta] : m_HeaderLoopMeta) {
+    if (header == Header) {
+      continue;
+    }
+    for (auto& [back_src, member_set] : loop_meta->m_LoopMemberSets) {
+      if (member_set.count(Header) && all_of(Latches, [&](BasicBlock* latch) { return member_set.count(latch); })) {
+        member_set.insert(NewLatch);
+        loop_meta->m_LoopMemberBlocks[back_src].push_back(NewLatch);
+      }
+    }
+  }
+}
+
+BasicBlock* UnitLoop::getLatch() const {
+  return m_Latches.size() == 1 ? m_Latches.front() : nullptr;
+}
+
+BasicBlock* UnitLoop::getLoopPredecessor() const {
+  BasicBlock* entering = nullptr;
+  for (BasicBlock* pred : predecessors(m_Header)) {
+    if (contains(pred)) {
+      continue;
+    }
+    if (entering && entering != pred) {
+      return nullptr;
+    }
+    entering = pred;
+  }
+  return entering;
+}
+
+BasicBlock* UnitLoop::getPreheader() const {
+  BasicBlock* preheader = getLoopPredecessor();
+  if (!preheader || preheader->getTerminator()->getNumSuccessors() != 1) {
+    return nullptr;
+  }
+  return preheader;
+}
+
+std::vector<BasicBlock*> UnitLoop::getExitingBlocks() const {
+  std::vector<BasicBlock*> exiting;
+  for (BasicBlock* BB : m_Blocks) {
+    for (BasicBlock* succ : successors(BB)) {
+      if (!contains(succ)) {
+        exiting.push_back(BB);
+        break;
+      }
+    }
+  }
+  return exiting;
+}
+
+std::vector<BasicBlock*> UnitLoop::getExitBlocks() const {
+  std::vector<BasicBlock*> exits;
+  for (BasicBlock* BB : m_Blocks) {
+    for (BasicBlock* succ : successors(BB)) {
+      if (!contains(succ) && std::find(exits.begin(), exits.end(), succ) == exits.end()) {
+        exits.push_back(succ);
+      }
+    }
+  }
+  return exits;
+}
+
+bool UnitLoop::isSafeToClone() const {
+  for (BasicBlock* BB : m_Blocks) {
+    if (isa<IndirectBrInst>(BB->getTerminator()) || isa<CallBrInst>(BB->getTerminator())) {
+      return false;
+    }
+    for (Instruction& I : *BB) {
+      if (I.getType()->isTokenTy()) {
+        return false;
+      }
+      if (auto* CB = dyn_cast<CallBase>(&I); CB && (CB->cannotDuplicate() || CB->isConvergent())) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+unsigned UnitLoop::getSize() const {
+  unsigned size = 0;
+  for (BasicBlock* BB : m_Blocks) {
+    size += BB->size();
+  }
+  return size;
+}
+
+bool cs426::analyzeInduction(const UnitLoop& L, UnitInduction& Ind) {
+  BasicBlock* latch = L.getLatch();
+  BasicBlock* entering = L.getLoopPredecessor();
+  std::vector<BasicBlock*> exiting = L.getExitingBlocks();
+  // The exit test has to run exactly once per iteration
+  if (!latch || !entering || exiting.size() != 1 ||
+      (exiting[0] != L.m_Header && exiting[0] != latch)) {
+    return false;
+  }
+  auto* BI = dyn_cast<BranchInst>(exiting[0]->getTerminator());
+  if (!BI || !BI->isConditional()) {
+    return false;
+  }
+  auto* cmp = dyn_cast<ICmpInst>(BI->getCondition());
+  if (!cmp) {
+    return false;
+  }
+
+  for (unsigned op = 0; op < 2; op++) {
+    Value* bound = cmp->getOperand(1 - op);
+    auto* bound_inst = dyn_cast<Instruction>(bound);
+    if (bound_inst && L.contains(bound_inst->getParent())) {
+      continue;
+    }
+
+    // The compared value is either the header PHI or its increment
+    Value* compared = cmp->getOperand(op);
+    auto* IV = dyn_cast<PHINode>(compared);
+    bool compares_next = !IV;
+    if (compares_next) {
+      auto* next = dyn_cast<BinaryOperator>(compared);
+      IV = next ? dyn_cast<PHINode>(next->getOperand(0)) : nullptr;
+    }
+    if (!IV || IV->getParent() != L.m_Header || IV->getNumIncomingValues() != 2 ||
+        !IV->getType()->isIntegerTy()) {
+      continue;
+    }
+    auto* next = dyn_cast<BinaryOperator>(IV->getIncomingValueForBlock(latch));
+    if (!next || (compares_next && next != compared) || next->getOperand(0) != IV) {
+      continue;
+    }
+    auto* step = dyn_cast<ConstantInt>(next->getOperand(1));
+    if (!step || (next->getOpcode() != Instruction::Add && next->getOpcode() != Instruction::Sub)) {
+      continue;
+    }
+
+    Ind.m_IV = IV;
+    Ind.m_Start = IV->getIncomingValueForBlock(entering);
+    Ind.m_Next = next;
+    Ind.m_Step = next->getOpcode() == Instruction::Add ? step->getValue() : -step->getValue();
+    Ind.m_Cmp = cmp;
+    Ind.m_Bound = bound;
+    Ind.m_Pred = op == 0 ? cmp->getPredicate() : cmp->getSwappedPredicate();
+    Ind.m_ComparesNext = compares_next;
+    Ind.m_ExitOnTrue = !L.contains(BI->getSuccessor(0));
+    Ind.m_ExitingBlock = exiting[0];
+    Ind.m_ExitBlock = BI->getSuccessor(Ind.m_ExitOnTrue ? 0 : 1);
+    Ind.m_InLoopSucc = BI->getSuccessor(Ind.m_ExitOnTrue ? 1 : 0);
+    return !L.contains(Ind.m_ExitBlock) && L.contains(Ind.m_InLoopSucc);
+  }
+  return false;
+}
+
+/// The exit test passes for IV values running from the start (one step
+/// further when the test looks at the increment) towards the bound. Strides
+/// other than 1 and inclusive bounds only terminate when the IV can't wrap.
+bool UnitInduction::isCountComputable() const {
+  ICmpInst::Predicate Pred = m_ExitOnTrue ? ICmpInst::getInversePredicate(m_Pred) : m_Pred;
+  bool Up = m_Step.isStrictlyPositive();
+  bool NoWrap = ICmpInst::isSigned(Pred) ? m_Next->hasNoSignedWrap() : m_Next->hasNoUnsignedWrap();
+  if (Pred == ICmpInst::ICMP_NE)
+    return m_Step.isOne() || m_Step.isAllOnes();
+  if (Pred == ICmpInst::ICMP_EQ || Up != (Pred == ICmpInst::ICMP_SLT || Pred == ICmpInst::ICMP_ULT ||
+                                             Pred == ICmpInst::ICMP_SLE || Pred == ICmpInst::ICMP_ULE))
+    return false;
+  if (ICmpInst::isNonStrictPredicate(Pred) || !m_Step.abs().isOne())
+    return NoWrap;
+  return true;
+}
+
+Value* UnitInduction::createCount(IRBuilder<>& Builder) const {
+  ICmpInst::Predicate Pred = m_ExitOnTrue ? ICmpInst::getInversePredicate(m_Pred) : m_Pred;
+  Type* IVTy = m_IV->getType();
+  Value* Step = ConstantInt::get(IVTy, m_Step);
+  Value* AbsStep = ConstantInt::get(IVTy, m_Step.abs());
+  Value* One = ConstantInt::get(IVTy, 1);
+  Value* Start = m_ComparesNext ? Builder.CreateAdd(m_Start, Step, "count.first") : m_Start;
+  Value* Bound = m_Bound;
+  bool Up = m_Step.isStrictlyPositive();
+  Value* Distance = Up ? Builder.CreateSub(Bound, Start, "count.dist") : Builder.CreateSub(Start, Bound, "count.dist");
+  if (Pred == ICmpInst::ICMP_NE)
+    return Distance;
+  // Distance / |step| + 1 passing tests for an inclusive bound, a test less
+  // for a strict one, and none if the first test fails
+  Value* InRange = Builder.CreateICmp(Pred, Start, Bound, "count.inrange");
+  if (ICmpInst::isStrictPredicate(Pred))
+    Distance = Builder.CreateSub(Distance, One, "count.dist");
+  Value* Count = Builder.CreateAdd(Builder.CreateUDiv(Distance, AbsStep), One, "count");
+  return Builder.CreateSelect(InRange, Count, ConstantInt::get(IVTy, 0), "count");
+}
+
+Optional<uint64_t> UnitInduction::getConstantHeaderCount(uint64_t Limit) const {
+  auto* start = dyn_cast<ConstantInt>(m_Start);
+  auto* bound = dyn_cast<ConstantInt>(m_Bound);
+  if (!start || !bound) {
+    return None;
+  }
+  // Step through the iterations, which gets wrap-around right for free
+  APInt IV = start->getValue();
+  for (uint64_t count = 1; count <= Limit; count++) {
+    APInt compared = m_ComparesNext ? IV + m_Step : IV;
+    if (ICmpInst::compare(compared, bound->getValue(), m_Pred) == m_ExitOnTrue) {
+      return count;
+    }
+    IV += m_Step;
+  }
+  return None;
+}
+
 /// Main function for running the Loop Identification analysis. This function
 /// returns information about the loops in the function via the UnitLoopInfo
 /// object
@@ -146,6 +452,8 @@ UnitLoopInfo UnitLoopAnalysis::run(Function &F, FunctionAnalysisManager &FAM) {
         std::vector<BasicBlock*> natural_loop_members;
         GetNaturalLoop(BB, back_src, DT, natural_loop_members);
         loop_metadata->m_LoopMemberBlocks[back_src] = natural_loop_members;
+        Loops.m_LoopMembers.insert(natural_loop_members.begin(), natural_loop_members.end());
+        loop_metadata->m_LoopMemberSets[back_src].insert(natural_loop_members.begin(), natural_loop_members.end());
 
         // Identify inner loops and setup nested relationships
         SetupInnerLoops(BB, back_src, Loops);
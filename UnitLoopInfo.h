@@ -1,5 +1,9 @@
 #ifndef INCLUDE_UNIT_LOOP_INFO_H
 #define INCLUDE_UNIT_LOOP_INFO_H
+#include "llvm/ADT/APInt.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/PassManager.h"
 #include <vector>
 #include <unordered_map>
@@ -13,6 +17,7 @@ namespace cs426 {
 /// function. At minimum this will need to identify the loops, may hold
 /// additional information you find useful for your LICM pass
 struct LoopMeta;
+struct UnitLoop;
 class UnitLoopInfo {
 
   // Define this class to provide the information you need in LICM
@@ -23,6 +28,24 @@ public:
 
   // Innermost loop header (if there is one) for basic blocks if it is a member of some natural loops
   std::unordered_map<BasicBlock*, BasicBlock*> m_InnerMostLoopHeader;
+
+  // Blocks that are a member of at least one natural loop
+  std::unordered_set<BasicBlock*> m_LoopMembers;
+
+  // Whether BB belongs to any natural loop of the function
+  bool isLoopMember(BasicBlock* BB) const;
+
+  // All loops of F with their back edges merged, innermost loops first and
+  // otherwise in the order their headers appear in F
+  std::vector<UnitLoop> getLoops(Function& F) const;
+
+  // Record a block put on the edges from Preds to Succ, which belongs to the
+  // loops containing all of those blocks
+  void addBlockOnEdges(BasicBlock* NewBB, ArrayRef<BasicBlock*> Preds, BasicBlock* Succ);
+
+  // Record that the back edges from Latches to Header now all come from
+  // NewLatch, a block in between
+  void mergeLatches(BasicBlock* Header, ArrayRef<BasicBlock*> Latches, BasicBlock* NewLatch);
 };
 
 // An object holding the metadata of a natural loop, only attached to loop headers
@@ -37,9 +60,99 @@ struct LoopMeta {
 
   // Loop members identified by different back edge source blocks
   std::unordered_map<BasicBlock*, std::vector<BasicBlock*>> m_LoopMemberBlocks;
-  
+
+  // The same members as sets, for membership tests
+  std::unordered_map<BasicBlock*, std::unordered_set<BasicBlock*>> m_LoopMemberSets;
 };
 
+/// A natural loop with all the back edges to its header merged, which is the
+/// shape the loop transformations work on
+struct UnitLoop {
+  BasicBlock* m_Header = nullptr;
+
+  // Loop members, header first
+  std::vector<BasicBlock*> m_Blocks;
+  std::unordered_set<BasicBlock*> m_BlockSet;
+
+  // Sources of the back edges to the header
+  std::vector<BasicBlock*> m_Latches;
+
+  // Header of the immediately enclosing loop, nullptr for top-level loops
+  BasicBlock* m_ParentHeader = nullptr;
+
+  // Headers of the loops immediately nested in this one
+  std::vector<BasicBlock*> m_SubLoopHeaders;
+
+  // Nesting depth, 1 for top-level loops
+  unsigned m_Depth = 1;
+
+  bool contains(BasicBlock* BB) const { return m_BlockSet.count(BB); }
+  bool isInnermost() const { return m_SubLoopHeaders.empty(); }
+
+  // The only latch, or nullptr if there are several back edges
+  BasicBlock* getLatch() const;
+
+  // The only predecessor of the header outside the loop, nullptr if there
+  // are several
+  BasicBlock* getLoopPredecessor() const;
+
+  // The loop predecessor if it has no other successor, nullptr otherwise
+  BasicBlock* getPreheader() const;
+
+  // Members with a successor outside the loop
+  std::vector<BasicBlock*> getExitingBlocks() const;
+
+  // Blocks outside the loop with a predecessor inside, without duplicates
+  std::vector<BasicBlock*> getExitBlocks() const;
+
+  // Whether the loop body may be duplicated (no tokens, convergent or
+  // non-duplicable calls, indirect branches)
+  bool isSafeToClone() const;
+
+  // Number of instructions in the loop
+  unsigned getSize() const;
+};
+
+/// A loop counted by an integer induction variable
+///   m_IV = phi [m_Start, entering block], [m_Next = m_IV + m_Step, latch]
+/// that leaves the loop from its only exiting block once `m_Cmp` (comparing
+/// m_IV or m_Next against the loop-invariant m_Bound) says so
+struct UnitInduction {
+  PHINode* m_IV = nullptr;
+  Value* m_Start = nullptr;
+  BinaryOperator* m_Next = nullptr;
+  APInt m_Step;
+
+  ICmpInst* m_Cmp = nullptr;
+  Value* m_Bound = nullptr;
+  // Predicate of m_Cmp with the induction side as its left operand
+  ICmpInst::Predicate m_Pred = ICmpInst::BAD_ICMP_PREDICATE;
+  // Whether m_Cmp looks at m_Next rather than m_IV
+  bool m_ComparesNext = false;
+  // Whether the loop is left when m_Cmp is true
+  bool m_ExitOnTrue = false;
+
+  BasicBlock* m_ExitingBlock = nullptr;
+  BasicBlock* m_ExitBlock = nullptr;
+  // Successor of the exiting block that stays in the loop
+  BasicBlock* m_InLoopSucc = nullptr;
+
+  // How many times the header runs, if it is a compile-time constant not
+  // larger than Limit
+  Optional<uint64_t> getConstantHeaderCount(uint64_t Limit) const;
+
+  // Whether the number of iterations (passing exit tests) can be computed
+  // in front of the loop, which also shows the loop terminates
+  bool isCountComputable() const;
+
+  // Emit the computation of the number of iterations, in the IV's type
+  Value* createCount(IRBuilder<>& Builder) const;
+};
+
+// Recognize the counted loop shape described by UnitInduction. L must have a
+// single latch, a single entering block and a single exiting block.
+bool analyzeInduction(const UnitLoop& L, UnitInduction& Ind);
+
 /// Loop Identification Analysis Pass. Produces a UnitLoopInfo object which
 /// should contain any information about the loops in the function which is
 /// needed for your implementation of LICM
@@ -0,0 +1,797 @@
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/MathExtras.h"
+#include <functional>
+#include <numeric>
+
+#include "UnitLoopNest.h"
+
+using namespace llvm;
+using namespace cs426;
+
+int LoopNest::getLevel(Value* V) const {
+  for (unsigned i = 0; i < m_Inds.size(); i++) {
+    if (m_Inds[i].m_IV == V)
+      return i;
+  }
+  return -1;
+}
+
+/// Check the loop control of a nest level: it has to be a top-tested loop
+/// over an IV with a constant step, bounds that don't change in the nest and
+/// an IV that is only used by the body
+static bool isRectangularLevel(const LoopNest& Nest, const UnitLoop& L, const UnitInduction& Ind) {
+  if (Ind.m_ExitingBlock != L.m_Header || Ind.m_ComparesNext || Ind.m_Next->getOpcode() != Instruction::Add)
+    return false;
+  if (!Ind.m_Next->hasOneUse() || !Ind.m_Cmp->hasOneUse())
+    return false;
+  if (!Nest.isInvariant(Ind.m_Start) || !Nest.isInvariant(Ind.m_Bound))
+    return false;
+  if (Ind.m_IV->getType() != Nest.m_Inds.front().m_IV->getType())
+    return false;
+  for (User* U : Ind.m_IV->users()) {
+    if (U == Ind.m_Next || U == Ind.m_Cmp)
+      continue;
+    auto* I = dyn_cast<Instruction>(U);
+    if (!I || !Nest.getInnermost().contains(I->getParent()))
+      return false;
+  }
+  return true;
+}
+
+/// Whether the blocks of L outside Inner hold nothing but the loop control
+static bool isPerfectLevel(const UnitLoop& L, const UnitLoop& Inner, const UnitInduction& Ind) {
+  for (BasicBlock* BB : L.m_Blocks) {
+    if (Inner.contains(BB))
+      continue;
+    for (Instruction& I : *BB) {
+      if (&I == Ind.m_IV || &I == Ind.m_Cmp || &I == Ind.m_Next)
+        continue;
+      if (auto* BI = dyn_cast<BranchInst>(&I); BI && (BI->isUnconditional() || BB == L.m_Header))
+        continue;
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Whether the arithmetic of I, seen through the extension Ext (0 if none),
+/// can be extended operand by operand: sext needs it to be nsw, zext nuw
+static bool extendsTermwise(Instruction* I, unsigned Ext) {
+  if (Ext == Instruction::SExt)
+    return I->hasNoSignedWrap();
+  if (Ext == Instruction::ZExt)
+    return I->hasNoUnsignedWrap();
+  return true;
+}
+
+/// Accumulate Factor * ext(V) into S, following V through the integer
+/// arithmetic of the nest. Ext is the innermost extension V was reached
+/// through, 0 if V has the type of the index.
+static bool parseSubscript(const LoopNest& Nest, Value* V, int64_t Factor, Subscript& S, unsigned Ext = 0) {
+  if (auto* C = dyn_cast<ConstantInt>(V)) {
+    if (Ext == Instruction::ZExt) {
+      if (C->getValue().getActiveBits() > 31)
+        return false;
+      S.m_Const += Factor * (int64_t)C->getZExtValue();
+      return true;
+    }
+    if (C->getValue().getMinSignedBits() > 32)
+      return false;
+    S.m_Const += Factor * C->getSExtValue();
+    return true;
+  }
+  int Level = Nest.getLevel(V);
+  if (Level >= 0) {
+    S.m_Coeffs[Level] += Factor;
+    return true;
+  }
+  if (Nest.isInvariant(V)) {
+    if (S.m_Sym || Factor != 1)
+      return false;
+    S.m_Sym = V;
+    return true;
+  }
+
+  // Arithmetic in the index's own type wraps like the address does, below an
+  // extension it has to be free of wrapping to be split into its terms
+  auto* I = dyn_cast<Instruction>(V);
+  if (!I)
+    return false;
+  auto getSmallConstant = [&](Value* Op) -> Optional<int64_t> {
+    auto* C = dyn_cast<ConstantInt>(Op);
+    if (!C)
+      return None;
+    if (Ext == Instruction::ZExt)
+      return C->getValue().getActiveBits() > 15 ? None : Optional<int64_t>(C->getZExtValue());
+    if (C->getValue().getMinSignedBits() > 16)
+      return None;
+    return C->getSExtValue();
+  };
+  if (isa<OverflowingBinaryOperator>(I) && !extendsTermwise(I, Ext))
+    return false;
+  switch (I->getOpcode()) {
+  case Instruction::SExt:
+  case Instruction::ZExt:
+    return parseSubscript(Nest, I->getOperand(0), Factor, S, I->getOpcode());
+  case Instruction::Add:
+    return parseSubscript(Nest, I->getOperand(0), Factor, S, Ext) &&
+           parseSubscript(Nest, I->getOperand(1), Factor, S, Ext);
+  case Instruction::Sub:
+    return parseSubscript(Nest, I->getOperand(0), Factor, S, Ext) &&
+           parseSubscript(Nest, I->getOperand(1), -Factor, S, Ext);
+  case Instruction::Mul:
+    if (Optional<int64_t> C = getSmallConstant(I->getOperand(1)))
+      return parseSubscript(Nest, I->getOperand(0), Factor * *C, S, Ext);
+    if (Optional<int64_t> C = getSmallConstant(I->getOperand(0)))
+      return parseSubscript(Nest, I->getOperand(1), Factor * *C, S, Ext);
+    return false;
+  case Instruction::Shl:
+    if (Optional<int64_t> C = getSmallConstant(I->getOperand(1)); C && *C >= 0 && *C < 16)
+      return parseSubscript(Nest, I->getOperand(0), Factor << *C, S, Ext);
+    return false;
+  default:
+    return false;
+  }
+}
+
+/// Look through the extensions of V, setting Ext to the innermost one
+static Value* stripExtensions(Value* V, unsigned& Ext) {
+  while (isa<SExtInst>(V) || isa<ZExtInst>(V)) {
+    Ext = cast<Instruction>(V)->getOpcode();
+    V = cast<Instruction>(V)->getOperand(0);
+  }
+  return V;
+}
+
+static Value* stripExtensions(Value* V) {
+  unsigned Ext = 0;
+  return stripExtensions(V, Ext);
+}
+
+static Subscript getSubscript(const LoopNest& Nest, Instruction* Access, Value* Index, uint64_t ElemSize,
+                              const DataLayout& DL) {
+  Subscript S;
+  S.m_Coeffs.assign(Nest.getDepth(), 0);
+  S.m_ElemSize = ElemSize;
+  unsigned Ext = 0;
+  Index = stripExtensions(Index, Ext);
+
+  // Rows of variable-length arrays are indexed by IV * row length. The rows
+  // only stay apart if the length is not zero.
+  Value* Scaled = Index;
+  auto* Mul = dyn_cast<BinaryOperator>(Index);
+  if (Mul && Mul->getOpcode() == Instruction::Mul && extendsTermwise(Mul, Ext)) {
+    Value* A = Mul->getOperand(0);
+    Value* B = Mul->getOperand(1);
+    if (Nest.isInvariant(B) && !isa<Constant>(B) && !Nest.isInvariant(A)) {
+      S.m_Scale = B;
+      Scaled = A;
+    } else if (Nest.isInvariant(A) && !isa<Constant>(A) && !Nest.isInvariant(B)) {
+      S.m_Scale = A;
+      Scaled = B;
+    }
+    if (S.m_Scale && !isKnownNonZero(S.m_Scale, DL, 0, nullptr, Access))
+      return S;
+  }
+  S.m_Known = parseSubscript(Nest, Scaled, 1, S, Ext);
+  return S;
+}
+
+namespace {
+// Largest iteration count handled, which keeps all products in 64 bits
+const int64_t MaxTracked = 1 << 28;
+} // namespace
+
+/// The largest iteration number the IV of Ind reaches in the header, where
+/// the test of its first failing value j = k (+ 1 when testing the increment)
+/// makes the loop leave
+static Optional<int64_t> getMaxIteration(const UnitInduction& Ind) {
+  auto* Start = dyn_cast<ConstantInt>(Ind.m_Start);
+  auto* Bound = dyn_cast<ConstantInt>(Ind.m_Bound);
+  if (!Start || !Bound || Start->getValue().getMinSignedBits() > 32 || Bound->getValue().getMinSignedBits() > 32 ||
+      Ind.m_Step.getMinSignedBits() > 32)
+    return None;
+  int64_t S = Start->getSExtValue();
+  int64_t B = Bound->getSExtValue();
+  int64_t Step = Ind.m_Step.getSExtValue();
+  ICmpInst::Predicate Pred = Ind.m_ExitOnTrue ? ICmpInst::getInversePredicate(Ind.m_Pred) : Ind.m_Pred;
+  if (ICmpInst::isUnsigned(Pred)) {
+    if (S < 0 || B < 0)
+      return None;
+    Pred = ICmpInst::getSignedPredicate(Pred);
+  }
+  // Number of values S + Step * j passing the test before the first failing
+  int64_t Passing;
+  if (Step > 0 && Pred == ICmpInst::ICMP_SLT)
+    Passing = divideCeil(std::max<int64_t>(B - S, 0), Step);
+  else if (Step > 0 && Pred == ICmpInst::ICMP_SLE)
+    Passing = B < S ? 0 : (B - S) / Step + 1;
+  else if (Step < 0 && Pred == ICmpInst::ICMP_SGT)
+    Passing = divideCeil(std::max<int64_t>(S - B, 0), -Step);
+  else if (Step < 0 && Pred == ICmpInst::ICMP_SGE)
+    Passing = S < B ? 0 : (S - B) / -Step + 1;
+  else if (Pred == ICmpInst::ICMP_NE && (B - S) % Step == 0 && (B - S) / Step >= 0)
+    Passing = (B - S) / Step;
+  else
+    return None;
+  int64_t Max = std::max<int64_t>(Passing - Ind.m_ComparesNext, 0);
+  if (Max > MaxTracked)
+    return None;
+  return Max;
+}
+
+/// Whether the subscript S of Access only takes values in [0, M): it has to
+/// be the IV of a loop running from a non-negative start up to M, which is
+/// tested before Access runs
+static bool isWithinRow(const LoopNest& Nest, Instruction* Access, const Subscript& S, Value* M) {
+  if (!S.m_Known || S.m_Sym || S.m_Scale || S.m_Const != 0)
+    return false;
+  auto Level = find_if(S.m_Coeffs, [](int64_t C) { return C != 0; });
+  if (Level == S.m_Coeffs.end() || *Level != 1 || std::any_of(Level + 1, S.m_Coeffs.end(), [](int64_t C) { return C; }))
+    return false;
+  const UnitLoop& L = *Nest.m_Loops[Level - S.m_Coeffs.begin()];
+  const UnitInduction& Ind = Nest.m_Inds[Level - S.m_Coeffs.begin()];
+  auto* Start = dyn_cast<ConstantInt>(Ind.m_Start);
+  ICmpInst::Predicate Pred = Ind.m_ExitOnTrue ? ICmpInst::getInversePredicate(Ind.m_Pred) : Ind.m_Pred;
+  return Start && !Start->isNegative() && Ind.m_Step.isStrictlyPositive() && !Ind.m_ComparesNext &&
+         (Pred == ICmpInst::ICMP_SLT || Pred == ICmpInst::ICMP_ULT) &&
+         stripExtensions(Ind.m_Bound) == stripExtensions(M) && Ind.m_ExitingBlock == L.m_Header &&
+         Access->getParent() != L.m_Header;
+}
+
+/// Whether the subscript S of Access only takes values in [0, Extent) in the
+/// iterations that reach Access. Only the header sees the IV value failing
+/// the exit test.
+static bool isWithinExtent(const LoopNest& Nest, Instruction* Access, const Subscript& S, uint64_t Extent) {
+  if (!S.m_Known || S.m_Sym || S.m_Scale || Extent > (uint64_t)INT64_MAX)
+    return false;
+  int64_t Min = S.m_Const, Max = S.m_Const;
+  for (unsigned l = 0; l < S.m_Coeffs.size(); l++) {
+    if (!S.m_Coeffs[l])
+      continue;
+    const UnitInduction& Ind = Nest.m_Inds[l];
+    Optional<int64_t> Last = getMaxIteration(Ind);
+    if (!Last)
+      return false;
+    BasicBlock* Header = Nest.m_Loops[l]->m_Header;
+    if (Ind.m_ExitingBlock == Header && Access->getParent() != Header && --*Last < 0)
+      return true;
+    int64_t First = cast<ConstantInt>(Ind.m_Start)->getSExtValue();
+    int64_t Final = First + Ind.m_Step.getSExtValue() * *Last;
+    if (MulOverflow(First, S.m_Coeffs[l], First) || MulOverflow(Final, S.m_Coeffs[l], Final) ||
+        AddOverflow(Min, std::min(First, Final), Min) || AddOverflow(Max, std::max(First, Final), Max))
+      return false;
+  }
+  return Min >= 0 && Max < (int64_t)Extent;
+}
+
+/// Recover the two subscripts of a flattened index Outer * M + Inner into an
+/// array with rows of M elements, like c[i * m + j]
+static bool delinearize(const LoopNest& Nest, Instruction* Access, Value* Index, uint64_t ElemSize,
+                        std::vector<Subscript>& Subscripts) {
+  // The terms of the sum with the extension each is reached through
+  std::vector<std::pair<Value*, unsigned>> Terms;
+  std::function<void(Value*, unsigned)> collectTerms = [&](Value* V, unsigned Ext) {
+    V = stripExtensions(V, Ext);
+    auto* Add = dyn_cast<BinaryOperator>(V);
+    if (Add && Add->getOpcode() == Instruction::Add && extendsTermwise(Add, Ext)) {
+      collectTerms(Add->getOperand(0), Ext);
+      collectTerms(Add->getOperand(1), Ext);
+    } else {
+      Terms.push_back({V, Ext});
+    }
+  };
+  collectTerms(Index, 0);
+
+  // Row length M is the first invariant factor of a product with an IV
+  auto getFactor = [&](Value* Term, unsigned Ext, Value* M) -> Value* {
+    auto* Mul = dyn_cast<BinaryOperator>(Term);
+    if (!Mul || Mul->getOpcode() != Instruction::Mul || !extendsTermwise(Mul, Ext))
+      return nullptr;
+    for (unsigned Op = 0; Op < 2; Op++) {
+      Value* Factor = Mul->getOperand(Op);
+      Value* Other = Mul->getOperand(1 - Op);
+      if (M ? stripExtensions(Factor) == stripExtensions(M)
+            : Nest.isInvariant(Factor) && !isa<Constant>(Factor) && !Nest.isInvariant(Other))
+        return Other;
+    }
+    return nullptr;
+  };
+  Value* M = nullptr;
+  for (auto [Term, Ext] : Terms) {
+    if (getFactor(Term, Ext, nullptr)) {
+      auto* Mul = cast<BinaryOperator>(Term);
+      M = Nest.isInvariant(Mul->getOperand(1)) ? Mul->getOperand(1) : Mul->getOperand(0);
+      break;
+    }
+  }
+  if (!M)
+    return false;
+
+  Subscript Outer, Inner;
+  Outer.m_Coeffs.assign(Nest.getDepth(), 0);
+  Inner.m_Coeffs.assign(Nest.getDepth(), 0);
+  Outer.m_Scale = M;
+  Outer.m_ElemSize = Inner.m_ElemSize = ElemSize;
+  Outer.m_Known = Inner.m_Known = true;
+  for (auto [Term, Ext] : Terms) {
+    if (Value* Row = getFactor(Term, Ext, M))
+      Outer.m_Known &= parseSubscript(Nest, Row, 1, Outer, Ext);
+    else
+      Inner.m_Known &= parseSubscript(Nest, Term, 1, Inner, Ext);
+  }
+  if (!Outer.m_Known || !isWithinRow(Nest, Access, Inner, M))
+    return false;
+  Subscripts.push_back(Outer);
+  Subscripts.push_back(Inner);
+  return true;
+}
+
+/// Fold Inner, an index that may leave its dimension, into the index Outer
+/// of the dimension around it, as Outer * (elements per outer element) +
+/// Inner
+static bool mergeSubscripts(Subscript& Outer, const Subscript& Inner) {
+  if (!Outer.m_Known || !Inner.m_Known || Outer.m_Scale || Inner.m_Scale || !Inner.m_ElemSize ||
+      Outer.m_ElemSize % Inner.m_ElemSize || Outer.m_ElemSize / Inner.m_ElemSize > (uint64_t)MaxTracked)
+    return false;
+  int64_t Factor = Outer.m_ElemSize / Inner.m_ElemSize;
+  if (Outer.m_Sym && (Factor != 1 || Inner.m_Sym))
+    return false;
+  Subscript Merged = Inner;
+  if (Outer.m_Sym)
+    Merged.m_Sym = Outer.m_Sym;
+  int64_t Scaled;
+  if (MulOverflow(Outer.m_Const, Factor, Scaled) || AddOverflow(Merged.m_Const, Scaled, Merged.m_Const))
+    return false;
+  for (unsigned l = 0; l < Merged.m_Coeffs.size(); l++) {
+    if (MulOverflow(Outer.m_Coeffs[l], Factor, Scaled) || AddOverflow(Merged.m_Coeffs[l], Scaled, Merged.m_Coeffs[l]))
+      return false;
+  }
+  Outer = Merged;
+  return true;
+}
+
+/// Split the address of a load or store into its base and its indices. Each
+/// GEP index is taken as an array dimension of its own, like the source
+/// code's subscripts were, unless it is a flattened index into rows. An
+/// index that may leave its dimension is merged into the one around it.
+NestAccess cs426::getNestAccess(const LoopNest& Nest, Instruction* I, const DataLayout& DL) {
+  NestAccess A;
+  A.m_Inst = I;
+  A.m_IsWrite = isa<StoreInst>(I);
+  Value* Ptr = getLoadStorePointerOperand(I)->stripPointerCasts();
+  // The subscripts count elements of the type the address points to, an
+  // access of another size may cover several of them or only part of one
+  bool Unknown = false;
+  if (auto* GEP = dyn_cast<GEPOperator>(Ptr))
+    Unknown = DL.getTypeStoreSize(getLoadStoreType(I)) != DL.getTypeStoreSize(GEP->getResultElementType());
+  // Elements of the dimension of every subscript, if the type bounds it, and
+  // whether the subscript provably stays inside its dimension
+  std::vector<Optional<uint64_t>> Extents;
+  std::vector<bool> Within;
+  while (auto* GEP = dyn_cast<GEPOperator>(Ptr)) {
+    std::vector<Subscript> Subscripts;
+    std::vector<Optional<uint64_t>> GEPExtents;
+    std::vector<bool> GEPWithin;
+    Type* Container = nullptr;
+    for (auto GTI = gep_type_begin(GEP), E = gep_type_end(GEP); GTI != E; ++GTI) {
+      uint64_t ElemSize = GTI.isStruct() ? 0 : DL.getTypeAllocSize(GTI.getIndexedType()).getFixedSize();
+      Optional<uint64_t> Extent;
+      if (auto* ArrayTy = dyn_cast_or_null<ArrayType>(Container))
+        Extent = ArrayTy->getNumElements();
+      else if (auto* VectorTy = dyn_cast_or_null<FixedVectorType>(Container))
+        Extent = VectorTy->getNumElements();
+      Container = GTI.getIndexedType();
+      size_t First = Subscripts.size();
+      if (GTI.isStruct() || !delinearize(Nest, I, GTI.getOperand(), ElemSize, Subscripts))
+        Subscripts.push_back(getSubscript(Nest, I, GTI.getOperand(), ElemSize, DL));
+      for (size_t d = First; d < Subscripts.size(); d++) {
+        if (!GEP->isInBounds())
+          Subscripts[d].m_Known = false;
+        // The second subscript of a flattened index stays below the row length
+        bool InRow = d > First;
+        GEPExtents.push_back(InRow ? None : Extent);
+        GEPWithin.push_back(GTI.isStruct() || InRow || (Extent && isWithinExtent(Nest, I, Subscripts[d], *Extent)));
+      }
+    }
+    A.m_Subscripts.insert(A.m_Subscripts.begin(), Subscripts.begin(), Subscripts.end());
+    Extents.insert(Extents.begin(), GEPExtents.begin(), GEPExtents.end());
+    Within.insert(Within.begin(), GEPWithin.begin(), GEPWithin.end());
+    Ptr = GEP->getPointerOperand()->stripPointerCasts();
+  }
+  A.m_Base = Ptr;
+  for (size_t d = A.m_Subscripts.size(); d-- > 1;) {
+    if (Within[d])
+      continue;
+    Subscript& Outer = A.m_Subscripts[d - 1];
+    uint64_t OuterSize = Outer.m_ElemSize;
+    if (!mergeSubscripts(Outer, A.m_Subscripts[d])) {
+      Unknown = true;
+      break;
+    }
+    A.m_Subscripts.erase(A.m_Subscripts.begin() + d);
+    if (Extents[d - 1])
+      Extents[d - 1] = SaturatingMultiply(*Extents[d - 1], OuterSize / Outer.m_ElemSize);
+    Within[d - 1] = Extents[d - 1] && isWithinExtent(Nest, I, Outer, *Extents[d - 1]);
+  }
+  if (Unknown) {
+    for (Subscript& S : A.m_Subscripts)
+      S.m_Known = false;
+  }
+  return A;
+}
+
+bool cs426::buildPerfectNest(const UnitLoop& Outer, const std::unordered_map<BasicBlock*, const UnitLoop*>& Loops,
+                             unsigned MaxDepth, const DataLayout& DL, LoopNest& Nest) {
+  const UnitLoop* L = &Outer;
+  while (true) {
+    UnitInduction Ind;
+    if (!analyzeInduction(*L, Ind))
+      return false;
+    Nest.m_Loops.push_back(L);
+    Nest.m_Inds.push_back(Ind);
+    if (L->isInnermost())
+      break;
+    if (L->m_SubLoopHeaders.size() != 1 || Nest.getDepth() == MaxDepth)
+      return false;
+    const UnitLoop* Inner = Loops.at(L->m_SubLoopHeaders.front());
+    if (!isPerfectLevel(*L, *Inner, Ind))
+      return false;
+    L = Inner;
+  }
+  if (Nest.getDepth() < 2)
+    return false;
+  for (unsigned i = 0; i < Nest.getDepth(); i++) {
+    if (!isRectangularLevel(Nest, *Nest.m_Loops[i], Nest.m_Inds[i]))
+      return false;
+  }
+
+  // The innermost loop can't carry values in registers or out of the nest,
+  // and only touches memory through plain loads and stores
+  const UnitLoop& Innermost = Nest.getInnermost();
+  if (&*Innermost.m_Header->phis().begin() != Nest.m_Inds.back().m_IV ||
+      std::next(Innermost.m_Header->phis().begin()) != Innermost.m_Header->phis().end())
+    return false;
+  for (BasicBlock* BB : Innermost.m_Blocks) {
+    for (Instruction& I : *BB) {
+      for (User* U : I.users()) {
+        if (!Innermost.contains(cast<Instruction>(U)->getParent()))
+          return false;
+      }
+    }
+  }
+  return collectNestAccesses(Nest, DL);
+}
+
+bool cs426::collectNestAccesses(LoopNest& Nest, const DataLayout& DL) {
+  for (BasicBlock* BB : Nest.getInnermost().m_Blocks) {
+    for (Instruction& I : *BB) {
+      if (isa<LoadInst>(I) || isa<StoreInst>(I)) {
+        bool Simple = isa<LoadInst>(I) ? cast<LoadInst>(I).isSimple() : cast<StoreInst>(I).isSimple();
+        if (!Simple)
+          return false;
+        Nest.m_Accesses.push_back(getNestAccess(Nest, &I, DL));
+      } else if (I.mayReadOrWriteMemory()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+uint64_t cs426::getAccessStride(const NestAccess& A, unsigned Level) {
+  uint64_t Stride = 0;
+  for (const Subscript& S : A.m_Subscripts) {
+    if (!S.m_Known || (S.m_Scale && S.m_Coeffs[Level]))
+      Stride += CacheLineSize;
+    else
+      Stride += std::abs(S.m_Coeffs[Level]) * S.m_ElemSize;
+  }
+  return Stride;
+}
+
+namespace {
+// Smallest and largest value of an expression over the iterations of the
+// loops, where None stands for an unbounded end
+struct Bounds {
+  Optional<int64_t> m_Min = 0;
+  Optional<int64_t> m_Max = 0;
+
+  bool contains(int64_t V) const { return (!m_Min || *m_Min <= V) && (!m_Max || V <= *m_Max); }
+};
+
+/// One subscript of A equated with the same subscript of B, in terms of the
+/// iteration numbers k of the loops around A and k' of those around B:
+///   sum(m_CoeffsA[l] * k_l) - sum(m_CoeffsB[l] * k'_l) == m_Delta
+/// with 0 <= k_l, k'_l <= m_MaxIters[l]
+struct SubscriptEquation {
+  std::vector<int64_t> m_CoeffsA;
+  std::vector<int64_t> m_CoeffsB;
+  int64_t m_Delta = 0;
+};
+
+} // namespace
+
+/// Bounds of Const + sum(Coeffs[i] * X) over 0 <= X <= Max for each term on
+/// its own, which are the vertices of the iteration spaces used below
+static Bounds getVertexBounds(int64_t Const, ArrayRef<int64_t> Coeffs, Optional<int64_t> Max) {
+  Bounds R{Const, Const};
+  for (int64_t C : Coeffs) {
+    if (C == 0)
+      continue;
+    if (!Max) {
+      (C < 0 ? R.m_Min : R.m_Max) = None;
+      continue;
+    }
+    int64_t V = Const + C * *Max;
+    if (R.m_Min)
+      R.m_Min = std::min(*R.m_Min, V);
+    if (R.m_Max)
+      R.m_Max = std::max(*R.m_Max, V);
+  }
+  return R;
+}
+
+static void addBounds(Bounds& R, const Bounds& B) {
+  R.m_Min = R.m_Min && B.m_Min ? Optional<int64_t>(*R.m_Min + *B.m_Min) : None;
+  R.m_Max = R.m_Max && B.m_Max ? Optional<int64_t>(*R.m_Max + *B.m_Max) : None;
+}
+
+/// Banerjee's bounds of a * k - b * k' for one loop, with k and k' ordered
+/// as Dir says. Returns None if no two iterations are ordered that way.
+static Optional<Bounds> getLevelBounds(int64_t A, int64_t B, unsigned Dir, Optional<int64_t> Max) {
+  // With k' = k + 1 + t (or the other way around for DirGT), the extremes
+  // lie on the corners of the triangle k, t >= 0, k + t <= Max - 1
+  Optional<int64_t> Inner = Max ? Optional<int64_t>(*Max - 1) : None;
+  if ((Dir == DirLT || Dir == DirGT) && Max && *Max == 0)
+    return None;
+  switch (Dir) {
+  case DirEQ:
+    return getVertexBounds(0, {A - B}, Max);
+  case DirLT:
+    return getVertexBounds(-B, {A - B, -B}, Inner);
+  case DirGT:
+    return getVertexBounds(A, {A - B, A}, Inner);
+  default: {
+    Bounds R = getVertexBounds(0, {A}, Max);
+    addBounds(R, getVertexBounds(0, {-B}, Max));
+    return R;
+  }
+  }
+}
+
+/// Bounds of the left side of E when the shared loops are ordered as Dirs
+/// says, or None if they can't be
+static Optional<Bounds> getEquationBounds(const SubscriptEquation& E, const DirectionVector& Dirs,
+                                          ArrayRef<Optional<int64_t>> MaxA, ArrayRef<Optional<int64_t>> MaxB) {
+  Bounds R;
+  for (unsigned l = 0; l < Dirs.size(); l++) {
+    // A set of directions takes the hull of the bounds of its members
+    Optional<Bounds> Level;
+    for (unsigned Dir : {DirLT, DirEQ, DirGT}) {
+      if (!(Dirs[l] & Dir))
+        continue;
+      Optional<Bounds> B = getLevelBounds(E.m_CoeffsA[l], E.m_CoeffsB[l], Dirs[l] == DirAll ? DirAll : Dir, MaxA[l]);
+      if (!B)
+        continue;
+      if (!Level) {
+        Level = B;
+      } else {
+        Level->m_Min = Level->m_Min && B->m_Min ? Optional<int64_t>(std::min(*Level->m_Min, *B->m_Min)) : None;
+        Level->m_Max = Level->m_Max && B->m_Max ? Optional<int64_t>(std::max(*Level->m_Max, *B->m_Max)) : None;
+      }
+      if (Dirs[l] == DirAll)
+        break;
+    }
+    if (!Level)
+      return None;
+    addBounds(R, *Level);
+  }
+  for (unsigned l = Dirs.size(); l < E.m_CoeffsA.size(); l++)
+    addBounds(R, getVertexBounds(0, {E.m_CoeffsA[l]}, MaxA[l]));
+  for (unsigned l = Dirs.size(); l < E.m_CoeffsB.size(); l++)
+    addBounds(R, getVertexBounds(0, {-E.m_CoeffsB[l]}, MaxB[l]));
+  return R;
+}
+
+/// Write the subscripts SA and SB as an equation over the iteration numbers,
+/// where the IV of a loop is Start + Step * k. Starts that aren't constants
+/// have to cancel out.
+static bool getSubscriptEquation(const Subscript& SA, ArrayRef<UnitInduction> IndsA, const Subscript& SB,
+                                 ArrayRef<UnitInduction> IndsB, unsigned Common, SubscriptEquation& E) {
+  E.m_Delta = SB.m_Const - SA.m_Const;
+  auto addLevel = [&](int64_t Coeff, const UnitInduction& Ind, std::vector<int64_t>& Coeffs, int64_t Sign) {
+    Coeffs.push_back(0);
+    if (!Coeff)
+      return true;
+    if (std::abs(Coeff) > MaxTracked || Ind.m_Step.getMinSignedBits() > 32)
+      return false;
+    Coeffs.back() = Coeff * Ind.m_Step.getSExtValue();
+    auto* Start = dyn_cast<ConstantInt>(Ind.m_Start);
+    if (!Start || Start->getValue().getMinSignedBits() > 32)
+      return false;
+    E.m_Delta += Sign * Coeff * Start->getSExtValue();
+    return true;
+  };
+  for (unsigned l = 0; l < IndsA.size(); l++) {
+    int64_t CoeffA = SA.m_Coeffs[l];
+    int64_t CoeffB = l < Common ? SB.m_Coeffs[l] : 0;
+    if (l < Common && CoeffA == CoeffB && !isa<ConstantInt>(IndsA[l].m_Start)) {
+      if (std::abs(CoeffA) > MaxTracked || IndsA[l].m_Step.getMinSignedBits() > 32)
+        return false;
+      // a * Start drops out of both sides
+      E.m_CoeffsA.push_back(CoeffA * IndsA[l].m_Step.getSExtValue());
+      E.m_CoeffsB.push_back(CoeffB * IndsA[l].m_Step.getSExtValue());
+      continue;
+    }
+    if (!addLevel(CoeffA, IndsA[l], E.m_CoeffsA, -1))
+      return false;
+    if (l < Common && !addLevel(CoeffB, IndsA[l], E.m_CoeffsB, 1))
+      return false;
+  }
+  for (unsigned l = Common; l < IndsB.size(); l++) {
+    if (!addLevel(SB.m_Coeffs[l], IndsB[l], E.m_CoeffsB, 1))
+      return false;
+  }
+  return std::all_of(E.m_CoeffsA.begin(), E.m_CoeffsA.end(), [](int64_t C) { return std::abs(C) <= MaxTracked; }) &&
+         std::all_of(E.m_CoeffsB.begin(), E.m_CoeffsB.end(), [](int64_t C) { return std::abs(C) <= MaxTracked; });
+}
+
+Optional<Dependence> cs426::testDependence(const NestAccess& A, ArrayRef<UnitInduction> IndsA, const NestAccess& B,
+                                           ArrayRef<UnitInduction> IndsB, unsigned Common, AAResults& AA) {
+  Dependence Dep;
+  Dep.m_Src = A.m_Inst;
+  Dep.m_Dst = B.m_Inst;
+  Dep.m_Dirs.assign(Common, DirAll);
+  Dep.m_Distances.assign(Common, None);
+  if (A.m_Base != B.m_Base) {
+    if (AA.isNoAlias(MemoryLocation::getBeforeOrAfter(A.m_Base), MemoryLocation::getBeforeOrAfter(B.m_Base)))
+      return None;
+    return Dep;
+  }
+  if (A.m_Subscripts.size() != B.m_Subscripts.size())
+    return Dep;
+  std::vector<Optional<int64_t>> MaxA, MaxB;
+  for (const UnitInduction& Ind : IndsA)
+    MaxA.push_back(getMaxIteration(Ind));
+  for (const UnitInduction& Ind : IndsB)
+    MaxB.push_back(getMaxIteration(Ind));
+
+  DirectionVector& Dirs = Dep.m_Dirs;
+  for (unsigned d = 0; d < A.m_Subscripts.size(); d++) {
+    const Subscript& SA = A.m_Subscripts[d];
+    const Subscript& SB = B.m_Subscripts[d];
+    if (!SA.m_Known || !SB.m_Known || SA.m_ElemSize != SB.m_ElemSize) {
+      Dep.m_Dirs.assign(Common, DirAll);
+      Dep.m_Distances.assign(Common, None);
+      return Dep;
+    }
+    // Symbolic row lengths are non-zero: a delinearized row has an IV
+    // running below its length, other scales are proven to be
+    SubscriptEquation E;
+    if (SA.m_Scale != SB.m_Scale || SA.m_Sym != SB.m_Sym ||
+        !getSubscriptEquation(SA, IndsA, SB, IndsB, Common, E))
+      continue;
+
+    std::vector<unsigned> Levels;
+    uint64_t GCD = 0;
+    for (unsigned l = 0; l < std::max(E.m_CoeffsA.size(), E.m_CoeffsB.size()); l++) {
+      int64_t CoeffA = l < E.m_CoeffsA.size() ? E.m_CoeffsA[l] : 0;
+      int64_t CoeffB = l < E.m_CoeffsB.size() ? E.m_CoeffsB[l] : 0;
+      if (CoeffA || CoeffB)
+        Levels.push_back(l);
+      GCD = std::gcd(GCD, (uint64_t)std::abs(CoeffA));
+      GCD = std::gcd(GCD, (uint64_t)std::abs(CoeffB));
+    }
+    // ZIV: the subscripts are the same constant or never meet
+    if (Levels.empty()) {
+      if (E.m_Delta != 0)
+        return None;
+      continue;
+    }
+    // GCD: the equation has no integer solution at all
+    if (E.m_Delta % (int64_t)GCD != 0)
+      return None;
+    // Strong SIV: a * (k - k') == Delta, so the distance is fixed
+    unsigned Level = Levels[0];
+    if (Levels.size() == 1 && Level < Common && E.m_CoeffsA[Level] == E.m_CoeffsB[Level]) {
+      int64_t Distance = -E.m_Delta / E.m_CoeffsA[Level];
+      if (MaxA[Level] && std::abs(Distance) > *MaxA[Level])
+        return None;
+      if (Dep.m_Distances[Level] && *Dep.m_Distances[Level] != Distance)
+        return None;
+      Dep.m_Distances[Level] = Distance;
+      Dirs[Level] &= Distance > 0 ? DirLT : Distance == 0 ? DirEQ : DirGT;
+      if (!Dirs[Level])
+        return None;
+      continue;
+    }
+    // Banerjee: Delta lies outside the bounds of the left side, for all
+    // directions or for some direction of a loop
+    Optional<Bounds> All = getEquationBounds(E, Dirs, MaxA, MaxB);
+    if (!All || !All->contains(E.m_Delta))
+      return None;
+    for (unsigned l : Levels) {
+      if (l >= Common)
+        continue;
+      unsigned Allowed = Dirs[l];
+      for (unsigned Dir : {DirLT, DirEQ, DirGT}) {
+        if (!(Allowed & Dir))
+          continue;
+        DirectionVector Refined = Dirs;
+        Refined[l] = Dir;
+        Optional<Bounds> R = getEquationBounds(E, Refined, MaxA, MaxB);
+        if (!R || !R->contains(E.m_Delta))
+          Dirs[l] &= ~Dir;
+      }
+      if (!Dirs[l])
+        return None;
+    }
+  }
+  for (unsigned l = 0; l < Common; l++) {
+    if (Dirs[l] == DirEQ)
+      Dep.m_Distances[l] = 0;
+  }
+  return Dep;
+}
+
+Optional<DirectionVector> cs426::getDependence(const LoopNest& Nest, const NestAccess& A, const NestAccess& B,
+                                               AAResults& AA) {
+  Optional<Dependence> Dep = testDependence(A, Nest.m_Inds, B, Nest.m_Inds, Nest.getDepth(), AA);
+  if (!Dep)
+    return None;
+  return Dep->m_Dirs;
+}
+
+std::vector<DirectionVector> cs426::getNestDependences(const LoopNest& Nest, AAResults& AA) {
+  std::vector<DirectionVector> Deps;
+  for (unsigned i = 0; i < Nest.m_Accesses.size(); i++) {
+    for (unsigned j = i; j < Nest.m_Accesses.size(); j++) {
+      const NestAccess& A = Nest.m_Accesses[i];
+      const NestAccess& B = Nest.m_Accesses[j];
+      if (!A.m_IsWrite && !B.m_IsWrite)
+        continue;
+      if (Optional<DirectionVector> Dirs = getDependence(Nest, A, B, AA))
+        Deps.push_back(*Dirs);
+    }
+  }
+  return Deps;
+}
+
+// Sign of the first non-equal direction of V, visiting the levels in Order
+static unsigned getLeadingDirection(const std::vector<unsigned>& V, const std::vector<unsigned>& Order) {
+  for (unsigned Level : Order) {
+    if (V[Level] != DirEQ)
+      return V[Level];
+  }
+  return DirEQ;
+}
+
+bool cs426::isLegalPermutation(const std::vector<DirectionVector>& Deps, const std::vector<unsigned>& Perm) {
+  std::vector<unsigned> Identity(Perm.size());
+  std::iota(Identity.begin(), Identity.end(), 0);
+  for (const DirectionVector& Dirs : Deps) {
+    // Enumerate the single-direction vectors the dependence allows
+    std::vector<unsigned> V(Dirs.size());
+    std::function<bool(unsigned)> Check = [&](unsigned Level) {
+      if (Level == Dirs.size())
+        return getLeadingDirection(V, Identity) == getLeadingDirection(V, Perm);
+      for (unsigned D : {DirLT, DirEQ, DirGT}) {
+        if (!(Dirs[Level] & D))
+          continue;
+        V[Level] = D;
+        if (!Check(Level + 1))
+          return false;
+      }
+      return true;
+    };
+    if (!Check(0))
+      return false;
+  }
+  return true;
+}
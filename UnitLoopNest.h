@@ -0,0 +1,117 @@
+#ifndef INCLUDE_UNIT_LOOP_NEST_H
+#define INCLUDE_UNIT_LOOP_NEST_H
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/IR/DataLayout.h"
+#include <unordered_map>
+#include <vector>
+
+#include "UnitLoopInfo.h"
+
+using namespace llvm;
+
+namespace cs426 {
+// Size of a cache line in the cache model of the nest transformations
+const uint64_t CacheLineSize = 64;
+
+/// One index of an address, m_Scale * (m_Coeffs . IVs + m_Const + m_Sym)
+/// where m_Scale and m_Sym are values invariant in the nest (nullptr for 1
+/// and 0) and m_Coeffs holds the coefficient of every nest level's IV
+struct Subscript {
+  std::vector<int64_t> m_Coeffs;
+  int64_t m_Const = 0;
+  Value* m_Sym = nullptr;
+  Value* m_Scale = nullptr;
+  // Bytes the address moves when the index grows by one
+  uint64_t m_ElemSize = 0;
+  // Whether the index has the form above at all
+  bool m_Known = false;
+};
+
+/// A load or store of a loop nest
+struct NestAccess {
+  Instruction* m_Inst = nullptr;
+  // Pointer the indices are applied to
+  Value* m_Base = nullptr;
+  bool m_IsWrite = false;
+  // Indices of every GEP on the way from m_Base to the address, outermost
+  // array dimension first. An index that may leave its dimension is merged
+  // into the one around it.
+  std::vector<Subscript> m_Subscripts;
+};
+
+/// A perfect nest of counted loops with rectangular bounds, outermost first,
+/// where only the innermost loop has anything besides its loop control
+struct LoopNest {
+  std::vector<const UnitLoop*> m_Loops;
+  std::vector<UnitInduction> m_Inds;
+  std::vector<NestAccess> m_Accesses;
+
+  unsigned getDepth() const { return m_Loops.size(); }
+  const UnitLoop& getOutermost() const { return *m_Loops.front(); }
+  const UnitLoop& getInnermost() const { return *m_Loops.back(); }
+  bool isInvariant(Value* V) const {
+    auto* I = dyn_cast<Instruction>(V);
+    return !I || !getOutermost().contains(I->getParent());
+  }
+  // Nest level whose IV V is, -1 if there is none
+  int getLevel(Value* V) const;
+};
+
+// Directions of a dependence at one nest level, as the sign of the distance
+// between the iteration of the second access and the first
+enum Direction : unsigned { DirLT = 1, DirEQ = 2, DirGT = 4, DirAll = 7 };
+
+// Possible directions per nest level for a dependence between two accesses
+typedef std::vector<unsigned> DirectionVector;
+
+/// A possible dependence between the access m_Src, executed in iteration I
+/// of the loops around it, and m_Dst, executed in iteration I'
+struct Dependence {
+  Instruction* m_Src = nullptr;
+  Instruction* m_Dst = nullptr;
+  // Possible directions of I' - I in the loops around both, outermost first
+  DirectionVector m_Dirs;
+  // I' - I counted in iterations, for the loops where it is a constant
+  std::vector<Optional<int64_t>> m_Distances;
+};
+
+// Identify the perfect nest rooted at Outer, at most MaxDepth loops deep.
+// Loops maps the loop headers of the function to their loops.
+bool buildPerfectNest(const UnitLoop& Outer, const std::unordered_map<BasicBlock*, const UnitLoop*>& Loops,
+                      unsigned MaxDepth, const DataLayout& DL, LoopNest& Nest);
+
+// Add the loads and stores of the innermost loop of Nest to its accesses.
+// Fails if the loop touches memory in any other way.
+bool collectNestAccesses(LoopNest& Nest, const DataLayout& DL);
+
+// Split the address of a load or store in the innermost loop of Nest into
+// its base and subscripts
+NestAccess getNestAccess(const LoopNest& Nest, Instruction* I, const DataLayout& DL);
+
+// Bytes the address of A moves per iteration of the loop at Level, at least
+// CacheLineSize if that isn't known at compile time
+uint64_t getAccessStride(const NestAccess& A, unsigned Level);
+
+// Directions (per nest level) in which the two accesses may touch the same
+// memory, or None if they never do. A is executed in iteration I, B in
+// iteration I', and the direction of a level is the sign of I' - I there.
+Optional<DirectionVector> getDependence(const LoopNest& Nest, const NestAccess& A, const NestAccess& B,
+                                        AAResults& AA);
+
+// Test whether A, inside the loops of IndsA, and B, inside the loops of IndsB,
+// may touch the same memory, or None if they never do. Both lists go from
+// the outermost loop inwards and share their first Common loops, which the
+// directions and distances of the result are given for.
+Optional<Dependence> testDependence(const NestAccess& A, ArrayRef<UnitInduction> IndsA, const NestAccess& B,
+                                    ArrayRef<UnitInduction> IndsB, unsigned Common, AAResults& AA);
+
+// Direction vectors of all dependences between the accesses of the nest
+// that involve a write
+std::vector<DirectionVector> getNestDependences(const LoopNest& Nest, AAResults& AA);
+
+// Whether reordering the nest so position t runs the loop at level Perm[t]
+// executes every pair of dependent iterations in the original order
+bool isLegalPermutation(const std::vector<DirectionVector>& Deps, const std::vector<unsigned>& Perm);
+} // namespace
+
+#endif // INCLUDE_UNIT_LOOP_NEST_H
@@ -0,0 +1,142 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-loop-simplify"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include "UnitLoopInfo.h"
+#include "UnitLoopSimplify.h"
+
+#define DEBUG_TYPE "UnitLoopSimplify"
+// Define any statistics here
+STATISTIC(NumPreheaders, "Number of preheaders inserted");
+STATISTIC(NumLatchesMerged, "Number of loops whose back edges were merged");
+STATISTIC(NumExitsSplit, "Number of dedicated exit blocks inserted");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+/// Puts the loops of a function into simplified form. The loops it works
+/// on are kept up to date along with the UnitLoopInfo they came from.
+class LoopSimplifier {
+public:
+  LoopSimplifier(Function& F, UnitLoopInfo& Loops) : m_Loops(Loops), m_AllLoops(Loops.getLoops(F)) {}
+
+  bool run();
+
+private:
+  // Whether the edges from Preds can be redirected to a new block
+  static bool canSplitEdgesFrom(ArrayRef<BasicBlock*> Preds) {
+    return none_of(Preds, [](BasicBlock* Pred) {
+      return isa<IndirectBrInst>(Pred->getTerminator()) || isa<CallBrInst>(Pred->getTerminator());
+    });
+  }
+  BasicBlock* splitEdges(BasicBlock* Succ, ArrayRef<BasicBlock*> Preds, const char* Suffix);
+
+  bool insertPreheader(UnitLoop& L);
+  bool mergeLatches(UnitLoop& L);
+  bool insertDedicatedExits(UnitLoop& L);
+
+  UnitLoopInfo& m_Loops;
+  std::vector<UnitLoop> m_AllLoops;
+};
+} // namespace
+
+/// Move the edges from Preds to Succ onto a new block in between, which is
+/// part of the loops containing all of them. Returns nullptr if Succ's edges
+/// can't be split, as for EH pads.
+BasicBlock* LoopSimplifier::splitEdges(BasicBlock* Succ, ArrayRef<BasicBlock*> Preds, const char* Suffix) {
+  BasicBlock* NewBB = SplitBlockPredecessors(Succ, Preds, Suffix);
+  if (!NewBB)
+    return nullptr;
+  m_Loops.addBlockOnEdges(NewBB, Preds, Succ);
+  for (UnitLoop& L : m_AllLoops) {
+    if (L.contains(Succ) && all_of(Preds, [&](BasicBlock* Pred) { return L.contains(Pred); })) {
+      L.m_Blocks.push_back(NewBB);
+      L.m_BlockSet.insert(NewBB);
+    }
+  }
+  return NewBB;
+}
+
+bool LoopSimplifier::insertPreheader(UnitLoop& L) {
+  if (L.getPreheader())
+    return false;
+  std::vector<BasicBlock*> Outside;
+  for (BasicBlock* Pred : predecessors(L.m_Header)) {
+    if (!L.contains(Pred) && !is_contained(Outside, Pred))
+      Outside.push_back(Pred);
+  }
+  if (Outside.empty() || !canSplitEdgesFrom(Outside))
+    return false;
+  if (!splitEdges(L.m_Header, Outside, ".preheader"))
+    return false;
+  NumPreheaders++;
+  return true;
+}
+
+bool LoopSimplifier::mergeLatches(UnitLoop& L) {
+  if (L.m_Latches.size() < 2 || !canSplitEdgesFrom(L.m_Latches))
+    return false;
+  std::vector<BasicBlock*> Latches = L.m_Latches;
+  BasicBlock* NewLatch = SplitBlockPredecessors(L.m_Header, Latches, ".latch");
+  if (!NewLatch)
+    return false;
+  m_Loops.mergeLatches(L.m_Header, Latches, NewLatch);
+  for (UnitLoop& Other : m_AllLoops) {
+    if (Other.contains(L.m_Header)) {
+      Other.m_Blocks.push_back(NewLatch);
+      Other.m_BlockSet.insert(NewLatch);
+    }
+  }
+  L.m_Latches = {NewLatch};
+  NumLatchesMerged++;
+  return true;
+}
+
+/// Exit blocks also reached from outside the loop get a block of their own
+/// for the edges from the loop
+bool LoopSimplifier::insertDedicatedExits(UnitLoop& L) {
+  bool Changed = false;
+  for (BasicBlock* Exit : L.getExitBlocks()) {
+    std::vector<BasicBlock*> Inside;
+    bool HasOutside = false;
+    for (BasicBlock* Pred : predecessors(Exit)) {
+      if (!L.contains(Pred))
+        HasOutside = true;
+      else if (!is_contained(Inside, Pred))
+        Inside.push_back(Pred);
+    }
+    if (!HasOutside || !canSplitEdgesFrom(Inside))
+      continue;
+    if (!splitEdges(Exit, Inside, ".loopexit"))
+      continue;
+    NumExitsSplit++;
+    Changed = true;
+  }
+  return Changed;
+}
+
+bool LoopSimplifier::run() {
+  bool Changed = false;
+  for (UnitLoop& L : m_AllLoops) {
+    Changed |= insertPreheader(L);
+    Changed |= mergeLatches(L);
+    Changed |= insertDedicatedExits(L);
+  }
+  return Changed;
+}
+
+/// Main function for running the loop simplification
+PreservedAnalyses UnitLoopSimplify::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitLoopSimplify running on " << F.getName() << "\n";
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  LoopSimplifier Simplifier(F, Loops);
+  if (!Simplifier.run())
+    return PreservedAnalyses::all();
+  // New blocks, which the loop analysis already knows about
+  PreservedAnalyses PA;
+  PA.preserve<UnitLoopAnalysis>();
+  return PA;
+}
@@ -0,0 +1,16 @@
+#ifndef INCLUDE_UNIT_LOOP_SIMPLIFY_H
+#define INCLUDE_UNIT_LOOP_SIMPLIFY_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop Simplification Pass. Gives every loop a preheader, a single latch
+/// and exit blocks only reached from inside the loop, recording the new
+/// blocks in the UnitLoopInfo of the function instead of recomputing it.
+struct UnitLoopSimplify : PassInfoMixin<UnitLoopSimplify> {
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_LOOP_SIMPLIFY_H
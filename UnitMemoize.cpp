@@ -0,0 +1,204 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-memoize"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include <unordered_set>
+
+#include "UnitMemoize.h"
+#include "UnitParRecurse.h"
+
+#define DEBUG_TYPE "UnitMemoize"
+// Define any statistics here
+STATISTIC(NumFunctionsMemoized, "Number of functions memoized");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// Attribute marking the bodies split off memoized functions
+const char* BodyAttribute = "unit-memoize";
+
+// Attributes of the functions unit-par-recurse and unit-parallelize run on
+// the thread pool, whose calls would race on the unsynchronized table
+const char* ParallelAttributes[] = {"unit-par-recurse", "unit-parallel-body"};
+
+// Arguments a table entry holds at most
+const unsigned MaxKeyArgs = 4;
+
+// Fibonacci hashing multiplier, 2^64 divided by the golden ratio
+const uint64_t HashMultiplier = 0x9E3779B97F4A7C15ULL;
+} // namespace
+
+static bool isSmallValueType(Type* Ty) {
+  return (Ty->isIntegerTy() && Ty->getIntegerBitWidth() <= 64) || Ty->isFloatTy() || Ty->isDoubleTy();
+}
+
+static unsigned countSelfCalls(Function& F) {
+  unsigned Count = 0;
+  for (Instruction& I : instructions(F)) {
+    auto* CI = dyn_cast<CallInst>(&I);
+    if (CI && CI->getCalledFunction() == &F)
+      Count++;
+  }
+  return Count;
+}
+
+/// Functions the thread pool may run: the parallel ones and whatever they
+/// call directly or indirectly. Sets AllParallel if an indirect call could
+/// reach any function.
+static std::unordered_set<Function*> getParallelFunctions(Module& M, bool& AllParallel) {
+  std::unordered_set<Function*> Parallel;
+  std::vector<Function*> Work;
+  for (Function& F : M) {
+    if (any_of(ParallelAttributes, [&](const char* Attr) { return F.hasFnAttribute(Attr); }) &&
+        Parallel.insert(&F).second)
+      Work.push_back(&F);
+  }
+  AllParallel = false;
+  while (!Work.empty()) {
+    Function* F = Work.back();
+    Work.pop_back();
+    for (Instruction& I : instructions(*F)) {
+      auto* CB = dyn_cast<CallBase>(&I);
+      if (!CB)
+        continue;
+      Function* Callee = CB->getCalledFunction();
+      if (!Callee && !CB->isInlineAsm())
+        AllParallel = true;
+      else if (Callee && !Callee->isDeclaration() && Parallel.insert(Callee).second)
+        Work.push_back(Callee);
+    }
+  }
+  return Parallel;
+}
+
+/// Whether a table can stand in for F: its result only depends on a few
+/// small arguments and it recurses often enough to look results up again
+static bool isMemoizable(Function& F, unsigned MinFanOut) {
+  if (F.hasFnAttribute(BodyAttribute) || !isSmallValueType(F.getReturnType()) || F.arg_size() == 0 ||
+      F.arg_size() > MaxKeyArgs || !all_of(F.args(), [](Argument& Arg) { return isSmallValueType(Arg.getType()); }))
+    return false;
+  return countSelfCalls(F) >= MinFanOut && isPureFunction(F);
+}
+
+/// The bits of V as an integer of its width
+static Value* getKeyBits(IRBuilder<>& Builder, Value* V) {
+  if (V->getType()->isIntegerTy())
+    return V;
+  return Builder.CreateBitCast(V, Builder.getIntNTy(V->getType()->getPrimitiveSizeInBits()));
+}
+
+/// F and the calls of it now access the table
+static void dropMemoryAttributes(Function& F) {
+  const Attribute::AttrKind Kinds[] = {Attribute::ReadNone, Attribute::ReadOnly, Attribute::WriteOnly,
+                                       Attribute::ArgMemOnly, Attribute::InaccessibleMemOnly,
+                                       Attribute::InaccessibleMemOrArgMemOnly, Attribute::Speculatable};
+  for (Attribute::AttrKind Kind : Kinds) {
+    F.removeFnAttr(Kind);
+    for (User* U : F.users()) {
+      if (auto* CB = dyn_cast<CallBase>(U))
+        CB->removeFnAttr(Kind);
+    }
+  }
+}
+
+/// Move the body of F into F.body, and make F look the arguments up in a
+/// table of Size entries {Args..., Result, Valid}, calling F.body and
+/// filling in the entry on a miss
+static void memoize(Function& F, unsigned Size) {
+  Module& M = *F.getParent();
+  LLVMContext& Ctx = F.getContext();
+  Function* Body = Function::Create(F.getFunctionType(), GlobalValue::InternalLinkage, F.getName() + ".body", M);
+  dropMemoryAttributes(F);
+  Body->copyAttributesFrom(&F);
+  Body->setLinkage(GlobalValue::InternalLinkage);
+  Body->addFnAttr(BodyAttribute);
+  Body->getBasicBlockList().splice(Body->end(), F.getBasicBlockList());
+  for (Argument& Arg : F.args()) {
+    Body->getArg(Arg.getArgNo())->setName(Arg.getName());
+    Arg.replaceAllUsesWith(Body->getArg(Arg.getArgNo()));
+  }
+
+  // Floating point keys are compared by their bits, which tells apart -0.0
+  // from 0.0 and finds NaNs again
+  std::vector<Type*> EntryTypes;
+  for (Argument& Arg : F.args())
+    EntryTypes.push_back(IntegerType::get(Ctx, Arg.getType()->getPrimitiveSizeInBits()));
+  EntryTypes.push_back(F.getReturnType());
+  EntryTypes.push_back(Type::getInt8Ty(Ctx));
+  StructType* EntryTy = StructType::create(Ctx, EntryTypes, (F.getName() + ".memo.entry").str());
+  auto* TableTy = ArrayType::get(EntryTy, Size);
+  auto* Table = new GlobalVariable(M, TableTy, false, GlobalValue::InternalLinkage,
+                                   ConstantAggregateZero::get(TableTy), F.getName() + ".memo");
+
+  BasicBlock* Entry = BasicBlock::Create(Ctx, "entry", &F);
+  BasicBlock* Hit = BasicBlock::Create(Ctx, "memo.hit", &F);
+  BasicBlock* Miss = BasicBlock::Create(Ctx, "memo.miss", &F);
+  IRBuilder<> Builder(Entry);
+  Type* Int64Ty = Builder.getInt64Ty();
+  std::vector<Value*> Keys;
+  Value* Hash = Builder.getInt64(0);
+  for (Argument& Arg : F.args()) {
+    Keys.push_back(getKeyBits(Builder, &Arg));
+    Hash = Builder.CreateMul(Builder.CreateXor(Hash, Builder.CreateZExt(Keys.back(), Int64Ty)),
+                             Builder.getInt64(HashMultiplier), "memo.hash");
+  }
+  // The high bits of the product depend on all bits of the keys
+  Value* Index = Builder.CreateLShr(Hash, 64 - Log2_32(Size), "memo.index");
+  Value* Slot = Builder.CreateGEP(TableTy, Table, {Builder.getInt64(0), Index}, "memo.slot");
+  unsigned ValidField = Keys.size() + 1;
+  Value* Found = Builder.CreateICmpNE(
+      Builder.CreateLoad(Builder.getInt8Ty(), Builder.CreateStructGEP(EntryTy, Slot, ValidField)), Builder.getInt8(0));
+  for (unsigned i = 0; i < Keys.size(); i++) {
+    Value* Stored = Builder.CreateLoad(EntryTypes[i], Builder.CreateStructGEP(EntryTy, Slot, i));
+    Found = Builder.CreateAnd(Found, Builder.CreateICmpEQ(Stored, Keys[i]), "memo.found");
+  }
+  Builder.CreateCondBr(Found, Hit, Miss);
+
+  Builder.SetInsertPoint(Hit);
+  Builder.CreateRet(Builder.CreateLoad(F.getReturnType(), Builder.CreateStructGEP(EntryTy, Slot, Keys.size())));
+
+  // The entry is only written once the result is known, as the body's own
+  // lookups may reuse the slot in the meantime
+  Builder.SetInsertPoint(Miss);
+  std::vector<Value*> Args;
+  for (Argument& Arg : F.args())
+    Args.push_back(&Arg);
+  Value* Result = Builder.CreateCall(Body, Args);
+  for (unsigned i = 0; i < Keys.size(); i++)
+    Builder.CreateStore(Keys[i], Builder.CreateStructGEP(EntryTy, Slot, i));
+  Builder.CreateStore(Result, Builder.CreateStructGEP(EntryTy, Slot, Keys.size()));
+  Builder.CreateStore(Builder.getInt8(1), Builder.CreateStructGEP(EntryTy, Slot, ValidField));
+  Builder.CreateRet(Result);
+}
+
+/// Main function for running the memoization
+PreservedAnalyses UnitMemoize::run(Module& M, ModuleAnalysisManager& MAM) {
+  dbgs() << "UnitMemoize running on " << M.getName() << "\n";
+  FunctionAnalysisManager& FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+  unsigned Size = PowerOf2Ceil(std::max(m_TableSize, 2u));
+
+  // No thread but one may call a memoized function
+  bool AllParallel;
+  std::unordered_set<Function*> Parallel = getParallelFunctions(M, AllParallel);
+  std::vector<Function*> Functions;
+  for (Function& F : M) {
+    if (!F.isDeclaration() && !AllParallel && !Parallel.count(&F) && isMemoizable(F, m_MinFanOut))
+      Functions.push_back(&F);
+  }
+  for (Function* F : Functions) {
+    dbgs() << "[UnitMemoize] Memoizing " << F->getName() << " with " << countSelfCalls(*F) << " self calls\n";
+    memoize(*F, Size);
+    NumFunctionsMemoized++;
+  }
+  if (Functions.empty())
+    return PreservedAnalyses::all();
+  for (Function& F : M)
+    FAM.invalidate(F, PreservedAnalyses::none());
+  return PreservedAnalyses::none();
+}
@@ -0,0 +1,26 @@
+#ifndef INCLUDE_UNIT_MEMOIZE_H
+#define INCLUDE_UNIT_MEMOIZE_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Memoization Pass. Moves the body of pure recursive functions taking a few
+/// integer or floating point arguments into a new function, and turns the
+/// original one into a lookup in a direct-mapped table of earlier results,
+/// which only calls the body on a miss. Only functions making enough self
+/// calls per invocation to recompute results over and over are memoized.
+struct UnitMemoize : PassInfoMixin<UnitMemoize> {
+  UnitMemoize(unsigned TableSize = 4096, unsigned MinFanOut = 2)
+      : m_TableSize(TableSize), m_MinFanOut(MinFanOut) {}
+
+  PreservedAnalyses run(Module& M, ModuleAnalysisManager& MAM);
+
+  // Entries of the table of each function, rounded up to a power of two
+  unsigned m_TableSize;
+  // Self calls a function has to make to be memoized
+  unsigned m_MinFanOut;
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_MEMOIZE_H
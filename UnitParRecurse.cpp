@@ -0,0 +1,288 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-par-recurse"
+// and link the result with libUnitRuntime.so
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include "UnitParRecurse.h"
+
+#define DEBUG_TYPE "UnitParRecurse"
+// Define any statistics here
+STATISTIC(NumFunctionsParallelized, "Number of recursive functions given a parallel version");
+STATISTIC(NumCallsSpawned, "Number of recursive calls spawned as tasks");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// Attribute marking the functions this pass created
+const char* ParallelAttribute = "unit-par-recurse";
+
+// Self calls in one block that don't depend on each other's results, and
+// the instructions between them that do, which have to wait for the tasks
+// and move in front of m_End, the instruction ending the group
+struct CallGroup {
+  std::vector<CallInst*> m_Calls;
+  std::vector<Instruction*> m_Deferred;
+  Instruction* m_End = nullptr;
+};
+} // namespace
+
+bool cs426::isPureFunction(const Function& F) {
+  if (F.isDeclaration() || F.isVarArg())
+    return false;
+  for (const Instruction& I : instructions(F)) {
+    if (auto* CB = dyn_cast<CallBase>(&I)) {
+      const Function* Callee = CB->getCalledFunction();
+      if (!isa<CallInst>(CB) || !Callee || (Callee != &F && (!Callee->doesNotAccessMemory() || !CB->doesNotThrow())))
+        return false;
+      continue;
+    }
+    if (I.mayReadOrWriteMemory() || I.mayThrow())
+      return false;
+  }
+  return true;
+}
+
+static bool isSelfCall(const Instruction& I, const Function& F) {
+  auto* CI = dyn_cast<CallInst>(&I);
+  return CI && CI->getCalledFunction() == &F && CI->getFunctionType() == F.getFunctionType();
+}
+
+/// Split the calls of Callee in every block of F into groups of calls that
+/// can run at the same time. A group ends at the first instruction using its results
+/// that can't be moved after the last call, like a call or the terminator.
+static std::vector<CallGroup> findCallGroups(Function& F, Function& Callee) {
+  std::vector<CallGroup> Groups;
+  for (BasicBlock& BB : F) {
+    CallGroup Group;
+    SmallPtrSet<Instruction*, 16> Dependent;
+    auto finishGroup = [&](Instruction* End) {
+      Group.m_End = End;
+      if (Group.m_Calls.size() > 1)
+        Groups.push_back(Group);
+      Group = CallGroup();
+      Dependent.clear();
+    };
+    for (Instruction& I : BB) {
+      auto usesGroup = [&]() {
+        return any_of(I.operands(), [&](Value* Op) {
+          auto* OpI = dyn_cast<Instruction>(Op);
+          return OpI && Dependent.count(OpI);
+        });
+      };
+      if (usesGroup() && (isa<CallBase>(I) || I.isTerminator()))
+        finishGroup(&I);
+      if (isSelfCall(I, Callee) && !usesGroup()) {
+        Group.m_Calls.push_back(cast<CallInst>(&I));
+        Dependent.insert(&I);
+      } else if (usesGroup()) {
+        Group.m_Deferred.push_back(&I);
+        Dependent.insert(&I);
+      }
+    }
+    finishGroup(BB.getTerminator());
+  }
+  return Groups;
+}
+
+/// Copy F into F.par(Args..., Depth)
+static Function* createParallelVersion(Function& F) {
+  std::vector<Type*> Params(F.getFunctionType()->param_begin(), F.getFunctionType()->param_end());
+  Params.push_back(Type::getInt32Ty(F.getContext()));
+  auto* ParTy = FunctionType::get(F.getReturnType(), Params, false);
+  Function* Par = Function::Create(ParTy, GlobalValue::InternalLinkage, F.getName() + ".par", F.getParent());
+  ValueToValueMapTy VMap;
+  for (Argument& Arg : F.args()) {
+    VMap[&Arg] = Par->getArg(Arg.getArgNo());
+    Par->getArg(Arg.getArgNo())->setName(Arg.getName());
+  }
+  SmallVector<ReturnInst*, 4> Returns;
+  CloneFunctionInto(Par, &F, VMap, CloneFunctionChangeType::LocalChangesOnly, Returns);
+  Par->setLinkage(GlobalValue::InternalLinkage);
+  Par->addFnAttr(ParallelAttribute);
+  Par->getArg(F.arg_size())->setName("depth");
+  return Par;
+}
+
+/// Make Par run F itself once its depth reaches the cutoff
+static void addCutoff(Function& Par, Function& F, unsigned Cutoff) {
+  LLVMContext& Ctx = F.getContext();
+  BasicBlock* Entry = &Par.getEntryBlock();
+  BasicBlock* Check = BasicBlock::Create(Ctx, "cutoff", &Par, Entry);
+  BasicBlock* Sequential = BasicBlock::Create(Ctx, "sequential", &Par, Entry);
+  // The frames stay allocated once in the entry block
+  for (Instruction& I : make_early_inc_range(*Entry)) {
+    if (isa<AllocaInst>(I))
+      I.moveBefore(*Check, Check->end());
+  }
+  IRBuilder<> Builder(Check);
+  Argument* Depth = Par.getArg(F.arg_size());
+  Builder.CreateCondBr(Builder.CreateICmpUGE(Depth, ConstantInt::get(Depth->getType(), Cutoff), "deep"),
+                       Sequential, Entry);
+  Builder.SetInsertPoint(Sequential);
+  std::vector<Value*> Args;
+  for (unsigned i = 0; i < F.arg_size(); i++)
+    Args.push_back(Par.getArg(i));
+  Builder.CreateRet(Builder.CreateCall(&F, Args));
+}
+
+/// The function running a spawned call, Task(Frame), where Frame points to
+/// the call's arguments and depth followed by a slot for its result
+static Function* createTask(Function& Par, StructType* FrameTy) {
+  LLVMContext& Ctx = Par.getContext();
+  auto* TaskTy = FunctionType::get(Type::getVoidTy(Ctx), {Type::getInt8PtrTy(Ctx)}, false);
+  Function* Task = Function::Create(TaskTy, GlobalValue::InternalLinkage, Par.getName() + ".task", Par.getParent());
+  Task->addFnAttr(ParallelAttribute);
+  Task->addFnAttr(Attribute::NoUnwind);
+  Task->getArg(0)->setName("frame");
+  IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", Task));
+  Value* Frame = Builder.CreatePointerCast(Task->getArg(0), FrameTy->getPointerTo());
+  std::vector<Value*> Args;
+  for (unsigned i = 0; i < Par.arg_size(); i++)
+    Args.push_back(Builder.CreateLoad(FrameTy->getElementType(i), Builder.CreateStructGEP(FrameTy, Frame, i)));
+  Builder.CreateStore(Builder.CreateCall(&Par, Args), Builder.CreateStructGEP(FrameTy, Frame, Par.arg_size()));
+  Builder.CreateRetVoid();
+  return Task;
+}
+
+/// Call Par instead of F at the place of CI, one level deeper than Depth
+static CallInst* callDeeper(CallInst* CI, Function& Par, Value* Depth) {
+  IRBuilder<> Builder(CI);
+  std::vector<Value*> Args(CI->arg_begin(), CI->arg_end());
+  Args.push_back(Builder.CreateAdd(Depth, ConstantInt::get(Depth->getType(), 1), "depth.next"));
+  CallInst* Call = Builder.CreateCall(&Par, Args);
+  Call->takeName(CI);
+  CI->replaceAllUsesWith(Call);
+  CI->eraseFromParent();
+  return Call;
+}
+
+/// Spawn all calls of the group but the last, and wait for them right after
+/// the last one returns
+static void forkGroup(CallGroup& Group, Function& Par, Function& Task, StructType* FrameTy) {
+  Module& M = *Par.getParent();
+  LLVMContext& Ctx = M.getContext();
+  Type* Int64Ty = Type::getInt64Ty(Ctx);
+  Type* Int8PtrTy = Type::getInt8PtrTy(Ctx);
+  Argument* Depth = Par.getArg(Par.arg_size() - 1);
+  FunctionCallee Spawn = M.getOrInsertFunction("__unit_spawn", Type::getVoidTy(Ctx), Task.getType(), Int8PtrTy,
+                                               Int64Ty->getPointerTo());
+  FunctionCallee Sync = M.getOrInsertFunction("__unit_sync", Type::getVoidTy(Ctx), Int64Ty->getPointerTo());
+
+  IRBuilder<> Builder(&*Par.getEntryBlock().getFirstInsertionPt());
+  AllocaInst* Pending = Builder.CreateAlloca(Int64Ty, nullptr, "pending");
+  std::vector<AllocaInst*> Frames;
+  for (unsigned i = 0; i + 1 < Group.m_Calls.size(); i++)
+    Frames.push_back(Builder.CreateAlloca(FrameTy, nullptr, "frame"));
+
+  Builder.SetInsertPoint(Group.m_Calls.front());
+  Builder.CreateStore(ConstantInt::get(Int64Ty, 0), Pending);
+  for (unsigned i = 0; i < Frames.size(); i++) {
+    CallInst* CI = Group.m_Calls[i];
+    Builder.SetInsertPoint(CI);
+    for (unsigned j = 0; j < CI->arg_size(); j++)
+      Builder.CreateStore(CI->getArgOperand(j), Builder.CreateStructGEP(FrameTy, Frames[i], j));
+    Builder.CreateStore(Builder.CreateAdd(Depth, ConstantInt::get(Depth->getType(), 1), "depth.next"),
+                        Builder.CreateStructGEP(FrameTy, Frames[i], CI->arg_size()));
+    Builder.CreateCall(Spawn, {&Task, Builder.CreatePointerCast(Frames[i], Int8PtrTy), Pending});
+    NumCallsSpawned++;
+  }
+
+  // The spawned results are read once all tasks are done, and the
+  // instructions using them move behind that. They go to the end of the
+  // group, in their order, as the instructions left in place may feed them.
+  CallInst* Last = callDeeper(Group.m_Calls.back(), Par, Depth);
+  Builder.SetInsertPoint(Last->getNextNode());
+  Builder.CreateCall(Sync, {Pending});
+  for (unsigned i = 0; i < Frames.size(); i++) {
+    CallInst* CI = Group.m_Calls[i];
+    Value* Result =
+        Builder.CreateLoad(CI->getType(), Builder.CreateStructGEP(FrameTy, Frames[i], CI->arg_size() + 1));
+    Result->takeName(CI);
+    CI->replaceAllUsesWith(Result);
+    CI->eraseFromParent();
+  }
+  for (Instruction* I : Group.m_Deferred)
+    I->moveBefore(Group.m_End);
+}
+
+/// Give F a parallel version if it makes independent self calls, and call
+/// that from everywhere else
+static bool parallelizeRecursion(Function& F, unsigned Cutoff) {
+  if (F.getReturnType()->isVoidTy() || !isPureFunction(F) || findCallGroups(F, F).empty())
+    return false;
+  std::vector<CallInst*> CallSites;
+  for (User* U : F.users()) {
+    auto* CI = dyn_cast<CallInst>(U);
+    if (CI && CI->getCalledFunction() == &F && CI->getFunctionType() == F.getFunctionType() &&
+        CI->getFunction() != &F)
+      CallSites.push_back(CI);
+  }
+  if (CallSites.empty())
+    return false;
+
+  Function* Par = createParallelVersion(F);
+  std::vector<Type*> FrameTypes(F.getFunctionType()->param_begin(), F.getFunctionType()->param_end());
+  FrameTypes.push_back(Type::getInt32Ty(F.getContext()));
+  FrameTypes.push_back(F.getReturnType());
+  StructType* FrameTy = StructType::create(F.getContext(), FrameTypes, (F.getName() + ".par.frame").str());
+  Function* Task = createTask(*Par, FrameTy);
+
+  // The clone still calls F, it calls itself one level deeper instead
+  std::vector<CallGroup> Groups = findCallGroups(*Par, F);
+  SmallPtrSet<CallInst*, 8> Grouped;
+  for (CallGroup& Group : Groups)
+    Grouped.insert(Group.m_Calls.begin(), Group.m_Calls.end());
+  std::vector<CallInst*> Others;
+  for (Instruction& I : instructions(*Par)) {
+    if (isSelfCall(I, F) && !Grouped.count(cast<CallInst>(&I)))
+      Others.push_back(cast<CallInst>(&I));
+  }
+  for (CallGroup& Group : Groups)
+    forkGroup(Group, *Par, *Task, FrameTy);
+  for (CallInst* CI : Others)
+    callDeeper(CI, *Par, Par->getArg(F.arg_size()));
+  addCutoff(*Par, F, Cutoff);
+
+  for (CallInst* CI : CallSites) {
+    IRBuilder<> Builder(CI);
+    std::vector<Value*> Args(CI->arg_begin(), CI->arg_end());
+    Args.push_back(Builder.getInt32(0));
+    CallInst* Call = Builder.CreateCall(Par, Args);
+    Call->takeName(CI);
+    CI->replaceAllUsesWith(Call);
+    CI->eraseFromParent();
+  }
+  dbgs() << "[UnitParRecurse] Forking " << Groups.size() << " call group(s) of " << F.getName() << "\n";
+  NumFunctionsParallelized++;
+  return true;
+}
+
+/// Main function for running the recursive fork-join parallelization
+PreservedAnalyses UnitParRecurse::run(Module& M, ModuleAnalysisManager& MAM) {
+  dbgs() << "UnitParRecurse running on " << M.getName() << "\n";
+  FunctionAnalysisManager& FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  std::vector<Function*> Functions;
+  for (Function& F : M) {
+    if (!F.isDeclaration() && !F.hasFnAttribute(ParallelAttribute))
+      Functions.push_back(&F);
+  }
+  bool Changed = false;
+  for (Function* F : Functions) {
+    if (parallelizeRecursion(*F, m_Cutoff)) {
+      // The callers of F now call its parallel version
+      for (Function& Caller : M)
+        FAM.invalidate(Caller, PreservedAnalyses::none());
+      Changed = true;
+    }
+  }
+  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
@@ -0,0 +1,29 @@
+#ifndef INCLUDE_UNIT_PAR_RECURSE_H
+#define INCLUDE_UNIT_PAR_RECURSE_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Whether F computes its result from its arguments alone: it doesn't
+/// access memory or throw, and only calls itself and functions like that
+bool isPureFunction(const Function& F);
+
+/// Recursive Fork-Join Parallelization Pass. Gives pure recursive functions
+/// that make several self calls not depending on each other a parallel
+/// version, which spawns all but the last of those calls as tasks of the
+/// UnitRuntime library and waits for them after running the last one. The
+/// parallel version tracks its recursion depth and falls back to the
+/// original function from the cutoff on, where the calls get too small to
+/// pay for a task.
+struct UnitParRecurse : PassInfoMixin<UnitParRecurse> {
+  UnitParRecurse(unsigned Cutoff = 8) : m_Cutoff(Cutoff) {}
+
+  PreservedAnalyses run(Module& M, ModuleAnalysisManager& MAM);
+
+  // Recursion depth from which calls run sequentially
+  unsigned m_Cutoff;
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_PAR_RECURSE_H
@@ -0,0 +1,438 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-parallelize"
+// and link the result with libUnitRuntime.so
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include "UnitDependence.h"
+#include "UnitLoopInfo.h"
+#include "UnitParallelize.h"
+
+#define DEBUG_TYPE "UnitParallelize"
+// Define any statistics here
+STATISTIC(NumLoopsParallelized, "Number of loops run on the thread pool");
+STATISTIC(NumRuntimeChecks, "Number of runtime overlap checks emitted");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// Attribute marking the functions holding a parallel loop body, whose loops
+// are already running in parallel
+const char* BodyAttribute = "unit-parallel-body";
+
+// Pairs of arrays a loop may check for overlap before running in parallel
+const unsigned MaxRuntimeChecks = 8;
+
+// IVs an address checked at run time may depend on, it is evaluated at all
+// combinations of their first and last values
+const unsigned MaxCornerIVs = 3;
+
+/// Parallelizes one loop. analyze() checks whether its iterations can run in
+/// any order on any thread, possibly after checking at run time that
+/// arrays it accesses through different pointers don't overlap.
+class LoopParallelizer {
+public:
+  LoopParallelizer(const UnitLoop& L, const UnitInduction& Ind, const NestDependences& Nest,
+                   const std::unordered_map<BasicBlock*, const UnitLoop*>& LoopOfHeader)
+      : m_Loop(L), m_Ind(Ind), m_Nest(Nest), m_LoopOfHeader(LoopOfHeader) {}
+
+  bool analyze();
+
+  // Replace the loop by a call of __unit_parallel_for, keeping it for when
+  // the runtime checks fail
+  void parallelize(unsigned Threshold);
+
+private:
+  bool isInvariant(Value* V) const {
+    auto* I = dyn_cast<Instruction>(V);
+    return !I || !m_Loop.contains(I->getParent());
+  }
+  bool canExpand(Value* V, SetVector<PHINode*>& IVs);
+  Value* expandAt(Value* V, DenseMap<Value*, Value*>& Expanded, IRBuilder<>& Builder);
+  std::pair<Value*, Value*> createRange(Value* Base, IRBuilder<>& Builder);
+  Value* createChecks(IRBuilder<>& Builder);
+  Function* createBody(Module& M, StructType* CtxTy, const SetVector<Value*>& Inputs);
+
+  const UnitLoop& m_Loop;
+  const UnitInduction& m_Ind;
+  const NestDependences& m_Nest;
+  const std::unordered_map<BasicBlock*, const UnitLoop*>& m_LoopOfHeader;
+
+  // Loop control of every IV the checked addresses depend on
+  DenseMap<PHINode*, UnitInduction> m_IVs;
+  // Pairs of bases whose accesses must not overlap
+  std::vector<std::pair<Value*, Value*>> m_Checks;
+  // Checked accesses by base, with the IVs their address depends on
+  MapVector<Value*, std::vector<std::pair<Instruction*, SetVector<PHINode*>>>> m_Checked;
+};
+} // namespace
+
+/// Whether V can be computed in front of the loop for given values of the
+/// IVs it depends on, which are collected in IVs
+bool LoopParallelizer::canExpand(Value* V, SetVector<PHINode*>& IVs) {
+  if (isInvariant(V))
+    return true;
+  if (auto* Phi = dyn_cast<PHINode>(V)) {
+    // The IV of a loop that is rectangular relative to this one
+    const UnitLoop* L = m_LoopOfHeader.count(Phi->getParent()) ? m_LoopOfHeader.at(Phi->getParent()) : nullptr;
+    UnitInduction Ind;
+    if (!L || !analyzeInduction(*L, Ind) || Ind.m_IV != Phi || !isInvariant(Ind.m_Start) ||
+        !isInvariant(Ind.m_Bound) || !Ind.isCountComputable())
+      return false;
+    m_IVs[Phi] = Ind;
+    IVs.insert(Phi);
+    return IVs.size() <= MaxCornerIVs;
+  }
+  auto* I = cast<Instruction>(V);
+  switch (I->getOpcode()) {
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::Mul:
+  case Instruction::Shl:
+  case Instruction::SExt:
+  case Instruction::ZExt:
+  case Instruction::Trunc:
+  case Instruction::BitCast:
+  case Instruction::GetElementPtr:
+    return all_of(I->operands(), [&](Value* Op) { return canExpand(Op, IVs); });
+  default:
+    return false;
+  }
+}
+
+/// Compute V in front of the loop, for the IV values in Expanded
+Value* LoopParallelizer::expandAt(Value* V, DenseMap<Value*, Value*>& Expanded, IRBuilder<>& Builder) {
+  if (isInvariant(V))
+    return V;
+  if (Value* E = Expanded.lookup(V))
+    return E;
+  Instruction* I = cast<Instruction>(V)->clone();
+  for (Use& U : I->operands())
+    U.set(expandAt(U.get(), Expanded, Builder));
+  // The corners need not be addresses the loop actually computes
+  I->dropPoisonGeneratingFlags();
+  Builder.Insert(I, V->getName() + ".par.check");
+  Expanded[V] = I;
+  return I;
+}
+
+bool LoopParallelizer::analyze() {
+  if (!m_Loop.getPreheader() || !m_Loop.getLatch() || !m_Loop.isSafeToClone() || !m_Ind.isCountComputable())
+    return false;
+  if (m_Ind.m_ExitingBlock != m_Loop.m_Header && m_Ind.m_ExitingBlock != m_Loop.getLatch())
+    return false;
+  // Any other phi carries a value from one iteration to the next
+  if (std::next(m_Loop.m_Header->phis().begin()) != m_Loop.m_Header->phis().end())
+    return false;
+  for (BasicBlock* BB : m_Loop.m_Blocks) {
+    for (Instruction& I : *BB) {
+      if (isa<AllocaInst>(I) || I.mayThrow())
+        return false;
+      for (User* U : I.users()) {
+        if (!m_Loop.contains(cast<Instruction>(U)->getParent()))
+          return false;
+      }
+      for (Value* Op : I.operands()) {
+        if (auto* GV = dyn_cast<GlobalValue>(Op); GV && GV->isThreadLocal())
+          return false;
+      }
+    }
+  }
+  if (any_of(m_Nest.m_Unknown, [&](Instruction* I) { return m_Loop.contains(I->getParent()); }))
+    return false;
+
+  // Carried dependences are only allowed between different arrays that may
+  // be the same, which the runtime checks rule out
+  DenseMap<Instruction*, const NestAccess*> AccessOf;
+  for (const NestAccess& A : m_Nest.m_Accesses)
+    AccessOf[A.m_Inst] = &A;
+  for (const Dependence& Dep : m_Nest.m_Deps) {
+    if (!isCarriedBy(Dep, m_Loop))
+      continue;
+    Value* BaseA = AccessOf[Dep.m_Src]->m_Base;
+    Value* BaseB = AccessOf[Dep.m_Dst]->m_Base;
+    if (BaseA == BaseB || !isInvariant(BaseA) || !isInvariant(BaseB))
+      return false;
+    if (!is_contained(m_Checks, std::make_pair(BaseA, BaseB)) &&
+        !is_contained(m_Checks, std::make_pair(BaseB, BaseA)))
+      m_Checks.push_back({BaseA, BaseB});
+  }
+  if (m_Checks.size() > MaxRuntimeChecks)
+    return false;
+
+  // The address of an access depends linearly on the IVs when its
+  // subscripts are known, so its extremes lie on the corners of the
+  // iteration space
+  for (const NestAccess& A : m_Nest.m_Accesses) {
+    if (!m_Loop.contains(A.m_Inst->getParent()))
+      continue;
+    bool Checked = any_of(m_Checks, [&](auto& Check) { return Check.first == A.m_Base || Check.second == A.m_Base; });
+    if (!Checked)
+      continue;
+    // A load and a store of the same element need only one range
+    Value* Ptr = getLoadStorePointerOperand(A.m_Inst);
+    auto& Ranges = m_Checked[A.m_Base];
+    if (any_of(Ranges, [&](auto& Access) {
+          return getLoadStorePointerOperand(Access.first) == Ptr &&
+                 getLoadStoreType(Access.first) == getLoadStoreType(A.m_Inst);
+        }))
+      continue;
+    SetVector<PHINode*> IVs;
+    if (any_of(A.m_Subscripts, [](const Subscript& S) { return !S.m_Known; }) ||
+        !canExpand(Ptr, IVs))
+      return false;
+    Ranges.push_back({A.m_Inst, IVs});
+  }
+  return true;
+}
+
+/// Lowest address and the end of the highest access the loop makes through
+/// Base, as integers
+std::pair<Value*, Value*> LoopParallelizer::createRange(Value* Base, IRBuilder<>& Builder) {
+  const DataLayout& DL = m_Loop.m_Header->getModule()->getDataLayout();
+  Type* IntPtrTy = DL.getIntPtrType(Base->getType());
+  DenseMap<PHINode*, std::pair<Value*, Value*>> IVRange;
+  Value* Lo = nullptr;
+  Value* Hi = nullptr;
+  for (auto& [I, IVs] : m_Checked[Base]) {
+    for (PHINode* IV : IVs) {
+      if (IVRange.count(IV))
+        continue;
+      // All values the IV takes in the header, the last one included
+      const UnitInduction& Ind = m_IVs[IV];
+      Value* Last = Builder.CreateAdd(Ind.m_Start, Builder.CreateMul(ConstantInt::get(IV->getType(), Ind.m_Step),
+                                                                     Ind.createCount(Builder)));
+      IVRange[IV] = {Ind.m_Start, Last};
+    }
+    Value* Size = ConstantInt::get(IntPtrTy, DL.getTypeStoreSize(getLoadStoreType(I)));
+    for (unsigned Corner = 0; Corner < (1u << IVs.size()); Corner++) {
+      DenseMap<Value*, Value*> Expanded;
+      for (unsigned i = 0; i < IVs.size(); i++)
+        Expanded[IVs[i]] = Corner & (1 << i) ? IVRange[IVs[i]].second : IVRange[IVs[i]].first;
+      Value* Addr = Builder.CreatePtrToInt(expandAt(getLoadStorePointerOperand(I), Expanded, Builder), IntPtrTy);
+      Value* End = Builder.CreateAdd(Addr, Size);
+      Lo = Lo ? Builder.CreateSelect(Builder.CreateICmpULT(Addr, Lo), Addr, Lo) : Addr;
+      Hi = Hi ? Builder.CreateSelect(Builder.CreateICmpUGT(End, Hi), End, Hi) : End;
+    }
+  }
+  return {Lo, Hi};
+}
+
+/// Whether the arrays the loop may access through different pointers are
+/// disjoint, nullptr if there is nothing to check
+Value* LoopParallelizer::createChecks(IRBuilder<>& Builder) {
+  if (m_Checks.empty())
+    return nullptr;
+  DenseMap<Value*, std::pair<Value*, Value*>> Ranges;
+  for (auto& [Base, Accesses] : m_Checked)
+    Ranges[Base] = createRange(Base, Builder);
+  Value* Disjoint = Builder.getTrue();
+  for (auto [A, B] : m_Checks) {
+    auto [LoA, HiA] = Ranges[A];
+    auto [LoB, HiB] = Ranges[B];
+    Value* Overlap = Builder.CreateAnd(Builder.CreateICmpULT(LoA, HiB), Builder.CreateICmpULT(LoB, HiA));
+    Disjoint = Builder.CreateAnd(Disjoint, Builder.CreateNot(Overlap), "par.disjoint");
+    NumRuntimeChecks++;
+  }
+  return Disjoint;
+}
+
+/// Copy the loop into a new function Body(Ctx, First, Last) that runs its
+/// iterations [First, Last), loading the values the loop uses from outside
+/// from the struct Ctx points to
+Function* LoopParallelizer::createBody(Module& M, StructType* CtxTy, const SetVector<Value*>& Inputs) {
+  LLVMContext& Ctx = M.getContext();
+  Type* Int64Ty = Type::getInt64Ty(Ctx);
+  Function& F = *m_Loop.m_Header->getParent();
+  auto* BodyTy = FunctionType::get(Type::getVoidTy(Ctx), {Type::getInt8PtrTy(Ctx), Int64Ty, Int64Ty}, false);
+  Function* Body = Function::Create(BodyTy, GlobalValue::InternalLinkage, F.getName() + ".par.body", M);
+  Body->addFnAttr(BodyAttribute);
+  Body->addFnAttr(Attribute::NoUnwind);
+  Argument* First = Body->getArg(1);
+  Argument* Last = Body->getArg(2);
+  Body->getArg(0)->setName("ctx");
+  First->setName("first");
+  Last->setName("last");
+
+  ValueToValueMapTy VMap;
+  BasicBlock* Entry = BasicBlock::Create(Ctx, "entry", Body);
+  IRBuilder<> Builder(Entry);
+  Value* CtxPtr = Builder.CreatePointerCast(Body->getArg(0), CtxTy->getPointerTo());
+  for (unsigned i = 0; i < Inputs.size(); i++)
+    VMap[Inputs[i]] = Builder.CreateLoad(CtxTy->getElementType(i), Builder.CreateStructGEP(CtxTy, CtxPtr, i),
+                                         Inputs[i]->getName());
+  SmallVector<BasicBlock*, 8> Blocks;
+  for (BasicBlock* BB : m_Loop.m_Blocks) {
+    BasicBlock* Clone = CloneBasicBlock(BB, VMap, "", Body);
+    VMap[BB] = Clone;
+    Blocks.push_back(Clone);
+    // Debug info would still refer to the values of F
+    for (Instruction& I : make_early_inc_range(*Clone)) {
+      if (isa<DbgInfoIntrinsic>(I))
+        I.eraseFromParent();
+    }
+  }
+  BasicBlock* Exit = BasicBlock::Create(Ctx, "exit", Body);
+  ReturnInst::Create(Ctx, Exit);
+  VMap[m_Ind.m_ExitBlock] = Exit;
+  remapInstructionsInBlocks(Blocks, VMap);
+
+  // The IV starts at iteration First, and the loop leaves once a counter of
+  // the iterations reaches Last
+  auto* Header = cast<BasicBlock>(VMap[m_Loop.m_Header]);
+  auto* IV = cast<PHINode>(VMap[m_Ind.m_IV]);
+  Type* IVTy = IV->getType();
+  Value* Start = m_Ind.m_Start;
+  if (Value* Input = VMap.lookup(Start))
+    Start = Input;
+  Value* FirstIV = Builder.CreateAdd(
+      Start, Builder.CreateMul(ConstantInt::get(IVTy, m_Ind.m_Step), Builder.CreateTrunc(First, IVTy)), "first.iv");
+  IV->setIncomingBlock(IV->getBasicBlockIndex(m_Loop.getPreheader()), Entry);
+  IV->setIncomingValueForBlock(Entry, FirstIV);
+  Builder.CreateBr(Header);
+
+  auto* Latch = cast<BasicBlock>(VMap[m_Loop.getLatch()]);
+  PHINode* Iter = PHINode::Create(Int64Ty, 2, "par.iter", &Header->front());
+  auto* IterNext = BinaryOperator::CreateAdd(Iter, ConstantInt::get(Int64Ty, 1), "par.iter.next",
+                                             Latch->getTerminator());
+  Iter->addIncoming(First, Entry);
+  Iter->addIncoming(IterNext, Latch);
+  auto* Exiting = cast<BasicBlock>(VMap[m_Ind.m_ExitingBlock]);
+  Instruction* ExitBr = Exiting->getTerminator();
+  Value* Tested = m_Ind.m_ExitingBlock == m_Loop.m_Header ? (Value*)Iter : IterNext;
+  auto* Continue = new ICmpInst(ExitBr, ICmpInst::ICMP_SLT, Tested, Last, "par.cont");
+  BranchInst::Create(cast<BasicBlock>(VMap[m_Ind.m_InLoopSucc]), Exit, Continue, ExitBr);
+  ExitBr->eraseFromParent();
+  return Body;
+}
+
+void LoopParallelizer::parallelize(unsigned Threshold) {
+  BasicBlock* Preheader = m_Loop.getPreheader();
+  BasicBlock* Exit = m_Ind.m_ExitBlock;
+  Function& F = *Preheader->getParent();
+  Module& M = *F.getParent();
+  LLVMContext& Ctx = F.getContext();
+  Type* Int64Ty = Type::getInt64Ty(Ctx);
+
+  SetVector<Value*> Inputs;
+  for (BasicBlock* BB : m_Loop.m_Blocks) {
+    for (Instruction& I : *BB) {
+      for (Value* Op : I.operands()) {
+        if (isa<Argument>(Op) || (isa<Instruction>(Op) && isInvariant(Op)))
+          Inputs.insert(Op);
+      }
+    }
+  }
+  std::vector<Type*> InputTypes;
+  for (Value* V : Inputs)
+    InputTypes.push_back(V->getType());
+  StructType* CtxTy = StructType::create(Ctx, InputTypes, (F.getName() + ".par.ctx").str());
+  Function* Body = createBody(M, CtxTy, Inputs);
+
+  // The loop runs Count iterations when it tests in the header, and one
+  // more when it only tests at the end of the latch
+  IRBuilder<> Builder(Preheader->getTerminator());
+  Value* Count = Builder.CreateZExt(m_Ind.createCount(Builder), Int64Ty);
+  if (m_Ind.m_ExitingBlock != m_Loop.m_Header)
+    Count = Builder.CreateAdd(Count, ConstantInt::get(Int64Ty, 1), "count.latch");
+  Value* Disjoint = createChecks(Builder);
+
+  BasicBlock* Call = BasicBlock::Create(Ctx, m_Loop.m_Header->getName() + ".par", &F, m_Loop.m_Header);
+  Builder.SetInsertPoint(Call);
+  AllocaInst* CtxAlloca = new AllocaInst(CtxTy, M.getDataLayout().getAllocaAddrSpace(), "par.ctx",
+                                         &*F.getEntryBlock().getFirstInsertionPt());
+  for (unsigned i = 0; i < Inputs.size(); i++)
+    Builder.CreateStore(Inputs[i], Builder.CreateStructGEP(CtxTy, CtxAlloca, i));
+  FunctionCallee ParallelFor = M.getOrInsertFunction("__unit_parallel_for", Type::getVoidTy(Ctx), Body->getType(),
+                                                     Builder.getInt8PtrTy(), Int64Ty, Int64Ty);
+  Builder.CreateCall(ParallelFor, {Body, Builder.CreatePointerCast(CtxAlloca, Builder.getInt8PtrTy()), Count,
+                                   ConstantInt::get(Int64Ty, Threshold)});
+  Builder.CreateBr(Exit);
+  for (PHINode& Phi : Exit->phis())
+    Phi.addIncoming(Phi.getIncomingValueForBlock(m_Ind.m_ExitingBlock), Call);
+
+  Instruction* Term = Preheader->getTerminator();
+  if (Disjoint) {
+    BranchInst::Create(Call, m_Loop.m_Header, Disjoint, Term);
+    Term->eraseFromParent();
+    return;
+  }
+  Term->replaceSuccessorWith(m_Loop.m_Header, Call);
+  Exit->removePredecessor(m_Ind.m_ExitingBlock);
+  for (BasicBlock* BB : m_Loop.m_Blocks)
+    BB->dropAllReferences();
+  for (BasicBlock* BB : m_Loop.m_Blocks)
+    BB->eraseFromParent();
+}
+
+/// Parallelize the outermost loops of F that allow it, and try the loops
+/// inside the others
+static bool parallelizeFunction(Function& F, FunctionAnalysisManager& FAM, unsigned Threshold) {
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  UnitDependenceInfo& Deps = FAM.getResult<UnitDependenceAnalysis>(F);
+  std::vector<UnitLoop> AllLoops = Loops.getLoops(F);
+  std::unordered_map<BasicBlock*, const UnitLoop*> LoopOfHeader;
+  for (const UnitLoop& L : AllLoops)
+    LoopOfHeader[L.m_Header] = &L;
+
+  // All loops are analyzed before the first one changes
+  std::vector<std::unique_ptr<UnitInduction>> Inds;
+  std::vector<std::unique_ptr<LoopParallelizer>> Parallel;
+  std::vector<const UnitLoop*> Work;
+  for (const UnitLoop& L : AllLoops) {
+    if (!L.m_ParentHeader)
+      Work.push_back(&L);
+  }
+  while (!Work.empty()) {
+    const UnitLoop* L = Work.back();
+    Work.pop_back();
+    auto Ind = std::make_unique<UnitInduction>();
+    if (analyzeInduction(*L, *Ind)) {
+      auto P = std::make_unique<LoopParallelizer>(*L, *Ind, Deps.getDependences(L->m_Header), LoopOfHeader);
+      if (P->analyze()) {
+        dbgs() << "[UnitParallelize] Parallelizing loop " << L->m_Header->getName() << " of " << F.getName()
+               << "\n";
+        Inds.push_back(std::move(Ind));
+        Parallel.push_back(std::move(P));
+        continue;
+      }
+    }
+    for (BasicBlock* Sub : L->m_SubLoopHeaders)
+      Work.push_back(LoopOfHeader.at(Sub));
+  }
+
+  for (auto& P : Parallel) {
+    P->parallelize(Threshold);
+    NumLoopsParallelized++;
+  }
+  return !Parallel.empty();
+}
+
+/// Main function for running the loop parallelization
+PreservedAnalyses UnitParallelize::run(Module& M, ModuleAnalysisManager& MAM) {
+  dbgs() << "UnitParallelize running on " << M.getName() << "\n";
+  FunctionAnalysisManager& FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  // The new body functions are left alone
+  std::vector<Function*> Functions;
+  for (Function& F : M) {
+    if (!F.isDeclaration() && !F.hasFnAttribute(BodyAttribute))
+      Functions.push_back(&F);
+  }
+  bool Changed = false;
+  for (Function* F : Functions) {
+    if (parallelizeFunction(*F, FAM, m_Threshold)) {
+      FAM.invalidate(*F, PreservedAnalyses::none());
+      Changed = true;
+    }
+  }
+  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
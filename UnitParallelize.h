@@ -0,0 +1,25 @@
+#ifndef INCLUDE_UNIT_PARALLELIZE_H
+#define INCLUDE_UNIT_PARALLELIZE_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop Parallelization Pass. Moves the body of the outermost counted loops
+/// whose iterations are independent by UnitDependenceAnalysis into a
+/// function over a range of iterations, and replaces the loop by a call to
+/// __unit_parallel_for of the UnitRuntime library, which runs the ranges on
+/// its thread pool. Arrays the loop accesses through pointers that may alias
+/// are checked for overlap first, keeping the loop for when they do. Loops
+/// run fewer times than the threshold stay on the calling thread.
+struct UnitParallelize : PassInfoMixin<UnitParallelize> {
+  UnitParallelize(unsigned Threshold = 64) : m_Threshold(Threshold) {}
+
+  PreservedAnalyses run(Module& M, ModuleAnalysisManager& MAM);
+
+  // Iterations below which the loop isn't split up at run time
+  unsigned m_Threshold;
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_PARALLELIZE_H
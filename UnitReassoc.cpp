@@ -0,0 +1,223 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-reassoc<acc=4>"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "UnitLoopInfo.h"
+#include "UnitReassoc.h"
+
+#define DEBUG_TYPE "UnitReassoc"
+// Define any statistics here
+STATISTIC(NumReductionsSplit, "Number of reductions split into partial accumulators");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+/// A header phi accumulating m_Op over the iterations of its loop. m_Op is
+/// either a binary operator, or a min/max given as an intrinsic or as a
+/// select over the comparison m_Cmp.
+struct Accumulation {
+  PHINode* m_Phi = nullptr;
+  Instruction* m_Op = nullptr;
+  Instruction* m_Cmp = nullptr;
+  // Intrinsic combining two partial results of a min/max
+  Intrinsic::ID m_MinMax = Intrinsic::not_intrinsic;
+};
+} // namespace
+
+static Intrinsic::ID getMinMaxIntrinsic(SelectPatternFlavor Flavor) {
+  switch (Flavor) {
+  case SPF_SMIN:
+    return Intrinsic::smin;
+  case SPF_SMAX:
+    return Intrinsic::smax;
+  case SPF_UMIN:
+    return Intrinsic::umin;
+  case SPF_UMAX:
+    return Intrinsic::umax;
+  default:
+    return Intrinsic::not_intrinsic;
+  }
+}
+
+/// Recognize Phi as a reduction whose partial results are only seen after
+/// the loop
+static Optional<Accumulation> getAccumulation(const UnitLoop& L, PHINode& Phi) {
+  Accumulation A;
+  A.m_Phi = &Phi;
+  A.m_Op = dyn_cast<Instruction>(Phi.getIncomingValueForBlock(L.getLatch()));
+  if (!A.m_Op || !L.contains(A.m_Op->getParent()))
+    return None;
+  if (auto* Op = dyn_cast<BinaryOperator>(A.m_Op)) {
+    if ((Op->getOperand(0) != &Phi) == (Op->getOperand(1) != &Phi))
+      return None;
+    switch (Op->getOpcode()) {
+    case Instruction::Add:
+    case Instruction::Mul:
+    case Instruction::And:
+    case Instruction::Or:
+    case Instruction::Xor:
+      break;
+    case Instruction::FAdd:
+    case Instruction::FMul:
+      if (!Op->hasAllowReassoc())
+        return None;
+      break;
+    default:
+      return None;
+    }
+  } else if (auto* II = dyn_cast<IntrinsicInst>(A.m_Op)) {
+    // minnum and maxnum ignore NaNs, so they combine in any order as well
+    Intrinsic::ID ID = II->getIntrinsicID();
+    if (ID != Intrinsic::smin && ID != Intrinsic::smax && ID != Intrinsic::umin && ID != Intrinsic::umax &&
+        ID != Intrinsic::minnum && ID != Intrinsic::maxnum)
+      return None;
+    if ((II->getArgOperand(0) != &Phi) == (II->getArgOperand(1) != &Phi))
+      return None;
+    A.m_MinMax = ID;
+  } else if (auto* Sel = dyn_cast<SelectInst>(A.m_Op)) {
+    Value *LHS, *RHS;
+    A.m_MinMax = getMinMaxIntrinsic(matchSelectPattern(Sel, LHS, RHS).Flavor);
+    A.m_Cmp = dyn_cast<ICmpInst>(Sel->getCondition());
+    if (!A.m_MinMax || !A.m_Cmp || !A.m_Cmp->hasOneUse() || (LHS != &Phi) == (RHS != &Phi))
+      return None;
+  } else {
+    return None;
+  }
+
+  // Nothing else in the loop may look at the partial results
+  for (User* U : Phi.users()) {
+    if (U != A.m_Op && U != A.m_Cmp && L.contains(cast<Instruction>(U)->getParent()))
+      return None;
+  }
+  for (User* U : A.m_Op->users()) {
+    if (U != &Phi && L.contains(cast<Instruction>(U)->getParent()))
+      return None;
+  }
+  return A;
+}
+
+/// Integer adds and bitwise operations finish in a cycle, so a chain of them
+/// already keeps up with one iteration per cycle. Multiplications, floating
+/// point operations and compare-and-select take several.
+static bool isSingleCycle(const Accumulation& A) {
+  switch (A.m_Op->getOpcode()) {
+  case Instruction::Add:
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Combine two partial results of A
+static Value* combine(const Accumulation& A, Value* X, Value* Y, IRBuilder<>& Builder) {
+  if (A.m_MinMax)
+    return Builder.CreateBinaryIntrinsic(A.m_MinMax, X, Y, nullptr, A.m_Phi->getName() + ".comb");
+  Value* V = Builder.CreateBinOp((Instruction::BinaryOps)A.m_Op->getOpcode(), X, Y, A.m_Phi->getName() + ".comb");
+  if (isa<FPMathOperator>(V))
+    cast<Instruction>(V)->copyFastMathFlags(A.m_Op);
+  return V;
+}
+
+/// Rotate A through N accumulators: the one in A's phi is updated, and moves
+/// to the back of the line while the others move up. The results after the
+/// loop combine all of them.
+static void splitAccumulation(const UnitLoop& L, const Accumulation& A, unsigned N, BasicBlock* Exit) {
+  PHINode* Phi = A.m_Phi;
+  BasicBlock* Latch = L.getLatch();
+  BasicBlock* Preheader = L.getLoopPredecessor();
+  Value* Init = Phi->getIncomingValueForBlock(Preheader);
+  // Min and max can start every accumulator at the initial value
+  Value* Identity = A.m_MinMax ? Init : ConstantExpr::getBinOpIdentity(A.m_Op->getOpcode(), Phi->getType());
+
+  std::vector<PHINode*> Accs = {Phi};
+  IRBuilder<> Builder(Phi->getContext());
+  for (unsigned i = 1; i < N; i++) {
+    PHINode* Acc = PHINode::Create(Phi->getType(), 2, Phi->getName() + ".acc" + Twine(i), L.m_Header->getFirstNonPHI());
+    Acc->addIncoming(Identity, Preheader);
+    Accs.push_back(Acc);
+  }
+  Phi->setIncomingValueForBlock(Latch, Accs[1]);
+  // Each accumulator now sums a different subset of the values, so the
+  // partial sums may wrap where the single one did not
+  A.m_Op->dropPoisonGeneratingFlags();
+  for (unsigned i = 1; i < N; i++)
+    Accs[i]->addIncoming(i + 1 < N ? Accs[i + 1] : A.m_Op, Latch);
+
+  // Phi after the loop stands for all accumulators of the last iteration,
+  // the update for all of them after it
+  std::vector<Use*> PhiUses, OpUses;
+  for (Use& U : Phi->uses()) {
+    if (!L.contains(cast<Instruction>(U.getUser())->getParent()))
+      PhiUses.push_back(&U);
+  }
+  for (Use& U : A.m_Op->uses()) {
+    if (!L.contains(cast<Instruction>(U.getUser())->getParent()))
+      OpUses.push_back(&U);
+  }
+  auto replaceUses = [&](const std::vector<Use*>& Uses, std::vector<Value*> Parts) {
+    if (Uses.empty())
+      return;
+    Builder.SetInsertPoint(&*Exit->getFirstInsertionPt());
+    Value* Total = Parts[0];
+    for (unsigned i = 1; i < Parts.size(); i++)
+      Total = combine(A, Total, Parts[i], Builder);
+    for (Use* U : Uses) {
+      // The exit block's phis have the loop as their only predecessor
+      auto* User = cast<Instruction>(U->getUser());
+      if (auto* ExitPhi = dyn_cast<PHINode>(User); ExitPhi && ExitPhi->getParent() == Exit) {
+        ExitPhi->replaceAllUsesWith(Total);
+        ExitPhi->eraseFromParent();
+      } else {
+        U->set(Total);
+      }
+    }
+  };
+  replaceUses(PhiUses, std::vector<Value*>(Accs.begin(), Accs.end()));
+  std::vector<Value*> After(Accs.begin() + 1, Accs.end());
+  After.push_back(A.m_Op);
+  replaceUses(OpUses, After);
+}
+
+/// Main function for running the reassociation
+PreservedAnalyses UnitReassoc::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitReassoc running on " << F.getName() << "\n";
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+
+  bool Changed = false;
+  for (const UnitLoop& L : Loops.getLoops(F)) {
+    std::vector<BasicBlock*> Exits = L.getExitBlocks();
+    if (m_Accumulators < 2 || !L.getLatch() || !L.getLoopPredecessor() || Exits.size() != 1 ||
+        !Exits[0]->getSinglePredecessor())
+      continue;
+    std::vector<Accumulation> Accumulations;
+    for (PHINode& Phi : L.m_Header->phis()) {
+      Optional<Accumulation> A = getAccumulation(L, Phi);
+      if (A && !isSingleCycle(*A))
+        Accumulations.push_back(*A);
+    }
+    for (const Accumulation& A : Accumulations) {
+      dbgs() << "[UnitReassoc] Splitting reduction " << A.m_Phi->getName() << " of loop "
+             << L.m_Header->getName() << " into " << m_Accumulators << " accumulators\n";
+      splitAccumulation(L, A, m_Accumulators, Exits[0]);
+      NumReductionsSplit++;
+      Changed = true;
+    }
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  // New phis and code after the loops, the CFG is untouched
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  PA.preserve<UnitLoopAnalysis>();
+  return PA;
+}
@@ -0,0 +1,23 @@
+#ifndef INCLUDE_UNIT_REASSOC_H
+#define INCLUDE_UNIT_REASSOC_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Reduction Reassociation Pass. Spreads add, mul, min and max reductions
+/// whose operation has a latency of several cycles over interleaved partial
+/// accumulators, so consecutive iterations don't wait for each other, and
+/// combines them after the loop. Floating point reductions are only split
+/// when their fast-math flags allow reassociation.
+struct UnitReassoc : PassInfoMixin<UnitReassoc> {
+  UnitReassoc(unsigned Accumulators = 4) : m_Accumulators(Accumulators) {}
+
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+
+  // Number of partial accumulators per reduction
+  unsigned m_Accumulators;
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_REASSOC_H
@@ -0,0 +1,155 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-rotate,unit-licm"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include "UnitLoopInfo.h"
+#include "UnitRotate.h"
+
+#define DEBUG_TYPE "UnitRotate"
+// Define any statistics here
+STATISTIC(NumLoopsRotated, "Number of loops rotated");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// Headers with more instructions than this aren't duplicated into the guard
+const unsigned MaxHeaderSize = 16;
+} // namespace
+
+/// Whether L tests its exit at the top: the header leaves the loop on one
+/// side of its branch, the only latch doesn't, and the header is small
+/// enough to be copied
+static bool canRotate(const UnitLoop& L) {
+  BasicBlock* Header = L.m_Header;
+  BasicBlock* Latch = L.getLatch();
+  if (!Latch || Latch == Header || !L.getLoopPredecessor() || Header->size() > MaxHeaderSize)
+    return false;
+  auto* LatchBr = dyn_cast<BranchInst>(Latch->getTerminator());
+  auto* BI = dyn_cast<BranchInst>(Header->getTerminator());
+  if (!LatchBr || LatchBr->isConditional() || !BI || !BI->isConditional())
+    return false;
+  if (L.contains(BI->getSuccessor(0)) == L.contains(BI->getSuccessor(1)))
+    return false;
+  // The body becomes the new header, entered from the guard and the old one
+  BasicBlock* Body = BI->getSuccessor(L.contains(BI->getSuccessor(0)) ? 0 : 1);
+  if (Body->getSinglePredecessor() != Header)
+    return false;
+  for (Instruction& I : *Header) {
+    if (I.getType()->isTokenTy())
+      return false;
+    if (auto* CB = dyn_cast<CallBase>(&I); CB && (CB->cannotDuplicate() || CB->isConvergent()))
+      return false;
+  }
+  return true;
+}
+
+/// Copy the header in front of the loop as the guard, and let the old
+/// header run after the latch instead. The body becomes the header.
+static void rotateLoop(const UnitLoop& L, const DataLayout& DL) {
+  BasicBlock* Header = L.m_Header;
+  BasicBlock* Preheader = L.getPreheader();
+  if (!Preheader)
+    Preheader = SplitEdge(L.getLoopPredecessor(), Header);
+  auto* BI = cast<BranchInst>(Header->getTerminator());
+  unsigned BodyIdx = L.contains(BI->getSuccessor(0)) ? 0 : 1;
+  BasicBlock* Body = BI->getSuccessor(BodyIdx);
+  BasicBlock* Exit = BI->getSuccessor(1 - BodyIdx);
+  FoldSingleEntryPHINodes(Body);
+
+  // The guard evaluates the header for the first iteration
+  ValueToValueMapTy VMap;
+  for (PHINode& PN : Header->phis())
+    VMap[&PN] = PN.getIncomingValueForBlock(Preheader);
+  Instruction* GuardPt = Preheader->getTerminator();
+  for (Instruction& I : *Header) {
+    if (isa<PHINode>(I) || I.isTerminator())
+      continue;
+    Instruction* Clone = I.clone();
+    if (I.hasName())
+      Clone->setName(I.getName() + ".guard");
+    RemapInstruction(Clone, VMap, RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+    if (Constant* C = ConstantFoldInstruction(Clone, DL)) {
+      VMap[&I] = C;
+      Clone->deleteValue();
+      continue;
+    }
+    Clone->insertBefore(GuardPt);
+    VMap[&I] = Clone;
+  }
+
+  LLVMContext& Ctx = Header->getContext();
+  BasicBlock* NewPreheader = BasicBlock::Create(Ctx, Body->getName() + ".ph", Header->getParent(), Body);
+  BranchInst::Create(Body, NewPreheader);
+  Value* Cond = BI->getCondition();
+  if (Value* NewCond = VMap.lookup(Cond))
+    Cond = NewCond;
+  BasicBlock* Succs[2];
+  Succs[BodyIdx] = NewPreheader;
+  Succs[1 - BodyIdx] = Exit;
+  BranchInst::Create(Succs[0], Succs[1], Cond, GuardPt);
+  GuardPt->eraseFromParent();
+  for (PHINode& PN : Exit->phis()) {
+    Value* V = PN.getIncomingValueForBlock(Header);
+    if (Value* NewV = VMap.lookup(V))
+      V = NewV;
+    PN.addIncoming(V, Preheader);
+  }
+  for (PHINode& PN : Header->phis())
+    PN.removeIncomingValue(Preheader);
+
+  // Values of the header now come from the guard in the first iteration
+  for (Instruction& I : *Header) {
+    std::vector<Use*> Uses;
+    for (Use& U : I.uses()) {
+      auto* User = cast<Instruction>(U.getUser());
+      if (User->getParent() != Header || isa<PHINode>(User))
+        Uses.push_back(&U);
+    }
+    if (Uses.empty())
+      continue;
+    SSAUpdater SSA;
+    SSA.Initialize(I.getType(), I.getName());
+    SSA.AddAvailableValue(Header, &I);
+    SSA.AddAvailableValue(Preheader, VMap[&I]);
+    for (Use* U : Uses)
+      SSA.RewriteUse(*U);
+  }
+
+  // The exit test now sits at the end of the latch
+  FoldSingleEntryPHINodes(Header);
+  MergeBlockIntoPredecessor(Header);
+}
+
+/// Rotate the first loop of F that can be rotated
+static bool rotateOneLoop(Function& F, FunctionAnalysisManager& FAM) {
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  for (const UnitLoop& L : Loops.getLoops(F)) {
+    if (!canRotate(L))
+      continue;
+    dbgs() << "[UnitRotate] Rotating loop " << L.m_Header->getName() << "\n";
+    rotateLoop(L, F.getParent()->getDataLayout());
+    NumLoopsRotated++;
+    return true;
+  }
+  return false;
+}
+
+/// Main function for running the rotation
+PreservedAnalyses UnitRotate::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitRotate running on " << F.getName() << "\n";
+  // The blocks of the loops around a rotated loop change, so the loops are
+  // identified again after every rotation
+  bool Changed = false;
+  while (rotateOneLoop(F, FAM)) {
+    FAM.invalidate(F, PreservedAnalyses::none());
+    Changed = true;
+  }
+  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
@@ -0,0 +1,17 @@
+#ifndef INCLUDE_UNIT_ROTATE_H
+#define INCLUDE_UNIT_ROTATE_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop Rotation Pass. Turns loops testing their exit condition at the top
+/// into a guard in front of the loop and a loop testing at the bottom, with
+/// a preheader of its own. Code hoisted to that preheader only runs when
+/// the body runs at least once.
+struct UnitRotate : PassInfoMixin<UnitRotate> {
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_ROTATE_H
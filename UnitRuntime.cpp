@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "UnitRuntime.h"
+
+namespace {
+struct Task {
+  void (*m_Fn)(void*);
+  void* m_Arg;
+  // Tasks of the group still to finish
+  std::atomic<int64_t>* m_Pending;
+};
+
+/// Worker threads with a task deque each. The owner pushes and pops at the
+/// back, thieves take the oldest (and usually largest) tasks at the front.
+class ThreadPool {
+public:
+  static ThreadPool& get() {
+    static ThreadPool Pool;
+    return Pool;
+  }
+
+  // Threads running tasks, including the one calling into the runtime
+  unsigned getNumThreads() const { return m_Threads.size() + 1; }
+
+  void spawn(void (*Fn)(void*), void* Arg, std::atomic<int64_t>& Pending);
+
+  // Run tasks until all of the group counted by Pending are done
+  void wait(std::atomic<int64_t>& Pending);
+
+private:
+  ThreadPool();
+  ~ThreadPool();
+
+  bool runOne(unsigned Self);
+  void workerLoop(unsigned Self);
+
+  struct Queue {
+    std::mutex m_Lock;
+    std::deque<Task> m_Tasks;
+  };
+  // Queue 0 is shared by the threads outside the pool
+  std::vector<std::unique_ptr<Queue>> m_Queues;
+  std::vector<std::thread> m_Threads;
+  std::atomic<int64_t> m_Queued{0};
+  std::mutex m_SleepLock;
+  std::condition_variable m_Wake;
+  bool m_Stop = false;
+};
+
+// Queue of the current thread
+thread_local unsigned CurrentQueue = 0;
+
+// Failed steal attempts before an idle worker goes to sleep
+const unsigned SpinCount = 64;
+} // namespace
+
+ThreadPool::ThreadPool() {
+  unsigned NumThreads = std::max(1u, std::thread::hardware_concurrency());
+  if (const char* Env = std::getenv("UNIT_NUM_THREADS"))
+    NumThreads = std::max(1, std::atoi(Env));
+  for (unsigned i = 0; i < NumThreads; i++)
+    m_Queues.push_back(std::make_unique<Queue>());
+  for (unsigned i = 1; i < NumThreads; i++)
+    m_Threads.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> Guard(m_SleepLock);
+    m_Stop = true;
+  }
+  m_Wake.notify_all();
+  for (std::thread& T : m_Threads)
+    T.join();
+}
+
+void ThreadPool::spawn(void (*Fn)(void*), void* Arg, std::atomic<int64_t>& Pending) {
+  Pending.fetch_add(1, std::memory_order_relaxed);
+  Queue& Q = *m_Queues[CurrentQueue];
+  {
+    std::lock_guard<std::mutex> Guard(Q.m_Lock);
+    Q.m_Tasks.push_back({Fn, Arg, &Pending});
+  }
+  m_Queued.fetch_add(1, std::memory_order_release);
+  // Taking the lock orders the new task before a sleeper's last check
+  { std::lock_guard<std::mutex> Guard(m_SleepLock); }
+  m_Wake.notify_one();
+}
+
+/// Run the newest task of our own queue, or else steal the oldest of
+/// another one
+bool ThreadPool::runOne(unsigned Self) {
+  Task T;
+  bool Found = false;
+  for (unsigned i = 0; i < m_Queues.size() && !Found; i++) {
+    Queue& Q = *m_Queues[(Self + i) % m_Queues.size()];
+    std::lock_guard<std::mutex> Guard(Q.m_Lock);
+    if (Q.m_Tasks.empty())
+      continue;
+    if (i == 0) {
+      T = Q.m_Tasks.back();
+      Q.m_Tasks.pop_back();
+    } else {
+      T = Q.m_Tasks.front();
+      Q.m_Tasks.pop_front();
+    }
+    Found = true;
+  }
+  if (!Found)
+    return false;
+  m_Queued.fetch_sub(1, std::memory_order_relaxed);
+  T.m_Fn(T.m_Arg);
+  T.m_Pending->fetch_sub(1, std::memory_order_release);
+  return true;
+}
+
+void ThreadPool::wait(std::atomic<int64_t>& Pending) {
+  while (Pending.load(std::memory_order_acquire) > 0) {
+    if (!runOne(CurrentQueue))
+      std::this_thread::yield();
+  }
+}
+
+void ThreadPool::workerLoop(unsigned Self) {
+  CurrentQueue = Self;
+  unsigned Idle = 0;
+  while (true) {
+    if (runOne(Self)) {
+      Idle = 0;
+      continue;
+    }
+    if (++Idle < SpinCount) {
+      std::this_thread::yield();
+      continue;
+    }
+    std::unique_lock<std::mutex> Lock(m_SleepLock);
+    m_Wake.wait(Lock, [&] { return m_Stop || m_Queued.load(std::memory_order_acquire) > 0; });
+    if (m_Stop)
+      return;
+    Idle = 0;
+  }
+}
+
+namespace {
+// Iterations [m_First, m_Last) of a parallel loop
+struct Range {
+  void (*m_Body)(void*, int64_t, int64_t);
+  void* m_Ctx;
+  int64_t m_First;
+  int64_t m_Last;
+  int64_t m_Grain;
+  std::atomic<int64_t>* m_Pending;
+};
+} // namespace
+
+static void runRange(void* Arg);
+
+/// Leave the upper halves of R to thieves until a chunk of at most the grain
+/// size is left, and run that
+static void splitRange(Range R) {
+  ThreadPool& Pool = ThreadPool::get();
+  while (R.m_Last - R.m_First > R.m_Grain) {
+    int64_t Mid = R.m_First + (R.m_Last - R.m_First) / 2;
+    Pool.spawn(runRange, new Range{R.m_Body, R.m_Ctx, Mid, R.m_Last, R.m_Grain, R.m_Pending}, *R.m_Pending);
+    R.m_Last = Mid;
+  }
+  R.m_Body(R.m_Ctx, R.m_First, R.m_Last);
+}
+
+static void runRange(void* Arg) {
+  std::unique_ptr<Range> R(static_cast<Range*>(Arg));
+  splitRange(*R);
+}
+
+extern "C" void __unit_parallel_for(void (*Body)(void*, int64_t, int64_t), void* Ctx, int64_t Count,
+                                    int64_t MinParallel) {
+  if (Count <= 0)
+    return;
+  ThreadPool& Pool = ThreadPool::get();
+  if (Count < MinParallel || Pool.getNumThreads() == 1) {
+    Body(Ctx, 0, Count);
+    return;
+  }
+  // A few chunks per thread leave room for balancing uneven iterations
+  int64_t Grain = std::max<int64_t>(1, Count / (8 * Pool.getNumThreads()));
+  std::atomic<int64_t> Pending{0};
+  splitRange({Body, Ctx, 0, Count, Grain, &Pending});
+  Pool.wait(Pending);
+}
+
+// Counters of the task API are plain integers in the caller's frame
+static std::atomic<int64_t>& getCounter(int64_t* Pending) {
+  static_assert(sizeof(std::atomic<int64_t>) == sizeof(int64_t) && std::atomic<int64_t>::is_always_lock_free);
+  return *reinterpret_cast<std::atomic<int64_t>*>(Pending);
+}
+
+extern "C" void __unit_spawn(void (*Fn)(void*), void* Arg, int64_t* Pending) {
+  ThreadPool& Pool = ThreadPool::get();
+  if (Pool.getNumThreads() == 1) {
+    Fn(Arg);
+    return;
+  }
+  Pool.spawn(Fn, Arg, getCounter(Pending));
+}
+
+extern "C" void __unit_sync(int64_t* Pending) {
+  ThreadPool::get().wait(getCounter(Pending));
+}
@@ -0,0 +1,32 @@
+#ifndef INCLUDE_UNIT_RUNTIME_H
+#define INCLUDE_UNIT_RUNTIME_H
+#include <stdint.h>
+
+/// Runtime library for the code the parallelizing passes emit. It keeps a
+/// pool of worker threads, one fewer than UNIT_NUM_THREADS (or the number of
+/// cores), each with a deque of tasks that idle workers steal from. Threads
+/// waiting for their tasks to finish run other tasks in the meantime.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Run Body(Ctx, First, Last) over chunks [First, Last) covering the
+/// iterations [0, Count) on the pool, returning once all are done. Counts
+/// below MinParallel run as one chunk on the calling thread.
+void __unit_parallel_for(void (*Body)(void* Ctx, int64_t First, int64_t Last), void* Ctx, int64_t Count,
+                         int64_t MinParallel);
+
+/// Run Fn(Arg) on the pool, counting it in *Pending (zero to start with)
+/// until it has returned.
+void __unit_spawn(void (*Fn)(void* Arg), void* Arg, int64_t* Pending);
+
+/// Return once all tasks spawned on Pending have returned, running tasks on
+/// the calling thread in the meantime.
+void __unit_sync(int64_t* Pending);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INCLUDE_UNIT_RUNTIME_H
@@ -1,20 +1,1186 @@
 // Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-sccp"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/KnownBits.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include <queue>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
 
+#include "UnitLoopInfo.h"
 #include "UnitSCCP.h"
 
-#define DEBUG_TYPE UnitSCCP
+#define DEBUG_TYPE "UnitSCCP"
 // Define any statistics here
+STATISTIC(NumInstReplaced, "Number of instructions replaced with constants");
+STATISTIC(NumInstRemoved, "Number of instructions removed");
+STATISTIC(NumBranchesFolded, "Number of conditional terminators folded");
+STATISTIC(NumDeadBlocks, "Number of unreachable basic blocks removed");
+STATISTIC(NumGlobalLoadsFolded, "Number of loads from read-only globals folded");
+STATISTIC(NumStackLoadsFolded, "Number of loads from tracked allocas folded");
+STATISTIC(NumCallsFolded, "Number of calls to foldable library functions folded");
+STATISTIC(NumReturnsPropagated, "Number of call results replaced by the callee's constant return");
+STATISTIC(NumRedundantMasks, "Number of and/or instructions made redundant by known bits");
 
 using namespace llvm;
 using namespace cs426;
 
+namespace {
+/// A single element of the SCCP lattice: Undefined (top), a single Constant,
+/// or Overdefined (bottom). Values only ever move down the lattice.
+/// In known-bits mode, integers additionally have a PartiallyKnown level
+/// between Constant and Overdefined carrying the bits that are fixed.
+class LatticeVal {
+public:
+  enum State { Undefined, Constant, PartiallyKnown, Overdefined };
+
+  bool isUndefined() const { return m_State == Undefined; }
+  bool isConstant() const { return m_State == Constant; }
+  bool isPartiallyKnown() const { return m_State == PartiallyKnown; }
+  bool isOverdefined() const { return m_State == Overdefined; }
+  llvm::Constant* getConstant() const { return m_Const; }
+  const KnownBits& getKnownBits() const { return m_Bits; }
+
+  // Each of the mark* methods returns true if the state actually changed
+  bool markConstant(llvm::Constant* C) {
+    if (isConstant() && m_Const == C)
+      return false;
+    if (isUndefined()) {
+      m_State = Constant;
+      m_Const = C;
+      return true;
+    }
+    return markOverdefined();
+  }
+
+  bool markOverdefined() {
+    if (isOverdefined())
+      return false;
+    m_State = Overdefined;
+    m_Const = nullptr;
+    m_Bits = KnownBits();
+    return true;
+  }
+
+  // Meet the current value with Known, which describes an integer of type Ty
+  bool markKnownBits(const KnownBits& Known, Type* Ty) {
+    KnownBits Merged = Known;
+    if (isOverdefined())
+      return false;
+    if (isConstant()) {
+      auto* CI = dyn_cast<ConstantInt>(m_Const);
+      if (!CI)
+        return markOverdefined();
+      Merged = KnownBits::commonBits(KnownBits::makeConstant(CI->getValue()), Known);
+    } else if (isPartiallyKnown()) {
+      Merged = KnownBits::commonBits(m_Bits, Known);
+    }
+    if (Merged.isConstant())
+      return markConstant(ConstantInt::get(Ty, Merged.getConstant()));
+    if (Merged.isUnknown())
+      return markOverdefined();
+    if (isPartiallyKnown() && Merged.Zero == m_Bits.Zero && Merged.One == m_Bits.One)
+      return false;
+    m_State = PartiallyKnown;
+    m_Const = nullptr;
+    m_Bits = Merged;
+    return true;
+  }
+
+  bool mergeIn(const LatticeVal& Other) {
+    if (Other.isUndefined())
+      return false;
+    if (Other.isOverdefined() || Other.isPartiallyKnown())
+      return markOverdefined();
+    return markConstant(Other.getConstant());
+  }
+
+private:
+  State m_State = Undefined;
+  llvm::Constant* m_Const = nullptr;
+  KnownBits m_Bits;
+};
+
+/// Lattice over a single byte of a tracked stack slot. Bytes are kept in
+/// memory order, so endianness only matters when assembling loaded values.
+struct ByteVal {
+  enum State { Undefined, Known, Overdefined };
+  State m_State = Undefined;
+  uint8_t m_Val = 0;
+
+  bool operator==(const ByteVal& Other) const {
+    return m_State == Other.m_State && m_Val == Other.m_Val;
+  }
+
+  void mergeIn(const ByteVal& Other) {
+    if (Other.m_State == Undefined || m_State == Overdefined)
+      return;
+    if (m_State == Undefined)
+      *this = Other;
+    else if (Other.m_State == Overdefined || Other.m_Val != m_Val)
+      m_State = Overdefined;
+  }
+};
+
+// Contents of every tracked alloca at one program point. An alloca without an
+// entry has not been reached yet, i.e. all of its bytes are Undefined.
+typedef std::unordered_map<AllocaInst*, std::vector<ByteVal>> MemoryState;
+
+/// Sparse conditional constant propagation solver over a single function,
+/// following Wegman & Zadeck: values are only evaluated in blocks reachable
+/// through feasible CFG edges.
+class SCCPSolver {
+public:
+  SCCPSolver(const DataLayout& DL, TargetLibraryInfo& TLI, bool TrackKnownBits)
+      : m_DL(DL), m_TLI(TLI), m_TrackKnownBits(TrackKnownBits) {}
+
+  void solve(Function& F);
+
+  LatticeVal getValueState(Value* V);
+  KnownBits getKnownBits(Value* V);
+  LatticeVal getFieldState(Value* V, unsigned Field);
+  bool isBlockExecutable(BasicBlock* BB) const { return m_ExecutableBlocks.count(BB); }
+  bool isEdgeFeasible(BasicBlock* From, BasicBlock* To) const {
+    return m_FeasibleEdges.count({From, To});
+  }
+
+private:
+  void markBlockExecutable(BasicBlock* BB);
+  void markEdgeFeasible(BasicBlock* From, BasicBlock* To);
+  void markConstant(Instruction* I, Constant* C);
+  void markOverdefined(Instruction* I);
+  void markLattice(Instruction* I, const LatticeVal& LV);
+  void mergeFieldState(Instruction* I, unsigned Field, const LatticeVal& LV);
+  void pushUsers(Instruction* I);
+
+  void visit(Instruction& I);
+  void visitPHINode(PHINode& PN);
+  void visitTerminator(Instruction& I);
+  void visitSelect(SelectInst& SI);
+  void visitLoad(LoadInst& LI);
+  void visitCall(CallBase& CB);
+  void visitCallReturn(CallBase& CB, Function& Callee);
+  void visitAggregate(Instruction& I);
+  void visitExtractValue(ExtractValueInst& EVI);
+  void visitFoldable(Instruction& I);
+  bool visitKnownBits(Instruction& I);
+  void markKnownBits(Instruction* I, const KnownBits& Known);
+
+  bool resolveUndefinedBranches(Function& F);
+
+  void collectTrackedAllocas(Function& F);
+  bool trackAllocaUses(Value* Ptr, AllocaInst* AI, uint64_t Offset, uint64_t Size);
+  void visitBlockMemory(BasicBlock* BB);
+  void storeBytes(std::vector<ByteVal>& Bytes, uint64_t Offset, StoreInst& SI);
+  void loadBytes(const std::vector<ByteVal>& Bytes, uint64_t Offset, LoadInst& LI);
+
+  Constant* foldLoadFromGlobal(Constant* Ptr, Type* Ty);
+  bool isNeverWrittenGlobal(GlobalVariable* GV);
+
+  const DataLayout& m_DL;
+  TargetLibraryInfo& m_TLI;
+  bool m_TrackKnownBits;
+
+  std::unordered_map<Value*, LatticeVal> m_ValueState;
+  // Aggregate values are tracked field by field instead of in m_ValueState
+  std::unordered_map<Value*, std::vector<LatticeVal>> m_FieldState;
+  std::unordered_set<BasicBlock*> m_ExecutableBlocks;
+  std::set<std::pair<BasicBlock*, BasicBlock*>> m_FeasibleEdges;
+  std::queue<BasicBlock*> m_BlockWorkList;
+  std::queue<Instruction*> m_InstWorkList;
+
+  // Calls counted in NumReturnsPropagated
+  std::unordered_set<CallBase*> m_PropagatedReturns;
+
+  // Memoized answers of isNeverWrittenGlobal
+  std::unordered_map<GlobalVariable*, bool> m_NeverWritten;
+
+  // Non-escaping allocas modeled byte-wise: every pointer derived from one of
+  // them maps to its alloca and constant byte offset
+  std::unordered_map<Value*, std::pair<AllocaInst*, uint64_t>> m_AllocaPointers;
+  // Memory state at the end of each executable block
+  std::unordered_map<BasicBlock*, MemoryState> m_BlockMemOut;
+  std::queue<BasicBlock*> m_MemBlockWorkList;
+};
+
+// Larger stack slots are left to SROA rather than copied around per block
+const uint64_t MaxTrackedAllocaSize = 256;
+// Aggregates with more fields than this are treated as a single value
+const unsigned MaxTrackedFields = 32;
+} // namespace
+
+// Structs and small arrays are given one lattice value per top-level field
+static bool isTrackedAggregate(Type* Ty) {
+  if (auto* ST = dyn_cast<StructType>(Ty))
+    return ST->getNumElements() <= MaxTrackedFields;
+  if (auto* AT = dyn_cast<ArrayType>(Ty))
+    return AT->getNumElements() <= MaxTrackedFields;
+  return false;
+}
+
+static unsigned getNumFields(Type* Ty) {
+  if (auto* ST = dyn_cast<StructType>(Ty))
+    return ST->getNumElements();
+  return cast<ArrayType>(Ty)->getNumElements();
+}
+
+static LatticeVal getConstantState(Constant* C) {
+  LatticeVal LV;
+  if (!C || isa<UndefValue>(C))
+    LV.markOverdefined();
+  else
+    LV.markConstant(C);
+  return LV;
+}
+
+LatticeVal SCCPSolver::getFieldState(Value* V, unsigned Field) {
+  if (auto* C = dyn_cast<Constant>(V))
+    return getConstantState(C->getAggregateElement(Field));
+  auto it = m_FieldState.find(V);
+  if (!isa<Instruction>(V) || !isTrackedAggregate(V->getType()))
+    return getConstantState(nullptr);
+  return it == m_FieldState.end() ? LatticeVal() : it->second[Field];
+}
+
+LatticeVal SCCPSolver::getValueState(Value* V) {
+  LatticeVal LV;
+  if (isa<Instruction>(V) && isTrackedAggregate(V->getType())) {
+    // The aggregate as a whole is constant once all of its fields are
+    SmallVector<Constant*, 8> Fields;
+    bool AnyUndefined = false;
+    for (unsigned i = 0; i < getNumFields(V->getType()); i++) {
+      LatticeVal Field = getFieldState(V, i);
+      if (Field.isUndefined())
+        AnyUndefined = true;
+      else if (!Field.isConstant())
+        return getConstantState(nullptr);
+      else
+        Fields.push_back(Field.getConstant());
+    }
+    if (AnyUndefined)
+      return LV;
+    if (auto* ST = dyn_cast<StructType>(V->getType()))
+      LV.markConstant(ConstantStruct::get(ST, Fields));
+    else
+      LV.markConstant(ConstantArray::get(cast<ArrayType>(V->getType()), Fields));
+    return LV;
+  }
+  if (auto* C = dyn_cast<Constant>(V)) {
+    // Undef may be refined differently at every use, so it is not treated as
+    // a single constant
+    if (isa<UndefValue>(C))
+      LV.markOverdefined();
+    else
+      LV.markConstant(C);
+    return LV;
+  }
+  if (!isa<Instruction>(V)) {
+    // Arguments and anything else we can't see through
+    LV.markOverdefined();
+    return LV;
+  }
+  auto it = m_ValueState.find(V);
+  return it == m_ValueState.end() ? LV : it->second;
+}
+
+void SCCPSolver::markBlockExecutable(BasicBlock* BB) {
+  if (m_ExecutableBlocks.insert(BB).second)
+    m_BlockWorkList.push(BB);
+}
+
+void SCCPSolver::markEdgeFeasible(BasicBlock* From, BasicBlock* To) {
+  if (!m_FeasibleEdges.insert({From, To}).second)
+    return;
+  if (isBlockExecutable(To)) {
+    // A new incoming edge only affects the PHI nodes and the incoming memory
+    // state of an executable block
+    for (PHINode& PN : To->phis())
+      m_InstWorkList.push(&PN);
+    if (m_AllocaPointers.size())
+      m_MemBlockWorkList.push(To);
+  } else {
+    markBlockExecutable(To);
+  }
+}
+
+void SCCPSolver::pushUsers(Instruction* I) {
+  for (User* U : I->users()) {
+    auto* UI = dyn_cast<Instruction>(U);
+    if (UI && isBlockExecutable(UI->getParent()))
+      m_InstWorkList.push(UI);
+  }
+}
+
+void SCCPSolver::markConstant(Instruction* I, Constant* C) {
+  if (isTrackedAggregate(I->getType())) {
+    for (unsigned i = 0; i < getNumFields(I->getType()); i++)
+      mergeFieldState(I, i, getConstantState(C->getAggregateElement(i)));
+    return;
+  }
+  if (m_ValueState[I].markConstant(C))
+    pushUsers(I);
+}
+
+void SCCPSolver::markOverdefined(Instruction* I) {
+  if (isTrackedAggregate(I->getType())) {
+    for (unsigned i = 0; i < getNumFields(I->getType()); i++)
+      mergeFieldState(I, i, getConstantState(nullptr));
+    return;
+  }
+  if (m_ValueState[I].markOverdefined())
+    pushUsers(I);
+}
+
+void SCCPSolver::markLattice(Instruction* I, const LatticeVal& LV) {
+  if (LV.isConstant())
+    markConstant(I, LV.getConstant());
+  else if (LV.isPartiallyKnown() && m_TrackKnownBits)
+    markKnownBits(I, LV.getKnownBits());
+  else if (!LV.isUndefined())
+    markOverdefined(I);
+}
+
+void SCCPSolver::mergeFieldState(Instruction* I, unsigned Field, const LatticeVal& LV) {
+  std::vector<LatticeVal>& Fields = m_FieldState[I];
+  if (Fields.empty())
+    Fields.resize(getNumFields(I->getType()));
+  if (Fields[Field].mergeIn(LV))
+    pushUsers(I);
+}
+
+void SCCPSolver::markKnownBits(Instruction* I, const KnownBits& Known) {
+  if (m_ValueState[I].markKnownBits(Known, I->getType()))
+    pushUsers(I);
+}
+
+/// The bits of integer V known from the lattice. Values the lattice gave up
+/// on may still have bits implied by e.g. argument attributes.
+KnownBits SCCPSolver::getKnownBits(Value* V) {
+  LatticeVal LV = getValueState(V);
+  if (LV.isPartiallyKnown())
+    return LV.getKnownBits();
+  if (LV.isConstant()) {
+    if (auto* CI = dyn_cast<ConstantInt>(LV.getConstant()))
+      return KnownBits::makeConstant(CI->getValue());
+  }
+  if (!isa<Instruction>(V))
+    return computeKnownBits(V, m_DL);
+  return KnownBits(V->getType()->getIntegerBitWidth());
+}
+
+void SCCPSolver::solve(Function& F) {
+  collectTrackedAllocas(F);
+  markBlockExecutable(&F.getEntryBlock());
+  do {
+    while (m_BlockWorkList.size() || m_InstWorkList.size() || m_MemBlockWorkList.size()) {
+      while (m_InstWorkList.size()) {
+        Instruction* I = m_InstWorkList.front();
+        m_InstWorkList.pop();
+        visit(*I);
+      }
+      while (m_BlockWorkList.size()) {
+        BasicBlock* BB = m_BlockWorkList.front();
+        m_BlockWorkList.pop();
+        for (Instruction& I : *BB)
+          visit(I);
+        if (m_AllocaPointers.size())
+          m_MemBlockWorkList.push(BB);
+      }
+      // Memory is only walked once the scalar worklists settle, so a block is
+      // not re-walked for every single operand that changes in it
+      if (m_InstWorkList.empty() && m_BlockWorkList.empty() && m_MemBlockWorkList.size()) {
+        BasicBlock* BB = m_MemBlockWorkList.front();
+        m_MemBlockWorkList.pop();
+        visitBlockMemory(BB);
+      }
+    }
+  } while (resolveUndefinedBranches(F));
+}
+
+// A branch whose condition is still undefined at the fixed point would leave
+// its successors unreachable; force such conditions to overdefined and iterate
+bool SCCPSolver::resolveUndefinedBranches(Function& F) {
+  bool Changed = false;
+  for (BasicBlock& BB : F) {
+    if (!isBlockExecutable(&BB))
+      continue;
+    Instruction* Term = BB.getTerminator();
+    Value* Cond = nullptr;
+    if (auto* BI = dyn_cast<BranchInst>(Term); BI && BI->isConditional())
+      Cond = BI->getCondition();
+    else if (auto* SI = dyn_cast<SwitchInst>(Term))
+      Cond = SI->getCondition();
+    if (Cond && getValueState(Cond).isUndefined()) {
+      markOverdefined(cast<Instruction>(Cond));
+      m_InstWorkList.push(Term);
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+void SCCPSolver::visit(Instruction& I) {
+  if (isTrackedAggregate(I.getType()) &&
+      (isa<InsertValueInst>(I) || isa<PHINode>(I) || isa<SelectInst>(I)))
+    return visitAggregate(I);
+  if (auto* EVI = dyn_cast<ExtractValueInst>(&I))
+    return visitExtractValue(*EVI);
+  if (auto* PN = dyn_cast<PHINode>(&I))
+    return visitPHINode(*PN);
+  if (I.isTerminator())
+    return visitTerminator(I);
+  if (auto* SI = dyn_cast<SelectInst>(&I))
+    return visitSelect(*SI);
+  if (m_AllocaPointers.count(getLoadStorePointerOperand(&I))) {
+    // Accesses to tracked allocas are evaluated by the block's memory walk
+    return m_MemBlockWorkList.push(I.getParent());
+  }
+  if (auto* LI = dyn_cast<LoadInst>(&I))
+    return visitLoad(*LI);
+  if (auto* CB = dyn_cast<CallBase>(&I); CB && !CB->getType()->isVoidTy())
+    return visitCall(*CB);
+  if (I.getType()->isVoidTy())
+    return;
+  if (isa<BinaryOperator>(I) || isa<UnaryOperator>(I) || isa<CastInst>(I) ||
+      isa<CmpInst>(I) || isa<GetElementPtrInst>(I) || isa<ExtractValueInst>(I) ||
+      isa<InsertValueInst>(I) || isa<ExtractElementInst>(I) ||
+      isa<InsertElementInst>(I) || isa<ShuffleVectorInst>(I))
+    return visitFoldable(I);
+  markOverdefined(&I);
+}
+
+void SCCPSolver::visitPHINode(PHINode& PN) {
+  if (m_TrackKnownBits && PN.getType()->isIntegerTy()) {
+    // Meet the incoming bits instead of dropping to overdefined as soon as
+    // two different constants flow in
+    Optional<KnownBits> Merged;
+    for (unsigned i = 0; i < PN.getNumIncomingValues(); i++) {
+      Value* In = PN.getIncomingValue(i);
+      if (!isEdgeFeasible(PN.getIncomingBlock(i), PN.getParent()) ||
+          getValueState(In).isUndefined())
+        continue;
+      KnownBits Known = getKnownBits(In);
+      Merged = Merged ? KnownBits::commonBits(*Merged, Known) : Known;
+    }
+    if (Merged)
+      markKnownBits(&PN, *Merged);
+    return;
+  }
+  LatticeVal Merged;
+  for (unsigned i = 0; i < PN.getNumIncomingValues(); i++) {
+    if (!isEdgeFeasible(PN.getIncomingBlock(i), PN.getParent()))
+      continue;
+    Merged.mergeIn(getValueState(PN.getIncomingValue(i)));
+    if (Merged.isOverdefined())
+      break;
+  }
+  markLattice(&PN, Merged);
+}
+
+void SCCPSolver::visitTerminator(Instruction& I) {
+  BasicBlock* BB = I.getParent();
+  if (auto* BI = dyn_cast<BranchInst>(&I)) {
+    if (BI->isUnconditional()) {
+      markEdgeFeasible(BB, BI->getSuccessor(0));
+      return;
+    }
+    LatticeVal Cond = getValueState(BI->getCondition());
+    if (Cond.isUndefined())
+      return;
+    auto* CI = Cond.isConstant() ? dyn_cast<ConstantInt>(Cond.getConstant()) : nullptr;
+    if (!CI) {
+      markEdgeFeasible(BB, BI->getSuccessor(0));
+      markEdgeFeasible(BB, BI->getSuccessor(1));
+      return;
+    }
+    markEdgeFeasible(BB, BI->getSuccessor(CI->isZero() ? 1 : 0));
+    return;
+  }
+  if (auto* SI = dyn_cast<SwitchInst>(&I)) {
+    LatticeVal Cond = getValueState(SI->getCondition());
+    if (Cond.isUndefined())
+      return;
+    if (Cond.isPartiallyKnown()) {
+      // Cases contradicting a known bit of the condition can't be taken
+      const KnownBits& Known = Cond.getKnownBits();
+      for (auto Case : SI->cases()) {
+        const APInt& Val = Case.getCaseValue()->getValue();
+        if (!Val.intersects(Known.Zero) && Known.One.isSubsetOf(Val))
+          markEdgeFeasible(BB, Case.getCaseSuccessor());
+      }
+      markEdgeFeasible(BB, SI->getDefaultDest());
+      return;
+    }
+    auto* CI = Cond.isConstant() ? dyn_cast<ConstantInt>(Cond.getConstant()) : nullptr;
+    if (!CI) {
+      for (BasicBlock* Succ : successors(BB))
+        markEdgeFeasible(BB, Succ);
+      return;
+    }
+    markEdgeFeasible(BB, SI->findCaseValue(CI)->getCaseSuccessor());
+    return;
+  }
+  // Invokes, indirect branches, etc. may transfer control to any successor
+  if (!I.getType()->isVoidTy())
+    markOverdefined(&I);
+  for (BasicBlock* Succ : successors(BB))
+    markEdgeFeasible(BB, Succ);
+}
+
+void SCCPSolver::visitSelect(SelectInst& SI) {
+  LatticeVal Cond = getValueState(SI.getCondition());
+  if (Cond.isUndefined())
+    return;
+  if (Cond.isConstant()) {
+    if (auto* CI = dyn_cast<ConstantInt>(Cond.getConstant())) {
+      // The chosen arm's state carries over whole, known bits included
+      return markLattice(&SI, getValueState(CI->isZero() ? SI.getFalseValue() : SI.getTrueValue()));
+    }
+  }
+  // Unknown condition: the result is constant only if both arms agree
+  if (m_TrackKnownBits && SI.getType()->isIntegerTy() && !Cond.isConstant()) {
+    LatticeVal T = getValueState(SI.getTrueValue());
+    LatticeVal F = getValueState(SI.getFalseValue());
+    if (!T.isUndefined() && !F.isUndefined())
+      markKnownBits(&SI, KnownBits::commonBits(getKnownBits(SI.getTrueValue()),
+                                               getKnownBits(SI.getFalseValue())));
+    return;
+  }
+  LatticeVal Merged;
+  Merged.mergeIn(getValueState(SI.getTrueValue()));
+  Merged.mergeIn(getValueState(SI.getFalseValue()));
+  markLattice(&SI, Merged);
+}
+
+void SCCPSolver::visitLoad(LoadInst& LI) {
+  if (!LI.isSimple())
+    return markOverdefined(&LI);
+  LatticeVal Ptr = getValueState(LI.getPointerOperand());
+  if (Ptr.isUndefined())
+    return;
+  if (Ptr.isConstant()) {
+    if (Constant* C = foldLoadFromGlobal(Ptr.getConstant(), LI.getType())) {
+      return markConstant(&LI, C);
+    }
+  }
+  markOverdefined(&LI);
+}
+
+/// Calls to math library functions and intrinsics (sqrt, sin, pow, fabs, ...)
+/// fold once all their arguments are constant. ConstantFoldCall refuses to
+/// fold anything that would set errno or raise an FP exception the program
+/// could observe, and constrained intrinsics are folded under their own
+/// rounding mode and exception behavior.
+void SCCPSolver::visitCall(CallBase& CB) {
+  Function* Callee = CB.getCalledFunction();
+  if (!Callee)
+    return markOverdefined(&CB);
+  if (!canConstantFoldCallTo(&CB, Callee))
+    return visitCallReturn(CB, *Callee);
+  // A plain libm call in strictfp code may run under a non-default rounding
+  // mode, which only the constrained intrinsics make explicit
+  if (CB.isStrictFP() && !isa<ConstrainedFPIntrinsic>(CB))
+    return markOverdefined(&CB);
+
+  SmallVector<Constant*, 4> Ops;
+  for (Value* Arg : CB.args()) {
+    // Rounding mode and exception behavior of constrained intrinsics
+    if (isa<MetadataAsValue>(Arg))
+      continue;
+    LatticeVal ArgState = getValueState(Arg);
+    if (ArgState.isUndefined())
+      return;
+    if (!ArgState.isConstant())
+      return markOverdefined(&CB);
+    Ops.push_back(ArgState.getConstant());
+  }
+  Constant* C = ConstantFoldCall(&CB, Callee, Ops, &m_TLI);
+  if (!C || isa<UndefValue>(C))
+    return markOverdefined(&CB);
+  if (m_ValueState[&CB].isUndefined())
+    NumCallsFolded++;
+  markConstant(&CB, C);
+}
+
+// The constant Field of an aggregate returned by `ret V`, looking through the
+// chain of insertvalues that usually builds it
+static Constant* getReturnedField(Value* V, unsigned Field) {
+  while (auto* IV = dyn_cast<InsertValueInst>(V)) {
+    if (IV->getIndices()[0] != Field) {
+      V = IV->getAggregateOperand();
+      continue;
+    }
+    if (IV->getNumIndices() != 1)
+      return nullptr;
+    return dyn_cast<Constant>(IV->getInsertedValueOperand());
+  }
+  auto* C = dyn_cast<Constant>(V);
+  return C ? C->getAggregateElement(Field) : nullptr;
+}
+
+/// The result of a call is known if every return of the callee's (exact)
+/// definition returns the same constant, or for aggregates, if each field is
+/// the same constant in every return
+void SCCPSolver::visitCallReturn(CallBase& CB, Function& Callee) {
+  if (Callee.isDeclaration() || !Callee.hasExactDefinition() ||
+      CB.getFunctionType() != Callee.getFunctionType())
+    return markOverdefined(&CB);
+
+  std::vector<Value*> Returned;
+  for (BasicBlock& BB : Callee) {
+    if (auto* RI = dyn_cast<ReturnInst>(BB.getTerminator()))
+      Returned.push_back(RI->getReturnValue());
+  }
+  bool Known = false;
+  if (isTrackedAggregate(CB.getType())) {
+    for (unsigned i = 0; i < getNumFields(CB.getType()); i++) {
+      LatticeVal Merged;
+      for (Value* RV : Returned)
+        Merged.mergeIn(getConstantState(getReturnedField(RV, i)));
+      mergeFieldState(&CB, i, Merged);
+      Known |= Merged.isConstant();
+    }
+  } else {
+    LatticeVal Merged;
+    for (Value* RV : Returned)
+      Merged.mergeIn(getConstantState(dyn_cast<Constant>(RV)));
+    markLattice(&CB, Merged);
+    Known = Merged.isConstant();
+  }
+  if (Known && !m_PropagatedReturns.count(&CB)) {
+    m_PropagatedReturns.insert(&CB);
+    NumReturnsPropagated++;
+  }
+}
+
+/// insertvalue, PHIs and selects of aggregates are evaluated field-wise, so
+/// fields built up from an undef aggregate stay constant
+void SCCPSolver::visitAggregate(Instruction& I) {
+  unsigned NumFields = getNumFields(I.getType());
+  if (auto* IV = dyn_cast<InsertValueInst>(&I)) {
+    unsigned Target = IV->getIndices()[0];
+    for (unsigned i = 0; i < NumFields; i++) {
+      if (i != Target) {
+        mergeFieldState(&I, i, getFieldState(IV->getAggregateOperand(), i));
+        continue;
+      }
+      LatticeVal Inserted = getValueState(IV->getInsertedValueOperand());
+      if (IV->getNumIndices() == 1) {
+        mergeFieldState(&I, i, Inserted);
+        continue;
+      }
+      // Inserting deeper into a nested aggregate: fold into the whole field
+      LatticeVal Field = getFieldState(IV->getAggregateOperand(), i);
+      if (Field.isUndefined() || Inserted.isUndefined())
+        continue;
+      Constant* C = nullptr;
+      if (Field.isConstant() && Inserted.isConstant())
+        C = ConstantFoldInsertValueInstruction(Field.getConstant(), Inserted.getConstant(),
+                                               IV->getIndices().drop_front());
+      mergeFieldState(&I, i, getConstantState(C));
+    }
+    return;
+  }
+
+  if (auto* PN = dyn_cast<PHINode>(&I)) {
+    for (unsigned i = 0; i < PN->getNumIncomingValues(); i++) {
+      if (!isEdgeFeasible(PN->getIncomingBlock(i), PN->getParent()))
+        continue;
+      for (unsigned Field = 0; Field < NumFields; Field++)
+        mergeFieldState(&I, Field, getFieldState(PN->getIncomingValue(i), Field));
+    }
+    return;
+  }
+
+  auto& SI = cast<SelectInst>(I);
+  LatticeVal Cond = getValueState(SI.getCondition());
+  if (Cond.isUndefined())
+    return;
+  auto* CI = Cond.isConstant() ? dyn_cast<ConstantInt>(Cond.getConstant()) : nullptr;
+  for (unsigned Field = 0; Field < NumFields; Field++) {
+    if (!CI || !CI->isZero())
+      mergeFieldState(&I, Field, getFieldState(SI.getTrueValue(), Field));
+    if (!CI || CI->isZero())
+      mergeFieldState(&I, Field, getFieldState(SI.getFalseValue(), Field));
+  }
+}
+
+void SCCPSolver::visitExtractValue(ExtractValueInst& EVI) {
+  if (!isTrackedAggregate(EVI.getAggregateOperand()->getType()))
+    return visitFoldable(EVI);
+  LatticeVal Field = getFieldState(EVI.getAggregateOperand(), EVI.getIndices()[0]);
+  if (EVI.getNumIndices() == 1 || !Field.isConstant())
+    return markLattice(&EVI, Field);
+  Constant* C = ConstantFoldExtractValueInstruction(Field.getConstant(), EVI.getIndices().drop_front());
+  markLattice(&EVI, getConstantState(C));
+}
+
+void SCCPSolver::visitFoldable(Instruction& I) {
+  if (m_TrackKnownBits && visitKnownBits(I))
+    return;
+  SmallVector<Constant*, 4> Ops;
+  for (Value* Op : I.operands()) {
+    LatticeVal OpState = getValueState(Op);
+    if (OpState.isUndefined())
+      return;
+    if (!OpState.isConstant())
+      return markOverdefined(&I);
+    Ops.push_back(OpState.getConstant());
+  }
+  Constant* C = nullptr;
+  if (auto* CI = dyn_cast<CmpInst>(&I))
+    C = ConstantFoldCompareInstOperands(CI->getPredicate(), Ops[0], Ops[1], m_DL, &m_TLI);
+  else
+    C = ConstantFoldInstOperands(&I, Ops, m_DL, &m_TLI);
+  if (C && !isa<UndefValue>(C))
+    markConstant(&I, C);
+  else
+    markOverdefined(&I);
+}
+
+/// Transfer function of the known-bits mode for bitwise operations, shifts,
+/// integer casts and comparisons. Returns false for anything it doesn't model.
+bool SCCPSolver::visitKnownBits(Instruction& I) {
+  if (!I.getType()->isIntegerTy() || !I.getOperand(0)->getType()->isIntegerTy())
+    return false;
+  switch (I.getOpcode()) {
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor:
+  case Instruction::Shl:
+  case Instruction::LShr:
+  case Instruction::AShr:
+  case Instruction::Trunc:
+  case Instruction::ZExt:
+  case Instruction::SExt:
+  case Instruction::ICmp:
+    break;
+  default:
+    return false;
+  }
+  for (Value* Op : I.operands()) {
+    if (getValueState(Op).isUndefined())
+      return true;
+  }
+
+  KnownBits LHS = getKnownBits(I.getOperand(0));
+  unsigned Width = I.getType()->getIntegerBitWidth();
+  KnownBits Result(Width);
+  if (auto* Cast = dyn_cast<CastInst>(&I)) {
+    if (Cast->getOpcode() == Instruction::Trunc)
+      Result = LHS.trunc(Width);
+    else if (Cast->getOpcode() == Instruction::ZExt)
+      Result = LHS.zext(Width);
+    else
+      Result = LHS.sext(Width);
+    markKnownBits(&I, Result);
+    return true;
+  }
+
+  KnownBits RHS = getKnownBits(I.getOperand(1));
+  switch (I.getOpcode()) {
+  case Instruction::And: Result = LHS & RHS; break;
+  case Instruction::Or: Result = LHS | RHS; break;
+  case Instruction::Xor: Result = LHS ^ RHS; break;
+  case Instruction::Shl: Result = KnownBits::shl(LHS, RHS); break;
+  case Instruction::LShr: Result = KnownBits::lshr(LHS, RHS); break;
+  case Instruction::AShr: Result = KnownBits::ashr(LHS, RHS); break;
+  case Instruction::ICmp: {
+    Optional<bool> Cmp;
+    switch (cast<ICmpInst>(I).getPredicate()) {
+    case ICmpInst::ICMP_EQ: Cmp = KnownBits::eq(LHS, RHS); break;
+    case ICmpInst::ICMP_NE: Cmp = KnownBits::ne(LHS, RHS); break;
+    case ICmpInst::ICMP_UGT: Cmp = KnownBits::ugt(LHS, RHS); break;
+    case ICmpInst::ICMP_UGE: Cmp = KnownBits::uge(LHS, RHS); break;
+    case ICmpInst::ICMP_ULT: Cmp = KnownBits::ult(LHS, RHS); break;
+    case ICmpInst::ICMP_ULE: Cmp = KnownBits::ule(LHS, RHS); break;
+    case ICmpInst::ICMP_SGT: Cmp = KnownBits::sgt(LHS, RHS); break;
+    case ICmpInst::ICMP_SGE: Cmp = KnownBits::sge(LHS, RHS); break;
+    case ICmpInst::ICMP_SLT: Cmp = KnownBits::slt(LHS, RHS); break;
+    case ICmpInst::ICMP_SLE: Cmp = KnownBits::sle(LHS, RHS); break;
+    default: break;
+    }
+    if (Cmp)
+      Result = KnownBits::makeConstant(APInt(1, *Cmp));
+    break;
+  }
+  }
+  markKnownBits(&I, Result);
+  return true;
+}
+
+/// Fold a load of type Ty from the constant address Ptr if it points into the
+/// initializer of a global that can never be modified. The address may be any
+/// constant GEP/bitcast chain into (nested aggregates of) the global.
+Constant* SCCPSolver::foldLoadFromGlobal(Constant* Ptr, Type* Ty) {
+  APInt Offset(m_DL.getIndexTypeSizeInBits(Ptr->getType()), 0);
+  auto* GV = dyn_cast<GlobalVariable>(
+      Ptr->stripAndAccumulateConstantOffsets(m_DL, Offset, /*AllowNonInbounds=*/true));
+  if (!GV || !GV->hasDefinitiveInitializer())
+    return nullptr;
+  if (!GV->isConstant() && !isNeverWrittenGlobal(GV))
+    return nullptr;
+  Constant* C = ConstantFoldLoadFromConst(GV->getInitializer(), Ty, Offset, m_DL);
+  if (!C || isa<UndefValue>(C))
+    return nullptr;
+  NumGlobalLoadsFolded++;
+  return C;
+}
+
+/// A global with local linkage whose address is only ever used to load from
+/// (possibly through GEPs and casts) keeps its initializer for the whole run
+bool SCCPSolver::isNeverWrittenGlobal(GlobalVariable* GV) {
+  if (!GV->hasLocalLinkage() || GV->isExternallyInitialized())
+    return false;
+  auto it = m_NeverWritten.find(GV);
+  if (it != m_NeverWritten.end())
+    return it->second;
+
+  bool ReadOnly = true;
+  std::vector<Value*> work_list = {GV};
+  std::unordered_set<Value*> visited;
+  while (ReadOnly && work_list.size()) {
+    Value* V = work_list.back();
+    work_list.pop_back();
+    if (!visited.insert(V).second)
+      continue;
+    for (User* U : V->users()) {
+      if (auto* LI = dyn_cast<LoadInst>(U)) {
+        ReadOnly &= LI->isSimple();
+      } else if (isa<GetElementPtrInst>(U) || isa<BitCastInst>(U) ||
+                 (isa<ConstantExpr>(U) && (cast<ConstantExpr>(U)->getOpcode() == Instruction::GetElementPtr ||
+                                           cast<ConstantExpr>(U)->getOpcode() == Instruction::BitCast))) {
+        work_list.push_back(U);
+      } else if (!isa<ICmpInst>(U)) {
+        // Stores, calls, escapes into integers, ... may all write the global
+        ReadOnly = false;
+      }
+      if (!ReadOnly)
+        break;
+    }
+  }
+  m_NeverWritten[GV] = ReadOnly;
+  return ReadOnly;
+}
+
+/// Find the allocas whose every access is a simple load or store at a constant
+/// offset, so their contents can be followed byte by byte
+void SCCPSolver::collectTrackedAllocas(Function& F) {
+  for (Instruction& I : instructions(F)) {
+    auto* AI = dyn_cast<AllocaInst>(&I);
+    if (!AI || !AI->isStaticAlloca())
+      continue;
+    Optional<TypeSize> Size = AI->getAllocationSizeInBits(m_DL);
+    if (!Size || Size->isScalable() || Size->getFixedSize() / 8 > MaxTrackedAllocaSize)
+      continue;
+    std::unordered_map<Value*, std::pair<AllocaInst*, uint64_t>> Saved = m_AllocaPointers;
+    if (!trackAllocaUses(AI, AI, 0, Size->getFixedSize() / 8))
+      m_AllocaPointers = std::move(Saved);
+  }
+}
+
+// Record Ptr (pointing Offset bytes into AI) and everything derived from it.
+// Returns false if any use lets the alloca escape or accesses it out of bounds.
+bool SCCPSolver::trackAllocaUses(Value* Ptr, AllocaInst* AI, uint64_t Offset, uint64_t Size) {
+  m_AllocaPointers[Ptr] = {AI, Offset};
+  for (User* U : Ptr->users()) {
+    if (auto* LI = dyn_cast<LoadInst>(U)) {
+      if (!LI->isSimple() || Offset + m_DL.getTypeStoreSize(LI->getType()) > Size)
+        return false;
+    } else if (auto* SI = dyn_cast<StoreInst>(U)) {
+      if (!SI->isSimple() || SI->getValueOperand() == Ptr ||
+          Offset + m_DL.getTypeStoreSize(SI->getValueOperand()->getType()) > Size)
+        return false;
+    } else if (auto* GEP = dyn_cast<GetElementPtrInst>(U)) {
+      APInt GEPOffset(m_DL.getIndexTypeSizeInBits(GEP->getType()), 0);
+      if (!GEP->accumulateConstantOffset(m_DL, GEPOffset) || GEPOffset.isNegative() ||
+          Offset + GEPOffset.getZExtValue() >= Size ||
+          !trackAllocaUses(GEP, AI, Offset + GEPOffset.getZExtValue(), Size))
+        return false;
+    } else if (isa<BitCastInst>(U)) {
+      if (!trackAllocaUses(U, AI, Offset, Size))
+        return false;
+    } else if (auto* II = dyn_cast<IntrinsicInst>(U)) {
+      if (!II->isLifetimeStartOrEnd() && !isa<DbgInfoIntrinsic>(II))
+        return false;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Transfer the memory state through BB: merge the states flowing in over
+/// feasible edges, then apply its stores and evaluate its loads in order
+void SCCPSolver::visitBlockMemory(BasicBlock* BB) {
+  if (!isBlockExecutable(BB))
+    return;
+  MemoryState State;
+  for (BasicBlock* Pred : predecessors(BB)) {
+    auto PredOut = m_BlockMemOut.find(Pred);
+    if (!isEdgeFeasible(Pred, BB) || PredOut == m_BlockMemOut.end())
+      continue;
+    for (auto& [AI, Bytes] : PredOut->second) {
+      auto [it, Inserted] = State.insert({AI, Bytes});
+      if (!Inserted) {
+        for (size_t i = 0; i < Bytes.size(); i++)
+          it->second[i].mergeIn(Bytes[i]);
+      }
+    }
+  }
+
+  for (Instruction& I : *BB) {
+    if (auto* AI = dyn_cast<AllocaInst>(&I); AI && m_AllocaPointers.count(AI)) {
+      // A fresh slot holds undef, which we conservatively treat as unknown
+      uint64_t Size = AI->getAllocationSizeInBits(m_DL)->getFixedSize() / 8;
+      State[AI] = std::vector<ByteVal>(Size, {ByteVal::Overdefined, 0});
+      continue;
+    }
+    auto Ptr = m_AllocaPointers.find(getLoadStorePointerOperand(&I));
+    if (Ptr == m_AllocaPointers.end())
+      continue;
+    auto [AI, Offset] = Ptr->second;
+    if (!State.count(AI))
+      continue;
+    if (auto* SI = dyn_cast<StoreInst>(&I))
+      storeBytes(State[AI], Offset, *SI);
+    else
+      loadBytes(State[AI], Offset, cast<LoadInst>(I));
+  }
+
+  auto [Out, Inserted] = m_BlockMemOut.insert({BB, State});
+  if (!Inserted) {
+    if (Out->second == State)
+      return;
+    Out->second = std::move(State);
+  }
+  for (BasicBlock* Succ : successors(BB)) {
+    if (isEdgeFeasible(BB, Succ))
+      m_MemBlockWorkList.push(Succ);
+  }
+}
+
+void SCCPSolver::storeBytes(std::vector<ByteVal>& Bytes, uint64_t Offset, StoreInst& SI) {
+  Type* Ty = SI.getValueOperand()->getType();
+  uint64_t Size = m_DL.getTypeStoreSize(Ty);
+  LatticeVal Val = getValueState(SI.getValueOperand());
+  Type* ByteTy = Type::getInt8Ty(SI.getContext());
+  for (uint64_t i = 0; i < Size; i++) {
+    ByteVal& B = Bytes[Offset + i];
+    B = ByteVal();
+    if (Val.isOverdefined() || Val.isPartiallyKnown()) {
+      B.m_State = ByteVal::Overdefined;
+    } else if (Val.isConstant()) {
+      // Reinterpreting the stored constant as i8 at each offset takes care of
+      // endianness and of FP/vector/aggregate layouts alike
+      auto* C = dyn_cast_or_null<ConstantInt>(
+          ConstantFoldLoadFromConst(Val.getConstant(), ByteTy, APInt(64, i), m_DL));
+      B.m_State = C ? ByteVal::Known : ByteVal::Overdefined;
+      B.m_Val = C ? C->getZExtValue() : 0;
+    }
+  }
+}
+
+void SCCPSolver::loadBytes(const std::vector<ByteVal>& Bytes, uint64_t Offset, LoadInst& LI) {
+  Type* Ty = LI.getType();
+  uint64_t Size = m_DL.getTypeStoreSize(Ty);
+  if (m_DL.getTypeSizeInBits(Ty) != Size * 8 ||
+      !(Ty->isIntegerTy() || Ty->isFloatingPointTy() || Ty->isVectorTy()))
+    return markOverdefined(&LI);
+
+  APInt Val(Size * 8, 0);
+  for (uint64_t i = 0; i < Size; i++) {
+    const ByteVal& B = Bytes[Offset + i];
+    if (B.m_State == ByteVal::Undefined)
+      return;
+    if (B.m_State == ByteVal::Overdefined)
+      return markOverdefined(&LI);
+    uint64_t Shift = m_DL.isLittleEndian() ? i : Size - 1 - i;
+    Val.insertBits(B.m_Val, Shift * 8, 8);
+  }
+  Constant* C = ConstantInt::get(LI.getContext(), Val);
+  if (!Ty->isIntegerTy())
+    C = ConstantFoldCastOperand(Instruction::BitCast, C, Ty, m_DL);
+  if (!C)
+    return markOverdefined(&LI);
+  if (m_ValueState[&LI].isUndefined())
+    NumStackLoadsFolded++;
+  markConstant(&LI, C);
+}
+
+/// An `and X, C` is a no-op if every bit C clears is already zero in X, and
+/// an `or X, C` is one if every bit C sets is already one in X
+static bool isRedundantMask(Instruction& I, SCCPSolver& Solver) {
+  if (I.getOpcode() != Instruction::And && I.getOpcode() != Instruction::Or)
+    return false;
+  auto* Mask = dyn_cast<ConstantInt>(I.getOperand(1));
+  if (!Mask || !I.getType()->isIntegerTy())
+    return false;
+  KnownBits Known = Solver.getKnownBits(I.getOperand(0));
+  if (I.getOpcode() == Instruction::And)
+    return (~Mask->getValue()).isSubsetOf(Known.Zero);
+  return Mask->getValue().isSubsetOf(Known.One);
+}
+
+std::unordered_map<CallBase*, std::vector<Constant*>> cs426::solveCallArguments(Function& F,
+                                                                                FunctionAnalysisManager& FAM) {
+  SCCPSolver Solver(F.getParent()->getDataLayout(), FAM.getResult<TargetLibraryAnalysis>(F), false);
+  Solver.solve(F);
+  std::unordered_map<CallBase*, std::vector<Constant*>> CallArgs;
+  for (BasicBlock& BB : F) {
+    if (!Solver.isBlockExecutable(&BB))
+      continue;
+    for (Instruction& I : BB) {
+      auto* CB = dyn_cast<CallBase>(&I);
+      if (!CB)
+        continue;
+      std::vector<Constant*>& Args = CallArgs[CB];
+      for (Value* Arg : CB->args()) {
+        LatticeVal LV = Solver.getValueState(Arg);
+        Args.push_back(LV.isConstant() ? LV.getConstant() : nullptr);
+      }
+    }
+  }
+  return CallArgs;
+}
+
 /// Main function for running the SCCP optimization
 PreservedAnalyses UnitSCCP::run(Function& F, FunctionAnalysisManager& FAM) {
   dbgs() << "UnitSCCP running on " << F.getName() << "\n";
+  TargetLibraryInfo& TLI = FAM.getResult<TargetLibraryAnalysis>(F);
+
+  SCCPSolver Solver(F.getParent()->getDataLayout(), TLI, m_TrackKnownBits);
+  Solver.solve(F);
 
   // Perform the optimization
+  bool Changed = false;
+  bool CFGChanged = false;
+
+  // CFG edits are batched into the dominator tree if one is already cached,
+  // so the passes after us don't have to rebuild it from scratch
+  DomTreeUpdater DTU(FAM.getCachedResult<DominatorTreeAnalysis>(F),
+                     DomTreeUpdater::UpdateStrategy::Lazy);
+  // The loops stay the same as long as every block we touch is outside them
+  UnitLoopInfo* Loops = FAM.getCachedResult<UnitLoopAnalysis>(F);
+  bool LoopsIntact = true;
+
+  std::vector<BasicBlock*> DeadBlocks;
+  for (BasicBlock& BB : F) {
+    if (!Solver.isBlockExecutable(&BB))
+      DeadBlocks.push_back(&BB);
+  }
+
+  // Replace every value proven constant in reachable code
+  for (BasicBlock& BB : F) {
+    if (!Solver.isBlockExecutable(&BB))
+      continue;
+    for (Instruction& I : make_early_inc_range(BB)) {
+      if (I.isTerminator() || I.getType()->isVoidTy())
+        continue;
+      LatticeVal LV = Solver.getValueState(&I);
+      if (m_TrackKnownBits && !LV.isConstant() && isRedundantMask(I, Solver)) {
+        // and/or whose constant mask only touches bits already known
+        I.replaceAllUsesWith(I.getOperand(0));
+        I.eraseFromParent();
+        NumRedundantMasks++;
+        Changed = true;
+        continue;
+      }
+      if (!LV.isConstant())
+        continue;
+      I.replaceAllUsesWith(LV.getConstant());
+      NumInstReplaced++;
+      Changed = true;
+      // Library calls like sqrt are not known to return until attributes are
+      // inferred, but a folded call that can't touch errno is dead as well
+      auto* CB = dyn_cast<CallInst>(&I);
+      if (isInstructionTriviallyDead(&I, &TLI) ||
+          (CB && CB->use_empty() && isMathLibCallNoop(CB, &TLI))) {
+        I.eraseFromParent();
+        NumInstRemoved++;
+      }
+    }
+  }
+
+  // Drop the infeasible edges out of reachable blocks
+  for (BasicBlock& BB : F) {
+    if (!Solver.isBlockExecutable(&BB))
+      continue;
+    Instruction* Term = BB.getTerminator();
+    if (!isa<BranchInst>(Term) && !isa<SwitchInst>(Term))
+      continue;
+
+    // Infeasible keeps one entry per CFG edge so that PHIs fed by several
+    // edges from BB lose all of their entries
+    SmallVector<BasicBlock*, 4> Feasible;
+    SmallVector<BasicBlock*, 4> Infeasible;
+    for (BasicBlock* Succ : successors(&BB)) {
+      if (Solver.isEdgeFeasible(&BB, Succ))
+        Feasible.push_back(Succ);
+      else
+        Infeasible.push_back(Succ);
+    }
+    if (Infeasible.empty())
+      continue;
+
+    if (auto* SI = dyn_cast<SwitchInst>(Term); SI && Feasible.size() > 1) {
+      // Only some of the cases survive, keep the switch but prune the rest
+      for (auto Case = SI->case_begin(); Case != SI->case_end();) {
+        if (!Solver.isEdgeFeasible(&BB, Case->getCaseSuccessor()))
+          Case = SI->removeCase(Case);
+        else
+          ++Case;
+      }
+      if (!Solver.isEdgeFeasible(&BB, SI->getDefaultDest())) {
+        BasicBlock* Unreachable = BasicBlock::Create(F.getContext(), "default.unreachable", &F);
+        new UnreachableInst(F.getContext(), Unreachable);
+        SI->setDefaultDest(Unreachable);
+        DTU.applyUpdates({{DominatorTree::Insert, &BB, Unreachable}});
+      }
+    } else {
+      BranchInst::Create(Feasible.front(), &BB);
+      Term->eraseFromParent();
+    }
+    std::unordered_set<BasicBlock*> Remaining(succ_begin(&BB), succ_end(&BB));
+    std::unordered_set<BasicBlock*> Deleted;
+    for (BasicBlock* Succ : Infeasible) {
+      Succ->removePredecessor(&BB);
+      if (!Remaining.count(Succ) && Deleted.insert(Succ).second)
+        DTU.applyUpdates({{DominatorTree::Delete, &BB, Succ}});
+    }
+    LoopsIntact &= !Loops || !Loops->isLoopMember(&BB);
+    NumBranchesFolded++;
+    Changed = CFGChanged = true;
+  }
+
+  // Anything the solver never reached is dead
+  if (DeadBlocks.size()) {
+    for (BasicBlock* BB : DeadBlocks)
+      LoopsIntact &= !Loops || !Loops->isLoopMember(BB);
+    NumDeadBlocks += DeadBlocks.size();
+    DeleteDeadBlocks(DeadBlocks, &DTU);
+    Changed = CFGChanged = true;
+  }
+  DTU.flush();
 
   // Set proper preserved analyses
-  return PreservedAnalyses::all();
+  if (!Changed)
+    return PreservedAnalyses::all();
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  if (!CFGChanged)
+    PA.preserveSet<CFGAnalyses>();
+  if (LoopsIntact)
+    PA.preserve<UnitLoopAnalysis>();
+  return PA;
 }
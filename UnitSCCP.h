@@ -1,14 +1,29 @@
 #ifndef INCLUDE_UNIT_SCCP_H
 #define INCLUDE_UNIT_SCCP_H
+#include "llvm/IR/Constant.h"
+#include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/PassManager.h"
+#include <unordered_map>
+#include <vector>
 
 using namespace llvm;
 
 namespace cs426 {
 /// Sparse Conditional Constant Propagation Optimization Pass
 struct UnitSCCP : PassInfoMixin<UnitSCCP> {
+  UnitSCCP(bool TrackKnownBits = false) : m_TrackKnownBits(TrackKnownBits) {}
+
   PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+
+  // Refine overdefined integers with the individual bits that are known
+  // (selected with unit-sccp<known-bits>)
+  bool m_TrackKnownBits;
 };
+
+/// Solve F without changing it, and give for every call in a reachable block
+/// the constant each argument is proven to be, nullptr where it is not
+std::unordered_map<CallBase*, std::vector<Constant*>> solveCallArguments(Function& F,
+                                                                        FunctionAnalysisManager& FAM);
 } // namespace
 
 #endif // INCLUDE_UNIT_SCCP_H
@@ -0,0 +1,552 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-slp"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/VectorUtils.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include <map>
+
+#include "UnitLoopInfo.h"
+#include "UnitSLP.h"
+
+#define DEBUG_TYPE "UnitSLP"
+// Define any statistics here
+STATISTIC(NumStoresVectorized, "Number of store groups vectorized");
+STATISTIC(NumInstsVectorized, "Number of scalar instructions packed into vectors");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// Operand trees deeper than this are gathered from scalars instead
+const unsigned MaxTreeDepth = 12;
+const TargetTransformInfo::TargetCostKind CostKind = TargetTransformInfo::TCK_RecipThroughput;
+
+/// One vector value of the tree: the scalars it stands for, one per lane
+struct Bundle {
+  enum Kind {
+    // Replaces isomorphic instructions
+    Vectorize,
+    // Loads of the same address, replaced by one load in all lanes
+    Broadcast,
+    // Lanes extracted from an existing vector, which is used as is
+    Reuse,
+    // Built lane by lane from scalars that stay
+    Gather,
+  };
+  Kind m_Kind = Gather;
+  std::vector<Value*> m_Scalars;
+  // Bundles of the operands of Vectorize bundles
+  std::vector<unsigned> m_Operands;
+  // Last scalar of the bundle, the vector value is computed right after it
+  Instruction* m_Last = nullptr;
+  Value* m_Vector = nullptr;
+};
+
+/// The stores of a group of seeds and the trees of isomorphic instructions
+/// computing their values
+class SLPTree {
+public:
+  SLPTree(AAResults& AA, const TargetTransformInfo& TTI, const DataLayout& DL,
+          const DenseMap<Instruction*, unsigned>& Pos)
+      : m_AA(AA), m_TTI(TTI), m_DL(DL), m_Pos(Pos) {}
+
+  // Build the tree for Seeds, stores to consecutive addresses in order.
+  // Returns false if they can't be stored as one vector.
+  bool build(ArrayRef<StoreInst*> Seeds);
+  // Cost of the vector code minus the cost of the scalar code it replaces
+  InstructionCost getCost() const;
+  void vectorize();
+
+private:
+  Optional<unsigned> buildBundle(ArrayRef<Value*> Scalars, unsigned Depth);
+  Optional<unsigned> addBundle(Bundle::Kind Kind, ArrayRef<Value*> Scalars);
+  bool isClobbered(Instruction* From, Instruction* To, const MemoryLocation& Loc, bool OnlyWrites) const;
+  bool isUsedBefore(Value* Scalar, Instruction* Last) const;
+  InstructionCost getInstrCost(Instruction* I, Type* Ty) const;
+  Value* getVector(unsigned Idx, IRBuilder<>& Builder);
+
+  bool isInTree(Value* V) const { return m_InTree.count(V); }
+
+  AAResults& m_AA;
+  const TargetTransformInfo& m_TTI;
+  const DataLayout& m_DL;
+  const DenseMap<Instruction*, unsigned>& m_Pos;
+
+  std::vector<StoreInst*> m_Seeds;
+  std::vector<Bundle> m_Bundles;
+  // Scalars replaced by Vectorize and Broadcast bundles, and the seeds
+  SmallPtrSet<Value*, 16> m_InTree;
+  unsigned m_Root = 0;
+};
+} // namespace
+
+/// Split the address of a load or store into a base pointer and a constant
+/// byte offset
+static std::pair<Value*, int64_t> getBaseAndOffset(Value* Ptr, const DataLayout& DL) {
+  APInt Offset(DL.getIndexTypeSizeInBits(Ptr->getType()), 0);
+  Value* Base = Ptr->stripAndAccumulateConstantOffsets(DL, Offset, /*AllowNonInbounds=*/true);
+  return {Base, Offset.getSExtValue()};
+}
+
+/// Whether a value of type Ty can be a vector lane that fills exactly one
+/// element of memory
+static bool isPackable(Type* Ty, const DataLayout& DL) {
+  return VectorType::isValidElementType(Ty) && !Ty->isPointerTy() &&
+         DL.getTypeStoreSize(Ty) == DL.getTypeAllocSize(Ty);
+}
+
+/// Whether an instruction between From and To, both in the block, may
+/// access Loc (just write it with OnlyWrites). The seeds are skipped, they
+/// don't overlap each other.
+bool SLPTree::isClobbered(Instruction* From, Instruction* To, const MemoryLocation& Loc, bool OnlyWrites) const {
+  if (m_Pos.lookup(From) >= m_Pos.lookup(To))
+    return false;
+  for (Instruction* I = From->getNextNode(); I != To; I = I->getNextNode()) {
+    if (!I->mayReadOrWriteMemory() || std::count(m_Seeds.begin(), m_Seeds.end(), I))
+      continue;
+    ModRefInfo MRI = m_AA.getModRefInfo(I, Loc);
+    if (OnlyWrites ? isModSet(MRI) : isModOrRefSet(MRI))
+      return true;
+  }
+  return false;
+}
+
+Optional<unsigned> SLPTree::addBundle(Bundle::Kind Kind, ArrayRef<Value*> Scalars) {
+  Bundle B;
+  B.m_Kind = Kind;
+  B.m_Scalars.assign(Scalars.begin(), Scalars.end());
+  if (Kind == Bundle::Gather) {
+    // The scalars of a gather stay, so they can't be ones that go away
+    for (Value* V : Scalars) {
+      if (isInTree(V))
+        return None;
+    }
+  } else {
+    for (Value* V : Scalars) {
+      auto* I = cast<Instruction>(V);
+      if (!B.m_Last || m_Pos.lookup(I) > m_Pos.lookup(B.m_Last))
+        B.m_Last = I;
+      if (Kind != Bundle::Reuse)
+        m_InTree.insert(I);
+    }
+  }
+  m_Bundles.push_back(std::move(B));
+  return m_Bundles.size() - 1;
+}
+
+/// Build the bundle for Scalars and, for instructions that can be packed,
+/// the bundles of their operands. Bundles come after their operands.
+Optional<unsigned> SLPTree::buildBundle(ArrayRef<Value*> Scalars, unsigned Depth) {
+  unsigned Lanes = Scalars.size();
+  auto* I0 = dyn_cast<Instruction>(Scalars[0]);
+  bool Packable = I0 && I0->getParent() == m_Seeds[0]->getParent() && Depth < MaxTreeDepth &&
+                  isPackable(I0->getType(), m_DL);
+  SmallPtrSet<Value*, 8> Distinct;
+  for (Value* V : Scalars) {
+    auto* I = dyn_cast<Instruction>(V);
+    Packable &= I0 && I && I->getParent() == I0->getParent() && I->getOpcode() == I0->getOpcode() &&
+                I->getType() == I0->getType() && !isInTree(I) && !I->mayHaveSideEffects();
+    Distinct.insert(V);
+  }
+  // Lanes taken out of one vector in order are that vector
+  auto* E0 = dyn_cast<ExtractElementInst>(Scalars[0]);
+  if (E0 && cast<FixedVectorType>(E0->getVectorOperandType())->getNumElements() == Lanes) {
+    bool InOrder = true;
+    for (unsigned k = 0; k < Lanes; k++) {
+      auto* E = dyn_cast<ExtractElementInst>(Scalars[k]);
+      auto* Idx = E ? dyn_cast<ConstantInt>(E->getIndexOperand()) : nullptr;
+      InOrder &= Idx && E->getVectorOperand() == E0->getVectorOperand() && Idx->getZExtValue() == k;
+    }
+    if (InOrder)
+      return addBundle(Bundle::Reuse, Scalars);
+  }
+  if (!Packable || Distinct.size() != Lanes)
+    return addBundle(Bundle::Gather, Scalars);
+
+  if (isa<LoadInst>(I0)) {
+    bool Consecutive = true, Same = true;
+    auto [Base0, Offset0] = getBaseAndOffset(cast<LoadInst>(I0)->getPointerOperand(), m_DL);
+    int64_t Size = m_DL.getTypeStoreSize(I0->getType());
+    Instruction* Last = I0;
+    for (unsigned k = 0; k < Lanes; k++) {
+      auto* LI = cast<LoadInst>(Scalars[k]);
+      auto [Base, Offset] = getBaseAndOffset(LI->getPointerOperand(), m_DL);
+      Consecutive &= LI->isSimple() && Base == Base0 && Offset == Offset0 + (int64_t)k * Size;
+      Same &= LI->isSimple() && Base == Base0 && Offset == Offset0;
+      if (m_Pos.lookup(LI) > m_Pos.lookup(Last))
+        Last = LI;
+    }
+    // All loads run at the position of the last one
+    for (Value* V : Scalars) {
+      auto* LI = cast<LoadInst>(V);
+      if ((Consecutive || Same) && isClobbered(LI, Last, MemoryLocation::get(LI), /*OnlyWrites=*/true))
+        Consecutive = Same = false;
+    }
+    if (Consecutive)
+      return addBundle(Bundle::Vectorize, Scalars);
+    if (Same)
+      return addBundle(Bundle::Broadcast, Scalars);
+    return addBundle(Bundle::Gather, Scalars);
+  }
+
+  bool Supported = isa<BinaryOperator>(I0) || isa<UnaryOperator>(I0);
+  if (auto* Cast = dyn_cast<CastInst>(I0)) {
+    Supported = isPackable(Cast->getSrcTy(), m_DL);
+    for (Value* V : Scalars)
+      Supported &= cast<CastInst>(V)->getSrcTy() == Cast->getSrcTy();
+  }
+  if (auto* Call = dyn_cast<IntrinsicInst>(I0)) {
+    Supported = isTriviallyVectorizable(Call->getIntrinsicID()) && Call->doesNotAccessMemory();
+    for (Value* V : Scalars)
+      Supported &= cast<IntrinsicInst>(V)->getIntrinsicID() == Call->getIntrinsicID();
+    for (Value* Arg : Call->args())
+      Supported &= Arg->getType() == Call->getType();
+  }
+  if (!Supported)
+    return addBundle(Bundle::Gather, Scalars);
+
+  // Claim the scalars before looking at the operands, so a scalar that is
+  // its own operand in another lane is gathered rather than packed twice
+  for (Value* V : Scalars)
+    m_InTree.insert(V);
+  unsigned NumOperands = isa<IntrinsicInst>(I0) ? cast<IntrinsicInst>(I0)->arg_size() : I0->getNumOperands();
+  std::vector<std::vector<Value*>> Operands(NumOperands);
+  for (Value* V : Scalars) {
+    for (unsigned i = 0; i < NumOperands; i++)
+      Operands[i].push_back(cast<Instruction>(V)->getOperand(i));
+  }
+  // Line up the operands of commutative operations that are listed in a
+  // different order than in the first lane
+  if (I0->isCommutative()) {
+    auto opcodeOf = [](Value* V) { return isa<Instruction>(V) ? cast<Instruction>(V)->getOpcode() : 0; };
+    for (unsigned k = 1; k < Lanes; k++) {
+      if (opcodeOf(Operands[0][k]) != opcodeOf(Operands[0][0]) &&
+          opcodeOf(Operands[1][k]) == opcodeOf(Operands[0][0]) &&
+          opcodeOf(Operands[0][k]) == opcodeOf(Operands[1][0]))
+        std::swap(Operands[0][k], Operands[1][k]);
+    }
+  }
+  std::vector<unsigned> OperandBundles;
+  for (std::vector<Value*>& Op : Operands) {
+    Optional<unsigned> Idx = buildBundle(Op, Depth + 1);
+    if (!Idx)
+      return None;
+    OperandBundles.push_back(*Idx);
+  }
+  Optional<unsigned> Idx = addBundle(Bundle::Vectorize, Scalars);
+  if (Idx)
+    m_Bundles[*Idx].m_Operands = std::move(OperandBundles);
+  return Idx;
+}
+
+bool SLPTree::build(ArrayRef<StoreInst*> Seeds) {
+  m_Seeds.assign(Seeds.begin(), Seeds.end());
+  StoreInst* Last = Seeds.back();
+  for (StoreInst* SI : Seeds) {
+    m_InTree.insert(SI);
+    if (m_Pos.lookup(SI) > m_Pos.lookup(Last))
+      Last = SI;
+  }
+  // All stores happen at the position of the last one
+  for (StoreInst* SI : Seeds) {
+    if (isClobbered(SI, Last, MemoryLocation::get(SI), /*OnlyWrites=*/false))
+      return false;
+  }
+
+  std::vector<Value*> Values;
+  for (StoreInst* SI : Seeds)
+    Values.push_back(SI->getValueOperand());
+  Optional<unsigned> Root = buildBundle(Values, 0);
+  if (!Root)
+    return false;
+  m_Root = *Root;
+  return true;
+}
+
+/// Whether Scalar has a user outside the tree that comes before Last, so it
+/// has to stay as a scalar
+bool SLPTree::isUsedBefore(Value* Scalar, Instruction* Last) const {
+  for (User* U : Scalar->users()) {
+    auto* I = cast<Instruction>(U);
+    if (!isInTree(I) && I->getParent() == Last->getParent() && m_Pos.lookup(I) <= m_Pos.lookup(Last))
+      return true;
+  }
+  return false;
+}
+
+/// Cost of the operation of I on values of type Ty, a scalar or a vector
+InstructionCost SLPTree::getInstrCost(Instruction* I, Type* Ty) const {
+  if (auto* LI = dyn_cast<LoadInst>(I))
+    return m_TTI.getMemoryOpCost(Instruction::Load, Ty, LI->getAlign(), LI->getPointerAddressSpace(), CostKind);
+  if (auto* SI = dyn_cast<StoreInst>(I))
+    return m_TTI.getMemoryOpCost(Instruction::Store, Ty, SI->getAlign(), SI->getPointerAddressSpace(), CostKind);
+  if (auto* Cast = dyn_cast<CastInst>(I)) {
+    Type* SrcTy = Cast->getSrcTy();
+    if (auto* VecTy = dyn_cast<FixedVectorType>(Ty))
+      SrcTy = FixedVectorType::get(SrcTy, VecTy->getNumElements());
+    return m_TTI.getCastInstrCost(Cast->getOpcode(), Ty, SrcTy, TargetTransformInfo::CastContextHint::None,
+                                  CostKind);
+  }
+  if (auto* Call = dyn_cast<IntrinsicInst>(I)) {
+    SmallVector<Type*, 4> ArgTys(Call->arg_size(), Ty);
+    return m_TTI.getIntrinsicInstrCost(IntrinsicCostAttributes(Call->getIntrinsicID(), Ty, ArgTys), CostKind);
+  }
+  return m_TTI.getArithmeticInstrCost(I->getOpcode(), Ty, CostKind);
+}
+
+InstructionCost SLPTree::getCost() const {
+  Type* ScalarTy = m_Seeds[0]->getValueOperand()->getType();
+  auto* VecTy = FixedVectorType::get(ScalarTy, m_Seeds.size());
+  InstructionCost Cost = getInstrCost(m_Seeds[0], VecTy);
+  for (StoreInst* SI : m_Seeds)
+    Cost -= getInstrCost(SI, ScalarTy);
+
+  for (const Bundle& B : m_Bundles) {
+    auto* VecTy = FixedVectorType::get(B.m_Scalars[0]->getType(), B.m_Scalars.size());
+    switch (B.m_Kind) {
+    case Bundle::Reuse:
+      break;
+    case Bundle::Gather: {
+      SmallPtrSet<Value*, 8> Distinct;
+      for (unsigned k = 0; k < B.m_Scalars.size(); k++) {
+        if (!isa<Constant>(B.m_Scalars[k]) && Distinct.insert(B.m_Scalars[k]).second)
+          Cost += m_TTI.getVectorInstrCost(Instruction::InsertElement, VecTy, k);
+      }
+      if (Distinct.size() == 1 && B.m_Scalars.size() > 1)
+        Cost += m_TTI.getShuffleCost(TargetTransformInfo::SK_Broadcast, VecTy);
+      break;
+    }
+    case Bundle::Broadcast:
+      Cost += m_TTI.getVectorInstrCost(Instruction::InsertElement, VecTy, 0);
+      Cost += m_TTI.getShuffleCost(TargetTransformInfo::SK_Broadcast, VecTy);
+      // One of the loads stays to feed the vector
+      Cost -= getInstrCost(cast<Instruction>(B.m_Scalars[0]), VecTy->getElementType()) *
+              (B.m_Scalars.size() - 1);
+      break;
+    case Bundle::Vectorize:
+      Cost += getInstrCost(cast<Instruction>(B.m_Scalars[0]), VecTy);
+      for (unsigned k = 0; k < B.m_Scalars.size(); k++) {
+        auto* I = cast<Instruction>(B.m_Scalars[k]);
+        // Scalars needed before the vector is ready stay
+        if (!isUsedBefore(I, B.m_Last))
+          Cost -= getInstrCost(I, I->getType());
+        bool UsedAfter = any_of(I->users(), [this](User* U) { return !isInTree(U); });
+        if (UsedAfter)
+          Cost += m_TTI.getVectorInstrCost(Instruction::ExtractElement, VecTy, k);
+      }
+      break;
+    }
+  }
+  return Cost;
+}
+
+/// The vector value of bundle Idx, building gathers at the builder's
+/// position
+Value* SLPTree::getVector(unsigned Idx, IRBuilder<>& Builder) {
+  Bundle& B = m_Bundles[Idx];
+  if (B.m_Vector)
+    return B.m_Vector;
+  assert(B.m_Kind == Bundle::Gather && "Vector bundles are created in order");
+  unsigned Lanes = B.m_Scalars.size();
+  if (all_of(B.m_Scalars, [](Value* V) { return isa<Constant>(V); })) {
+    SmallVector<Constant*, 8> Elems;
+    for (Value* V : B.m_Scalars)
+      Elems.push_back(cast<Constant>(V));
+    return ConstantVector::get(Elems);
+  }
+  if (all_of(B.m_Scalars, [&B](Value* V) { return V == B.m_Scalars[0]; }))
+    return Builder.CreateVectorSplat(Lanes, B.m_Scalars[0], B.m_Scalars[0]->getName() + ".splat");
+  Value* Vec = PoisonValue::get(FixedVectorType::get(B.m_Scalars[0]->getType(), Lanes));
+  for (unsigned k = 0; k < Lanes; k++)
+    Vec = Builder.CreateInsertElement(Vec, B.m_Scalars[k], k, "slp.gather");
+  return Vec;
+}
+
+void SLPTree::vectorize() {
+  LLVMContext& Ctx = m_Seeds[0]->getContext();
+  IRBuilder<> Builder(Ctx);
+  for (unsigned Idx = 0; Idx < m_Bundles.size(); Idx++) {
+    Bundle& B = m_Bundles[Idx];
+    unsigned Lanes = B.m_Scalars.size();
+    auto* I0 = dyn_cast<Instruction>(B.m_Scalars[0]);
+    if (B.m_Kind == Bundle::Gather)
+      continue;
+    if (B.m_Kind == Bundle::Reuse) {
+      B.m_Vector = cast<ExtractElementInst>(I0)->getVectorOperand();
+      continue;
+    }
+    Builder.SetInsertPoint(B.m_Last->getNextNode());
+    auto* VecTy = FixedVectorType::get(I0->getType(), Lanes);
+    if (B.m_Kind == Bundle::Broadcast) {
+      // Any of the loads reads the value of all of them, the first one
+      // comes before the others
+      Value* First = *std::min_element(B.m_Scalars.begin(), B.m_Scalars.end(), [this](Value* A, Value* C) {
+        return m_Pos.lookup(cast<Instruction>(A)) < m_Pos.lookup(cast<Instruction>(C));
+      });
+      B.m_Vector = Builder.CreateVectorSplat(Lanes, First, First->getName() + ".splat");
+      for (Value* V : B.m_Scalars) {
+        if (V != First)
+          V->replaceAllUsesWith(First);
+      }
+      continue;
+    }
+
+    Value* Vec = nullptr;
+    if (auto* LI = dyn_cast<LoadInst>(I0)) {
+      Value* Ptr = Builder.CreateBitCast(LI->getPointerOperand(), PointerType::get(VecTy, LI->getPointerAddressSpace()));
+      Vec = Builder.CreateAlignedLoad(VecTy, Ptr, LI->getAlign(), I0->getName() + ".slp");
+    } else {
+      SmallVector<Value*, 4> Ops;
+      for (unsigned Op : B.m_Operands)
+        Ops.push_back(getVector(Op, Builder));
+      if (auto* Cast = dyn_cast<CastInst>(I0)) {
+        Vec = Builder.CreateCast(Cast->getOpcode(), Ops[0], VecTy, I0->getName() + ".slp");
+      } else if (auto* Call = dyn_cast<IntrinsicInst>(I0)) {
+        Function* Decl = Intrinsic::getDeclaration(I0->getModule(), Call->getIntrinsicID(), {VecTy});
+        Vec = Builder.CreateCall(Decl, Ops, I0->getName() + ".slp");
+      } else if (isa<UnaryOperator>(I0)) {
+        Vec = Builder.CreateUnOp((Instruction::UnaryOps)I0->getOpcode(), Ops[0], I0->getName() + ".slp");
+      } else {
+        Vec = Builder.CreateBinOp((Instruction::BinaryOps)I0->getOpcode(), Ops[0], Ops[1], I0->getName() + ".slp");
+      }
+      // Only flags that hold in every lane hold for the vector
+      if (auto* VecI = dyn_cast<Instruction>(Vec)) {
+        VecI->copyIRFlags(I0);
+        for (Value* V : B.m_Scalars)
+          VecI->andIRFlags(V);
+      }
+    }
+    B.m_Vector = Vec;
+
+    // Users outside the tree that come later take their lane out of the
+    // vector, earlier ones keep the scalar
+    for (unsigned k = 0; k < Lanes; k++) {
+      auto* I = cast<Instruction>(B.m_Scalars[k]);
+      Value* Lane = nullptr;
+      for (Use& U : make_early_inc_range(I->uses())) {
+        auto* User = cast<Instruction>(U.getUser());
+        if (isInTree(User) || (User->getParent() == B.m_Last->getParent() &&
+                               m_Pos.lookup(User) <= m_Pos.lookup(B.m_Last)))
+          continue;
+        if (!Lane)
+          Lane = Builder.CreateExtractElement(Vec, (uint64_t)k, I->getName() + ".lane");
+        U.set(Lane);
+      }
+    }
+    NumInstsVectorized += Lanes;
+  }
+
+  // Store the root vector where the last seed was
+  StoreInst* Last = m_Seeds[0];
+  for (StoreInst* SI : m_Seeds) {
+    if (m_Pos.lookup(SI) > m_Pos.lookup(Last))
+      Last = SI;
+  }
+  Builder.SetInsertPoint(Last);
+  Value* Root = getVector(m_Root, Builder);
+  Value* Ptr = Builder.CreateBitCast(m_Seeds[0]->getPointerOperand(),
+                                     PointerType::get(Root->getType(), m_Seeds[0]->getPointerAddressSpace()));
+  Builder.CreateAlignedStore(Root, Ptr, m_Seeds[0]->getAlign());
+  for (StoreInst* SI : m_Seeds)
+    SI->eraseFromParent();
+
+  // Users come after their operands, so dead scalars go from the back
+  for (auto it = m_Bundles.rbegin(); it != m_Bundles.rend(); ++it) {
+    if (it->m_Kind != Bundle::Vectorize && it->m_Kind != Bundle::Broadcast)
+      continue;
+    for (Value* V : it->m_Scalars) {
+      auto* I = cast<Instruction>(V);
+      if (I->use_empty())
+        I->eraseFromParent();
+    }
+  }
+}
+
+/// Try to pack the stores of BB to adjacent addresses. Returns true once a
+/// group has been vectorized, since that invalidates the positions.
+static bool vectorizeStores(BasicBlock& BB, AAResults& AA, const TargetTransformInfo& TTI, const DataLayout& DL) {
+  DenseMap<Instruction*, unsigned> Pos;
+  // Stores grouped by base pointer and type, ordered by offset
+  std::map<std::pair<Value*, Type*>, std::map<int64_t, StoreInst*>> Groups;
+  std::vector<std::pair<Value*, Type*>> GroupOrder;
+  unsigned Next = 0;
+  for (Instruction& I : BB) {
+    Pos[&I] = Next++;
+    auto* SI = dyn_cast<StoreInst>(&I);
+    if (!SI || !SI->isSimple() || !isPackable(SI->getValueOperand()->getType(), DL))
+      continue;
+    auto [Base, Offset] = getBaseAndOffset(SI->getPointerOperand(), DL);
+    std::pair<Value*, Type*> Key(Base, SI->getValueOperand()->getType());
+    if (!Groups.count(Key))
+      GroupOrder.push_back(Key);
+    // Only the last store to an address is a candidate
+    Groups[Key][Offset] = SI;
+  }
+
+  unsigned RegisterBits = TTI.getRegisterBitWidth(TargetTransformInfo::RGK_FixedWidthVector).getFixedSize();
+  for (const auto& Key : GroupOrder) {
+    unsigned MaxLanes = RegisterBits / DL.getTypeSizeInBits(Key.second).getFixedSize();
+    if (MaxLanes < 2)
+      continue;
+    // Runs of stores one element apart
+    int64_t Size = DL.getTypeStoreSize(Key.second);
+    std::vector<std::vector<StoreInst*>> Runs;
+    int64_t Prev = 0;
+    for (auto [Offset, SI] : Groups[Key]) {
+      if (Runs.empty() || Offset != Prev + Size)
+        Runs.emplace_back();
+      Runs.back().push_back(SI);
+      Prev = Offset;
+    }
+
+    for (const std::vector<StoreInst*>& Run : Runs) {
+      for (unsigned i = 0; i + 1 < Run.size(); i++) {
+        for (unsigned Lanes = std::min<unsigned>(Run.size() - i, MaxLanes); Lanes >= 2; Lanes--) {
+          SLPTree Tree(AA, TTI, DL, Pos);
+          ArrayRef<StoreInst*> Seeds(&Run[i], Lanes);
+          if (!Tree.build(Seeds))
+            continue;
+          InstructionCost Cost = Tree.getCost();
+          if (!Cost.isValid() || Cost >= 0)
+            continue;
+          dbgs() << "[UnitSLP] Packing " << Lanes << " stores to " << Key.first->getName() << " (cost " << Cost
+                 << ")\n";
+          Tree.vectorize();
+          NumStoresVectorized++;
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+/// Main function for running the SLP vectorization
+PreservedAnalyses UnitSLP::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitSLP running on " << F.getName() << "\n";
+  AAResults& AA = FAM.getResult<AAManager>(F);
+  TargetTransformInfo& TTI = FAM.getResult<TargetIRAnalysis>(F);
+  const DataLayout& DL = F.getParent()->getDataLayout();
+
+  bool Changed = false;
+  for (BasicBlock& BB : F) {
+    while (vectorizeStores(BB, AA, TTI, DL))
+      Changed = true;
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  // Only instructions within blocks changed
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  PA.preserve<UnitLoopAnalysis>();
+  return PA;
+}
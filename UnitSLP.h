@@ -0,0 +1,16 @@
+#ifndef INCLUDE_UNIT_SLP_H
+#define INCLUDE_UNIT_SLP_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// SLP Vectorization Pass. Packs stores to adjacent memory, and the
+/// isomorphic computations feeding them, into vector instructions when the
+/// target's cost model says the vector code is cheaper.
+struct UnitSLP : PassInfoMixin<UnitSLP> {
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_SLP_H
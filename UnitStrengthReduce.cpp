@@ -0,0 +1,414 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-strength-reduce"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#include "UnitLoopInfo.h"
+#include "UnitStrengthReduce.h"
+
+#define DEBUG_TYPE "UnitStrengthReduce"
+// Define any statistics here
+STATISTIC(NumAddressesReduced, "Number of address computations turned into pointer increments");
+STATISTIC(NumMulsReduced, "Number of multiplications turned into additive recurrences");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// A basic induction variable: m_Phi = phi [m_Start, preheader], [m_Phi + m_Step, latch]
+struct BasicIV {
+  PHINode* m_Phi = nullptr;
+  Value* m_Start = nullptr;
+  Value* m_Step = nullptr;
+  bool m_NSW = false;
+  bool m_NUW = false;
+};
+
+// m_Base + m_Scale * ext(m_IV), where m_Base and m_Scale are loop-invariant
+// values of the expression's type, and ext is m_Ext (if any)
+struct AffineExpr {
+  const BasicIV* m_IV = nullptr;
+  // nullptr stands for zero
+  Value* m_Base = nullptr;
+  Value* m_Scale = nullptr;
+  // Instruction::SExt or Instruction::ZExt, 0 if m_IV has the expression's type
+  unsigned m_Ext = 0;
+  // Whether computing the expression from m_IV can't wrap
+  bool m_NSW = false;
+  bool m_NUW = false;
+};
+
+/// Strength reduction of a single loop. Invariant parts of the recurrences
+/// are computed in the preheader.
+class StrengthReducer {
+public:
+  StrengthReducer(const UnitLoop& L)
+      : m_Loop(L), m_Preheader(L.getPreheader()), m_Latch(L.getLatch()),
+        m_Builder(L.getPreheader()->getTerminator()) {
+    for (Instruction& I : *m_Preheader) {
+      if (!I.isTerminator())
+        m_Settled.insert(&I);
+    }
+  }
+
+  bool run();
+
+private:
+  bool isInvariant(Value* V) const {
+    auto* I = dyn_cast<Instruction>(V);
+    return !I || !m_Loop.contains(I->getParent());
+  }
+  bool isHoistable(Value* V, unsigned Depth = 0) const;
+  void hoistOperands(Value* V);
+  void findBasicIVs();
+  Optional<AffineExpr> getAffine(Value* V);
+  Optional<AffineExpr> computeAffine(Value* V);
+
+  // Invariant arithmetic in the preheader, nullptr standing for zero
+  static bool isConstant(Value* V, uint64_t C) {
+    auto* CI = dyn_cast_or_null<ConstantInt>(V);
+    return CI && CI->getValue() == C;
+  }
+  Value* add(Value* A, Value* B) {
+    if (!A || isConstant(A, 0))
+      return B;
+    if (!B || isConstant(B, 0))
+      return A;
+    return m_Builder.CreateAdd(A, B);
+  }
+  Value* mul(Value* A, Value* B) {
+    if (!A || !B || isConstant(A, 0) || isConstant(B, 0))
+      return nullptr;
+    if (isConstant(A, 1))
+      return B;
+    if (isConstant(B, 1))
+      return A;
+    return m_Builder.CreateMul(A, B);
+  }
+  // -V in the expression's type, which R may only be extended through if
+  // the negation can't wrap: never for zext, and for sext unless V is a
+  // constant other than the signed minimum
+  Value* neg(Value* V, AffineExpr& R) {
+    auto* C = dyn_cast<ConstantInt>(V);
+    if (!C || C->getValue().isMinSignedValue())
+      R.m_NSW = false;
+    R.m_NUW = false;
+    return m_Builder.CreateNeg(V);
+  }
+  Value* ext(unsigned Op, Value* V, Type* Ty) {
+    return V && Op ? m_Builder.CreateCast((Instruction::CastOps)Op, V, Ty) : V;
+  }
+
+  // Value of the expression in the first iteration and its increment per
+  // iteration
+  Value* getStart(const AffineExpr& E, Type* Ty);
+  Value* getStep(const AffineExpr& E, Type* Ty);
+  void createRecurrence(Instruction* I, Value* Start, function_ref<Instruction*(PHINode*)> CreateNext);
+
+  bool reduceAddress(GetElementPtrInst* GEP);
+  bool reduceMul(BinaryOperator* Mul);
+
+  const UnitLoop& m_Loop;
+  BasicBlock* m_Preheader;
+  BasicBlock* m_Latch;
+  IRBuilder<> m_Builder;
+  std::unordered_map<PHINode*, BasicIV> m_IVs;
+  std::unordered_map<Value*, Optional<AffineExpr>> m_Affine;
+  // Preheader instructions that the arithmetic built for candidates comes
+  // after: the original ones and those hoisted out of the loop
+  std::unordered_set<Instruction*> m_Settled;
+  bool m_Hoisted = false;
+};
+
+// How deep the computation of a value is followed to find out it is invariant
+const unsigned MaxHoistDepth = 4;
+} // namespace
+
+/// Whether V is loop-invariant or computed inside the loop from invariant
+/// operands, so it could be hoisted to the preheader
+bool StrengthReducer::isHoistable(Value* V, unsigned Depth) const {
+  if (isInvariant(V))
+    return true;
+  auto* I = cast<Instruction>(V);
+  if (Depth == MaxHoistDepth || isa<PHINode>(I) || I->mayReadFromMemory() || !isSafeToSpeculativelyExecute(I))
+    return false;
+  return all_of(I->operands(), [&](Value* Op) { return isHoistable(Op, Depth + 1); });
+}
+
+/// Once a rewrite uses V, computed in the preheader, move the loop
+/// instructions it was built from in front of the preheader arithmetic
+void StrengthReducer::hoistOperands(Value* V) {
+  auto* I = dyn_cast<Instruction>(V);
+  if (!I || m_Settled.count(I) || (I->getParent() != m_Preheader && !m_Loop.contains(I->getParent())))
+    return;
+  for (Value* Op : I->operands())
+    hoistOperands(Op);
+  if (I->getParent() == m_Preheader)
+    return;
+  auto First = find_if(*m_Preheader, [&](Instruction& PI) { return !m_Settled.count(&PI); });
+  I->moveBefore(&*First);
+  m_Settled.insert(I);
+  m_Hoisted = true;
+}
+
+void StrengthReducer::findBasicIVs() {
+  for (PHINode& PN : m_Loop.m_Header->phis()) {
+    if (!PN.getType()->isIntegerTy() || PN.getNumIncomingValues() != 2)
+      continue;
+    auto* Inc = dyn_cast<BinaryOperator>(PN.getIncomingValueForBlock(m_Latch));
+    if (!Inc || Inc->getOpcode() != Instruction::Add)
+      continue;
+    Value* Step = Inc->getOperand(0) == &PN ? Inc->getOperand(1) : Inc->getOperand(0);
+    if (Inc->getOperand(0) != &PN && Inc->getOperand(1) != &PN)
+      continue;
+    if (!isInvariant(Step))
+      continue;
+    m_IVs[&PN] = {&PN, PN.getIncomingValueForBlock(m_Preheader), Step, Inc->hasNoSignedWrap(),
+                  Inc->hasNoUnsignedWrap()};
+  }
+}
+
+Optional<AffineExpr> StrengthReducer::getAffine(Value* V) {
+  auto it = m_Affine.find(V);
+  if (it != m_Affine.end())
+    return it->second;
+  Optional<AffineExpr> E = computeAffine(V);
+  m_Affine[V] = E;
+  return E;
+}
+
+Optional<AffineExpr> StrengthReducer::computeAffine(Value* V) {
+  Type* Ty = V->getType();
+  if (!Ty->isIntegerTy() || isHoistable(V))
+    return None;
+  if (auto* PN = dyn_cast<PHINode>(V)) {
+    auto it = m_IVs.find(PN);
+    if (it == m_IVs.end())
+      return None;
+    const BasicIV& IV = it->second;
+    return AffineExpr{&IV, nullptr, ConstantInt::get(Ty, 1), 0, IV.m_NSW, IV.m_NUW};
+  }
+
+  if (auto* Cast = dyn_cast<CastInst>(V)) {
+    unsigned Op = Cast->getOpcode();
+    if (Op != Instruction::SExt && Op != Instruction::ZExt)
+      return None;
+    Optional<AffineExpr> E = getAffine(Cast->getOperand(0));
+    // Extending distributes over the expression as long as it doesn't wrap
+    if (!E || E->m_Ext || !(Op == Instruction::SExt ? E->m_NSW : E->m_NUW))
+      return None;
+    return AffineExpr{E->m_IV, ext(Op, E->m_Base, Ty), ext(Op, E->m_Scale, Ty), Op, false, false};
+  }
+
+  auto* BO = dyn_cast<BinaryOperator>(V);
+  if (!BO)
+    return None;
+  // Operands computed in the loop from invariants are treated as invariant,
+  // they are only hoisted if the expression ends up rewritten
+  Value* A = BO->getOperand(0);
+  Value* B = BO->getOperand(1);
+  bool InvA = isHoistable(A);
+  bool InvB = isHoistable(B);
+  Optional<AffineExpr> EA = InvA ? None : getAffine(A);
+  Optional<AffineExpr> EB = InvB ? None : getAffine(B);
+  Optional<AffineExpr> R;
+  switch (BO->getOpcode()) {
+  case Instruction::Add:
+    if (EA && InvB) {
+      R = EA;
+      R->m_Base = add(EA->m_Base, B);
+    } else if (EB && InvA) {
+      R = EB;
+      R->m_Base = add(A, EB->m_Base);
+    } else if (EA && EB && EA->m_IV == EB->m_IV && EA->m_Ext == EB->m_Ext) {
+      R = EA;
+      R->m_Base = add(EA->m_Base, EB->m_Base);
+      R->m_Scale = add(EA->m_Scale, EB->m_Scale);
+      R->m_NSW &= EB->m_NSW;
+      R->m_NUW &= EB->m_NUW;
+    }
+    break;
+  case Instruction::Sub:
+    if (EA && InvB) {
+      R = EA;
+      R->m_Base = add(EA->m_Base, neg(B, *R));
+    } else if (EB && InvA) {
+      R = EB;
+      R->m_Base = EB->m_Base ? m_Builder.CreateSub(A, EB->m_Base) : A;
+      R->m_Scale = neg(EB->m_Scale, *R);
+    }
+    break;
+  case Instruction::Mul:
+    if (EA && InvB) {
+      R = EA;
+      R->m_Base = mul(EA->m_Base, B);
+      R->m_Scale = mul(EA->m_Scale, B);
+    } else if (EB && InvA) {
+      R = EB;
+      R->m_Base = mul(A, EB->m_Base);
+      R->m_Scale = mul(A, EB->m_Scale);
+    }
+    break;
+  case Instruction::Shl:
+    if (auto* Amount = dyn_cast<ConstantInt>(B); EA && Amount && Amount->getValue().ult(Ty->getIntegerBitWidth())) {
+      auto* Factor = ConstantInt::get(Ty, APInt::getOneBitSet(Ty->getIntegerBitWidth(), Amount->getZExtValue()));
+      R = EA;
+      R->m_Base = mul(EA->m_Base, Factor);
+      R->m_Scale = mul(EA->m_Scale, Factor);
+    }
+    break;
+  default:
+    break;
+  }
+  if (R) {
+    R->m_NSW &= BO->hasNoSignedWrap();
+    R->m_NUW &= BO->hasNoUnsignedWrap();
+  }
+  return R;
+}
+
+Value* StrengthReducer::getStart(const AffineExpr& E, Type* Ty) {
+  Value* Start = add(E.m_Base, mul(E.m_Scale, ext(E.m_Ext, E.m_IV->m_Start, Ty)));
+  return Start ? Start : Constant::getNullValue(Ty);
+}
+
+Value* StrengthReducer::getStep(const AffineExpr& E, Type* Ty) {
+  Value* Step = mul(E.m_Scale, ext(E.m_Ext, E.m_IV->m_Step, Ty));
+  return Step ? Step : Constant::getNullValue(Ty);
+}
+
+/// Replace I by a header PHI starting at Start and advanced on the back edge
+/// by the instruction CreateNext builds from the PHI in the latch
+void StrengthReducer::createRecurrence(Instruction* I, Value* Start,
+                                       function_ref<Instruction*(PHINode*)> CreateNext) {
+  PHINode* PN = PHINode::Create(I->getType(), 2, I->getName() + ".sr", &m_Loop.m_Header->front());
+  PN->addIncoming(Start, m_Preheader);
+  PN->addIncoming(CreateNext(PN), m_Latch);
+  I->replaceAllUsesWith(PN);
+  RecursivelyDeleteTriviallyDeadInstructions(I);
+  // Deleted instructions may still be keys of the cache
+  m_Affine.clear();
+}
+
+/// Turn an address indexed by an affine expression in its last index into a
+/// pointer advanced by a constant stride every iteration
+bool StrengthReducer::reduceAddress(GetElementPtrInst* GEP) {
+  unsigned Last = GEP->getNumOperands() - 1;
+  if (Last < 1 || GEP->getType()->isVectorTy() || !isInvariant(GEP->getPointerOperand()))
+    return false;
+  for (unsigned i = 1; i < Last; i++) {
+    if (!isInvariant(GEP->getOperand(i)))
+      return false;
+  }
+  Value* Index = GEP->getOperand(Last);
+  Optional<AffineExpr> E = getAffine(Index);
+  if (!E)
+    return false;
+
+  // The first address might never have been computed by the loop, so it
+  // loses inbounds
+  auto* Start = cast<GetElementPtrInst>(GEP->clone());
+  Start->setOperand(Last, getStart(*E, Index->getType()));
+  Start->setIsInBounds(false);
+  Start->setName(GEP->getName() + ".sr.start");
+  Start->insertBefore(m_Preheader->getTerminator());
+
+  Value* Step = getStep(*E, Index->getType());
+  hoistOperands(Start);
+  hoistOperands(Step);
+  dbgs() << "[UnitStrengthReduce] Incrementing " << GEP->getName() << " by " << *Step << "\n";
+  Type* ElemTy = GEP->getResultElementType();
+  std::string Name = (GEP->getName() + ".sr.next").str();
+  createRecurrence(GEP, Start, [&](PHINode* PN) {
+    return GetElementPtrInst::Create(ElemTy, PN, Step, Name, m_Latch->getTerminator());
+  });
+  NumAddressesReduced++;
+  return true;
+}
+
+/// Turn a multiplication affine in an induction variable into an additive
+/// recurrence
+bool StrengthReducer::reduceMul(BinaryOperator* Mul) {
+  Optional<AffineExpr> E = Mul->use_empty() ? None : getAffine(Mul);
+  if (!E)
+    return false;
+  Type* Ty = Mul->getType();
+  Value* Start = getStart(*E, Ty);
+  Value* Step = getStep(*E, Ty);
+  hoistOperands(Start);
+  hoistOperands(Step);
+  dbgs() << "[UnitStrengthReduce] Replacing " << *Mul << " by a recurrence\n";
+  std::string Name = (Mul->getName() + ".sr.next").str();
+  createRecurrence(Mul, Start, [&](PHINode* PN) {
+    return BinaryOperator::CreateAdd(PN, Step, Name, m_Latch->getTerminator());
+  });
+  NumMulsReduced++;
+  return true;
+}
+
+bool StrengthReducer::run() {
+  findBasicIVs();
+  if (m_IVs.empty())
+    return false;
+
+  // Addresses first, the multiplications only feeding them go away with them
+  bool Changed = false;
+  std::vector<GetElementPtrInst*> GEPs;
+  for (BasicBlock* BB : m_Loop.m_Blocks) {
+    for (Instruction& I : *BB) {
+      if (auto* GEP = dyn_cast<GetElementPtrInst>(&I))
+        GEPs.push_back(GEP);
+    }
+  }
+  for (GetElementPtrInst* GEP : GEPs)
+    Changed |= reduceAddress(GEP);
+
+  std::vector<WeakTrackingVH> Muls;
+  for (BasicBlock* BB : m_Loop.m_Blocks) {
+    for (Instruction& I : *BB) {
+      if (I.getOpcode() == Instruction::Mul)
+        Muls.push_back(&I);
+    }
+  }
+  for (WeakTrackingVH& Mul : Muls) {
+    if (auto* BO = dyn_cast_or_null<BinaryOperator>(Mul))
+      Changed |= reduceMul(BO);
+  }
+
+  // Drop the invariant expressions built for candidates that didn't pan out,
+  // along with loop instructions only they still used
+  SmallVector<WeakTrackingVH, 16> Dead;
+  for (Instruction& I : *m_Preheader) {
+    if (isInstructionTriviallyDead(&I))
+      Dead.push_back(&I);
+  }
+  RecursivelyDeleteTriviallyDeadInstructionsPermissive(Dead);
+  return Changed || m_Hoisted;
+}
+
+/// Main function for running the strength reduction
+PreservedAnalyses UnitStrengthReduce::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitStrengthReduce running on " << F.getName() << "\n";
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+
+  // Inner loops first, so the start addresses they compute in their
+  // preheaders are reduced again in the enclosing loop
+  bool Changed = false;
+  for (const UnitLoop& L : Loops.getLoops(F)) {
+    if (!L.getPreheader() || !L.getLatch())
+      continue;
+    Changed |= StrengthReducer(L).run();
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  // Only instructions were added and removed, the CFG is untouched
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  PA.preserve<UnitLoopAnalysis>();
+  return PA;
+}
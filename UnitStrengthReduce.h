@@ -0,0 +1,16 @@
+#ifndef INCLUDE_UNIT_STRENGTH_REDUCE_H
+#define INCLUDE_UNIT_STRENGTH_REDUCE_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Induction Variable Strength Reduction Pass. Replaces address computations
+/// and multiplications that are affine in an induction variable by pointer
+/// and integer recurrences updated once per iteration.
+struct UnitStrengthReduce : PassInfoMixin<UnitStrengthReduce> {
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_STRENGTH_REDUCE_H
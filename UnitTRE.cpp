@@ -0,0 +1,203 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-tre"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include "UnitTRE.h"
+
+#define DEBUG_TYPE "UnitTRE"
+// Define any statistics here
+STATISTIC(NumTailCallsEliminated, "Number of tail calls turned into jumps");
+STATISTIC(NumAccumulators, "Number of accumulators introduced");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// A self call whose result the function returns, directly or combined with
+// m_Other by m_Combine
+struct TailCall {
+  CallInst* m_Call = nullptr;
+  BinaryOperator* m_Combine = nullptr;
+  Value* m_Other = nullptr;
+  ReturnInst* m_Ret = nullptr;
+};
+} // namespace
+
+static bool isSelfCall(Instruction* I, Function& F) {
+  auto* CI = dyn_cast_or_null<CallInst>(I);
+  return CI && CI->getCalledFunction() == &F && CI->getFunctionType() == F.getFunctionType() &&
+         !CI->isMustTailCall();
+}
+
+/// Whether the stack frame of F can be reused by the calls it makes to itself
+static bool canReuseFrame(Function& F) {
+  if (F.isVarArg() || F.callsFunctionThatReturnsTwice())
+    return false;
+  for (Argument& Arg : F.args()) {
+    if (Arg.hasByValAttr() || Arg.hasInAllocaAttr() || Arg.hasPreallocatedAttr())
+      return false;
+  }
+  // The callee could see the locals of the frame it replaces
+  return none_of(instructions(F), [](Instruction& I) { return isa<AllocaInst>(I); });
+}
+
+/// Whether V returned at Term (the return or the branch to it) is the
+/// result of the self call right in front, possibly combined with another
+/// value just before
+static Optional<TailCall> matchTailCall(Function& F, Instruction* Term, Value* V) {
+  Instruction* Prev = Term->getPrevNonDebugInstruction();
+  TailCall TC;
+  if (isSelfCall(Prev, F) && (F.getReturnType()->isVoidTy() || V == Prev)) {
+    TC.m_Call = cast<CallInst>(Prev);
+    return TC;
+  }
+  // The returned values may be combined in any order when the operation is
+  // associative and commutative
+  auto* BO = dyn_cast_or_null<BinaryOperator>(Prev);
+  if (!BO || BO != V || !BO->isAssociative() || !BO->isCommutative())
+    return None;
+  Instruction* Call = BO->getPrevNonDebugInstruction();
+  if (!isSelfCall(Call, F) || !Call->hasOneUse() || BO->getOperand(0) == BO->getOperand(1))
+    return None;
+  TC.m_Call = cast<CallInst>(Call);
+  TC.m_Combine = BO;
+  TC.m_Other = BO->getOperand(0) == Call ? BO->getOperand(1) : BO->getOperand(0);
+  return TC;
+}
+
+/// Copy returns that only pick their value with phis into the predecessors
+/// whose value is a tail call, like the ones simplifycfg merges
+static bool foldReturns(Function& F) {
+  std::vector<std::pair<BasicBlock*, BasicBlock*>> Folds;
+  for (BasicBlock& BB : F) {
+    auto* Ret = dyn_cast<ReturnInst>(BB.getTerminator());
+    if (!Ret || BB.getFirstNonPHIOrDbg() != Ret)
+      continue;
+    for (BasicBlock* Pred : predecessors(&BB)) {
+      auto* Br = dyn_cast<BranchInst>(Pred->getTerminator());
+      if (!Br || Br->isConditional() || Pred == &BB)
+        continue;
+      Value* V = Ret->getReturnValue();
+      if (auto* Phi = dyn_cast_or_null<PHINode>(V); Phi && Phi->getParent() == &BB)
+        V = Phi->getIncomingValueForBlock(Pred);
+      if (matchTailCall(F, Br, V))
+        Folds.push_back({Pred, &BB});
+    }
+  }
+  for (auto [Pred, RetBB] : Folds) {
+    Value* V = cast<ReturnInst>(RetBB->getTerminator())->getReturnValue();
+    if (auto* Phi = dyn_cast_or_null<PHINode>(V); Phi && Phi->getParent() == RetBB)
+      V = Phi->getIncomingValueForBlock(Pred);
+    ReturnInst::Create(F.getContext(), V, Pred->getTerminator());
+    Pred->getTerminator()->eraseFromParent();
+    RetBB->removePredecessor(Pred);
+    if (pred_empty(RetBB))
+      DeleteDeadBlock(RetBB);
+  }
+  return !Folds.empty();
+}
+
+/// Turn the tail calls into jumps to a new loop header at the top of F,
+/// with a phi per argument and, if some tail calls combine their results,
+/// an accumulator that the other returns apply
+static void eliminateTailCalls(Function& F, std::vector<TailCall>& TailCalls) {
+  LLVMContext& Ctx = F.getContext();
+  BasicBlock* Header = &F.getEntryBlock();
+  Header->setName("tailrecurse");
+  BasicBlock* Entry = BasicBlock::Create(Ctx, "entry", &F, Header);
+  BranchInst::Create(Header, Entry);
+
+  std::vector<PHINode*> ArgPhis;
+  for (Argument& Arg : F.args()) {
+    PHINode* Phi = PHINode::Create(Arg.getType(), TailCalls.size() + 1, Arg.getName() + ".tr",
+                                   &*Header->getFirstInsertionPt());
+    Arg.replaceAllUsesWith(Phi);
+    Phi->addIncoming(&Arg, Entry);
+    ArgPhis.push_back(Phi);
+  }
+
+  // The first combining operation decides the accumulator, tail calls
+  // combining differently stay calls
+  auto First = find_if(TailCalls, [](TailCall& TC) { return TC.m_Combine; });
+  PHINode* Acc = nullptr;
+  Instruction::BinaryOps Op;
+  FastMathFlags FMF;
+  if (First != TailCalls.end()) {
+    Op = First->m_Combine->getOpcode();
+    if (isa<FPMathOperator>(First->m_Combine))
+      FMF = First->m_Combine->getFastMathFlags();
+    erase_if(TailCalls, [&](TailCall& TC) { return TC.m_Combine && TC.m_Combine->getOpcode() != Op; });
+    Acc = PHINode::Create(F.getReturnType(), TailCalls.size() + 1, "accumulator.tr", &*Header->getFirstInsertionPt());
+    Acc->addIncoming(ConstantExpr::getBinOpIdentity(Op, F.getReturnType()), Entry);
+    NumAccumulators++;
+  }
+
+  auto accumulate = [&](Value* V, Instruction* Before, const Twine& Name) -> Value* {
+    // Reassociating invalidates the wrap flags, fast-math flags still hold
+    auto* Combined = BinaryOperator::Create(Op, Acc, V, Name, Before);
+    if (isa<FPMathOperator>(Combined))
+      Combined->setFastMathFlags(FMF);
+    return Combined;
+  };
+  std::vector<ReturnInst*> Returns;
+  for (Instruction& I : instructions(F)) {
+    if (auto* Ret = dyn_cast<ReturnInst>(&I))
+      Returns.push_back(Ret);
+  }
+  for (TailCall& TC : TailCalls) {
+    BasicBlock* BB = TC.m_Call->getParent();
+    for (unsigned i = 0; i < ArgPhis.size(); i++)
+      ArgPhis[i]->addIncoming(TC.m_Call->getArgOperand(i), BB);
+    if (Acc && TC.m_Combine) {
+      // The value combined with may be an argument of this call's caller
+      Value* Other = TC.m_Other;
+      if (auto* Arg = dyn_cast<Argument>(Other))
+        Other = ArgPhis[Arg->getArgNo()];
+      Acc->addIncoming(accumulate(Other, TC.m_Ret, "accumulate.tr"), BB);
+    } else if (Acc) {
+      Acc->addIncoming(Acc, BB);
+    }
+    BranchInst::Create(Header, TC.m_Ret);
+    erase_value(Returns, TC.m_Ret);
+    TC.m_Ret->eraseFromParent();
+    if (TC.m_Combine)
+      TC.m_Combine->eraseFromParent();
+    TC.m_Call->eraseFromParent();
+    NumTailCallsEliminated++;
+  }
+  if (Acc) {
+    for (ReturnInst* Ret : Returns)
+      Ret->setOperand(0, accumulate(Ret->getReturnValue(), Ret, "accumulate.ret"));
+  }
+}
+
+/// Main function for running the tail recursion elimination
+PreservedAnalyses UnitTRE::run(Function& F, FunctionAnalysisManager&) {
+  dbgs() << "UnitTRE running on " << F.getName() << "\n";
+  if (!canReuseFrame(F))
+    return PreservedAnalyses::all();
+  bool Changed = foldReturns(F);
+  std::vector<TailCall> TailCalls;
+  for (BasicBlock& BB : F) {
+    auto* Ret = dyn_cast<ReturnInst>(BB.getTerminator());
+    if (!Ret)
+      continue;
+    if (Optional<TailCall> TC = matchTailCall(F, Ret, Ret->getReturnValue())) {
+      TC->m_Ret = Ret;
+      TailCalls.push_back(*TC);
+    }
+  }
+  if (!TailCalls.empty()) {
+    dbgs() << "[UnitTRE] Eliminating " << TailCalls.size() << " tail call(s) of " << F.getName() << "\n";
+    eliminateTailCalls(F, TailCalls);
+    Changed = true;
+  }
+  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
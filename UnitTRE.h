@@ -0,0 +1,19 @@
+#ifndef INCLUDE_UNIT_TRE_H
+#define INCLUDE_UNIT_TRE_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Tail Recursion Elimination Pass. Turns calls of a function to itself
+/// whose result is returned right away into a jump back to the start of the
+/// function with the call's arguments. A result combined with a value by an
+/// associative and commutative operation before it is returned, as in
+/// return f(n - 1) + g(n), is gathered in an accumulator that every return
+/// applies instead.
+struct UnitTRE : PassInfoMixin<UnitTRE> {
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_TRE_H
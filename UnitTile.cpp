@@ -0,0 +1,262 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-tile<l1=32768;l2=262144>"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include <unordered_set>
+
+#include "UnitLoopInfo.h"
+#include "UnitLoopNest.h"
+#include "UnitTile.h"
+
+#define DEBUG_TYPE "UnitTile"
+// Define any statistics here
+STATISTIC(NumNestsTiled, "Number of loop nests tiled");
+STATISTIC(NumLoopsTiled, "Number of loops strip-mined");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// Only 2-D and 3-D nests are tiled
+const unsigned MaxNestDepth = 3;
+// Bounds of the tile sizes tried, in iterations per loop
+const uint64_t MinTileSize = 8;
+const uint64_t MaxTileSize = 1024;
+} // namespace
+
+/// Whether every loop of the nest can be strip-mined: it counts up by one
+/// and stops at its bound, and nothing after the nest uses its values
+static bool isTileable(const LoopNest& Nest) {
+  for (const UnitInduction& Ind : Nest.m_Inds) {
+    ICmpInst::Predicate Pred = Ind.m_ExitOnTrue ? ICmpInst::getInversePredicate(Ind.m_Pred) : Ind.m_Pred;
+    if (!Ind.m_Step.isOne() || Ind.m_ComparesNext)
+      return false;
+    if (Pred != ICmpInst::ICMP_SLT && Pred != ICmpInst::ICMP_ULT)
+      return false;
+  }
+  // The exit is reached from the tile loops after tiling, values computed
+  // in the nest don't reach it any more
+  const UnitInduction& Outer = Nest.m_Inds[0];
+  for (PHINode& Phi : Outer.m_ExitBlock->phis()) {
+    if (!Nest.isInvariant(Phi.getIncomingValueForBlock(Outer.m_ExitingBlock)))
+      return false;
+  }
+  return true;
+}
+
+/// Whether the loops of the nest are fully permutable, i.e. no dependence
+/// runs backwards at any level once it is oriented forwards. Tiling all
+/// levels is legal then.
+static bool isFullyPermutable(const std::vector<DirectionVector>& Deps) {
+  for (const DirectionVector& Dep : Deps) {
+    // Enumerate the plain direction vectors the dependence stands for
+    std::vector<DirectionVector> Work = {DirectionVector()};
+    for (unsigned Dirs : Dep) {
+      std::vector<DirectionVector> Next;
+      for (const DirectionVector& V : Work) {
+        for (unsigned Dir : {DirLT, DirEQ, DirGT}) {
+          if (Dirs & Dir) {
+            Next.push_back(V);
+            Next.back().push_back(Dir);
+          }
+        }
+      }
+      Work = std::move(Next);
+    }
+
+    for (const DirectionVector& V : Work) {
+      // Loop independent dependences stay inside one iteration of the tile
+      auto Lead = std::find_if(V.begin(), V.end(), [](unsigned Dir) { return Dir != DirEQ; });
+      if (Lead == V.end())
+        continue;
+      // The same dependence seen from the other access
+      unsigned Backward = *Lead == DirGT ? DirLT : DirGT;
+      if (std::find(Lead, V.end(), Backward) != V.end())
+        return false;
+    }
+  }
+  return true;
+}
+
+/// Whether some loop other than the innermost one carries reuse the tiles
+/// can keep in the cache: an access that stays on the same line across its
+/// iterations
+static bool hasOuterReuse(const LoopNest& Nest) {
+  for (const NestAccess& A : Nest.m_Accesses) {
+    for (unsigned Level = 0; Level + 1 < Nest.getDepth(); Level++) {
+      if (getAccessStride(A, Level) < CacheLineSize)
+        return true;
+    }
+  }
+  return false;
+}
+
+/// Bytes of the cache lines the accesses of the nest touch during a tile
+/// with Sizes iterations per level. Accesses to the same address are counted
+/// once.
+static uint64_t getFootprint(const LoopNest& Nest, const std::vector<uint64_t>& Sizes) {
+  std::unordered_set<Value*> Seen;
+  uint64_t Bytes = 0;
+  for (const NestAccess& A : Nest.m_Accesses) {
+    if (!Seen.insert(getLoadStorePointerOperand(A.m_Inst)).second)
+      continue;
+    // The level with the smallest stride below a line walks along lines,
+    // every other level the access varies with moves to other lines
+    Optional<unsigned> Contiguous;
+    uint64_t Lines = 1;
+    for (unsigned Level = 0; Level < Nest.getDepth(); Level++) {
+      bool Varies = false;
+      for (const Subscript& S : A.m_Subscripts)
+        Varies |= !S.m_Known || S.m_Coeffs[Level];
+      if (!Varies)
+        continue;
+      uint64_t Stride = getAccessStride(A, Level);
+      if (Stride < CacheLineSize && (!Contiguous || Stride < getAccessStride(A, *Contiguous))) {
+        if (Contiguous)
+          Lines *= Sizes[*Contiguous];
+        Contiguous = Level;
+      } else {
+        Lines *= Sizes[Level];
+      }
+    }
+    uint64_t LineBytes = CacheLineSize;
+    if (Contiguous)
+      LineBytes = std::max(alignTo(Sizes[*Contiguous] * getAccessStride(A, *Contiguous), CacheLineSize), CacheLineSize);
+    Bytes += Lines * LineBytes;
+  }
+  return Bytes;
+}
+
+/// Iterations per tile of every level, innermost levels sized so a tile
+/// fits in half of L1 and the outermost one so a row of tiles fits in half
+/// of L2. Returns an empty vector if not even the smallest tiles fit.
+static std::vector<uint64_t> getTileSizes(const LoopNest& Nest, uint64_t L1Size, uint64_t L2Size) {
+  std::vector<uint64_t> Sizes(Nest.getDepth(), MinTileSize);
+  if (getFootprint(Nest, Sizes) > L1Size / 2)
+    return {};
+  for (uint64_t T = MinTileSize * 2; T <= MaxTileSize; T *= 2) {
+    std::vector<uint64_t> Larger(Nest.getDepth(), T);
+    if (getFootprint(Nest, Larger) > L1Size / 2)
+      break;
+    Sizes = Larger;
+  }
+  while (Sizes[0] < MaxTileSize) {
+    std::vector<uint64_t> Larger = Sizes;
+    Larger[0] *= 2;
+    if (getFootprint(Nest, Larger) > L2Size / 2)
+      break;
+    Sizes = Larger;
+  }
+  return Sizes;
+}
+
+/// Strip-mine every loop of the nest and place the loops over the tiles,
+/// in the order of the nest, in front of the original outermost loop. The
+/// original loops then run from the start of their tile to its end.
+static void tileNest(LoopNest& Nest, const std::vector<uint64_t>& Sizes) {
+  unsigned Depth = Nest.getDepth();
+  BasicBlock* Header = Nest.getOutermost().m_Header;
+  BasicBlock* Entering = Nest.getOutermost().getLoopPredecessor();
+  BasicBlock* Exit = Nest.m_Inds[0].m_ExitBlock;
+  Function* F = Header->getParent();
+  LLVMContext& Ctx = F->getContext();
+
+  // Blocks of the tile loop at every level: the header tests the tile start
+  // against the bound, the body computes the end of the tile and the latch
+  // moves on to the next tile
+  std::vector<BasicBlock*> TileHeaders, TileBodies, TileLatches;
+  for (unsigned Level = 0; Level < Depth; Level++) {
+    TileHeaders.push_back(BasicBlock::Create(Ctx, "tile.header", F, Header));
+    TileBodies.push_back(BasicBlock::Create(Ctx, "tile.body", F, Header));
+    TileLatches.push_back(BasicBlock::Create(Ctx, "tile.latch", F, Header));
+  }
+
+  std::vector<PHINode*> TileStarts;
+  std::vector<Value*> TileEnds;
+  for (unsigned Level = 0; Level < Depth; Level++) {
+    UnitInduction& Ind = Nest.m_Inds[Level];
+    Type* Ty = Ind.m_IV->getType();
+    ICmpInst::Predicate Pred = Ind.m_ExitOnTrue ? ICmpInst::getInversePredicate(Ind.m_Pred) : Ind.m_Pred;
+
+    IRBuilder<> Builder(TileHeaders[Level]);
+    PHINode* Start = Builder.CreatePHI(Ty, 2, Ind.m_IV->getName() + ".tile");
+    Start->addIncoming(Ind.m_Start, Level == 0 ? Entering : TileBodies[Level - 1]);
+    Value* Cond = Builder.CreateICmp(Pred, Start, Ind.m_Bound, "tile.cond");
+    Builder.CreateCondBr(Cond, TileBodies[Level], Level == 0 ? Exit : TileLatches[Level - 1]);
+
+    // min(Start + Size, Bound), without letting Start + Size wrap around
+    Builder.SetInsertPoint(TileBodies[Level]);
+    Value* Size = ConstantInt::get(Ty, Sizes[Level]);
+    Value* Left = Builder.CreateSub(Ind.m_Bound, Start, "tile.left");
+    Value* Full = Builder.CreateICmpUGT(Left, Size, "tile.full");
+    Value* Next = Builder.CreateAdd(Start, Size, "tile.next");
+    Value* End = Builder.CreateSelect(Full, Next, Ind.m_Bound, "tile.end");
+    Builder.CreateBr(Level + 1 < Depth ? TileHeaders[Level + 1] : Header);
+
+    Builder.SetInsertPoint(TileLatches[Level]);
+    Builder.CreateBr(TileHeaders[Level]);
+    Start->addIncoming(End, TileLatches[Level]);
+    TileStarts.push_back(Start);
+    TileEnds.push_back(End);
+  }
+
+  // Enter the tile loops instead of the nest, and leave them instead of it
+  Entering->getTerminator()->replaceSuccessorWith(Header, TileHeaders[0]);
+  Header->replacePhiUsesWith(Entering, TileBodies[Depth - 1]);
+  Nest.m_Inds[0].m_ExitingBlock->getTerminator()->replaceSuccessorWith(Exit, TileLatches[Depth - 1]);
+  Exit->replacePhiUsesWith(Nest.m_Inds[0].m_ExitingBlock, TileHeaders[0]);
+
+  // Run every original loop over its tile only
+  for (unsigned Level = 0; Level < Depth; Level++) {
+    UnitInduction& Ind = Nest.m_Inds[Level];
+    BasicBlock* Pred = Level == 0 ? TileBodies[Depth - 1] : Nest.m_Loops[Level]->getLoopPredecessor();
+    Ind.m_IV->setIncomingValueForBlock(Pred, TileStarts[Level]);
+    Ind.m_Cmp->replaceUsesOfWith(Ind.m_Bound, TileEnds[Level]);
+  }
+}
+
+/// Main function for running the tiling
+PreservedAnalyses UnitTile::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitTile running on " << F.getName() << "\n";
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  AAResults& AA = FAM.getResult<AAManager>(F);
+  const DataLayout& DL = F.getParent()->getDataLayout();
+
+  std::vector<UnitLoop> AllLoops = Loops.getLoops(F);
+  std::unordered_map<BasicBlock*, const UnitLoop*> LoopOfHeader;
+  for (const UnitLoop& L : AllLoops)
+    LoopOfHeader[L.m_Header] = &L;
+
+  // Outermost loops first, a nest is only tiled as a whole
+  std::unordered_set<BasicBlock*> InNest;
+  bool Changed = false;
+  for (auto it = AllLoops.rbegin(); it != AllLoops.rend(); ++it) {
+    LoopNest Nest;
+    if (InNest.count(it->m_Header) || !buildPerfectNest(*it, LoopOfHeader, MaxNestDepth, DL, Nest))
+      continue;
+    for (const UnitLoop* L : Nest.m_Loops)
+      InNest.insert(L->m_Header);
+    if (Nest.getDepth() < 2 || !isTileable(Nest) || !hasOuterReuse(Nest))
+      continue;
+    if (!isFullyPermutable(getNestDependences(Nest, AA)))
+      continue;
+    std::vector<uint64_t> Sizes = getTileSizes(Nest, m_L1Size, m_L2Size);
+    if (Sizes.empty())
+      continue;
+
+    dbgs() << "[UnitTile] Tiling nest at " << it->m_Header->getName() << " with tiles";
+    for (uint64_t Size : Sizes)
+      dbgs() << " " << Size;
+    dbgs() << "\n";
+    tileNest(Nest, Sizes);
+    NumNestsTiled++;
+    NumLoopsTiled += Nest.getDepth();
+    Changed = true;
+  }
+
+  // New loops around the nests
+  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
@@ -0,0 +1,24 @@
+#ifndef INCLUDE_UNIT_TILE_H
+#define INCLUDE_UNIT_TILE_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop Tiling Pass. Strip-mines every loop of a perfect, rectangular nest
+/// and moves the loops over the tiles outside of the original nest, so the
+/// data a tile touches stays in the cache while the tile runs. Tile sizes
+/// follow a simple model of the L1 and L2 caches.
+struct UnitTile : PassInfoMixin<UnitTile> {
+  UnitTile(uint64_t L1Size = 32768, uint64_t L2Size = 262144) : m_L1Size(L1Size), m_L2Size(L2Size) {}
+
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+
+  // Size of the L1 data cache in bytes, the inner tiles fit half of it
+  uint64_t m_L1Size;
+  // Size of the L2 cache in bytes, the outermost tiles fit half of it
+  uint64_t m_L2Size;
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_TILE_H
@@ -0,0 +1,276 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-unroll"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include <memory>
+
+#include "UnitLoopInfo.h"
+#include "UnitUnroll.h"
+
+#define DEBUG_TYPE "UnitUnroll"
+// Define any statistics here
+STATISTIC(NumFullyUnrolled, "Number of loops fully unrolled");
+STATISTIC(NumPartiallyUnrolled, "Number of loops partially unrolled");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+/// The copies of a loop body made while unrolling. Copy 0 is the original
+/// loop, every further copy has its own value map.
+class LoopCopies {
+public:
+  LoopCopies(const UnitLoop& L) : m_Loop(L) { m_Maps.emplace_back(nullptr); }
+
+  unsigned size() const { return m_Maps.size(); }
+
+  Value* map(unsigned Copy, Value* V) const {
+    if (Copy == 0)
+      return V;
+    auto it = m_Maps[Copy]->find(V);
+    return it == m_Maps[Copy]->end() ? V : (Value*)it->second;
+  }
+  BasicBlock* map(unsigned Copy, BasicBlock* BB) const {
+    return cast<BasicBlock>(map(Copy, (Value*)BB));
+  }
+
+  // Clone the loop once more. Its header PHIs are replaced by HeaderValues
+  // (indexed like the PHIs), and its back edge still points to its own header.
+  unsigned addCopy(const std::vector<Value*>& HeaderValues, const Twine& Suffix);
+
+private:
+  const UnitLoop& m_Loop;
+  std::vector<std::unique_ptr<ValueToValueMapTy>> m_Maps;
+};
+} // namespace
+
+unsigned LoopCopies::addCopy(const std::vector<Value*>& HeaderValues, const Twine& Suffix) {
+  m_Maps.push_back(std::make_unique<ValueToValueMapTy>());
+  ValueToValueMapTy& VMap = *m_Maps.back();
+  std::vector<BasicBlock*> NewBlocks;
+  for (BasicBlock* BB : m_Loop.m_Blocks) {
+    BasicBlock* NewBB = CloneBasicBlock(BB, VMap, Suffix, BB->getParent());
+    VMap[BB] = NewBB;
+    NewBlocks.push_back(NewBB);
+  }
+
+  std::vector<PHINode*> ClonedPHIs;
+  unsigned i = 0;
+  for (PHINode& PN : m_Loop.m_Header->phis()) {
+    ClonedPHIs.push_back(cast<PHINode>(VMap[&PN]));
+    VMap[&PN] = HeaderValues[i++];
+  }
+  for (BasicBlock* BB : NewBlocks) {
+    for (Instruction& I : *BB)
+      RemapInstruction(&I, VMap, RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+  }
+  for (PHINode* PN : ClonedPHIs)
+    PN->eraseFromParent();
+  return m_Maps.size() - 1;
+}
+
+// The values the header PHIs take in the iteration after copy Copy
+static std::vector<Value*> getNextHeaderValues(const UnitLoop& L, const LoopCopies& Copies, unsigned Copy) {
+  std::vector<Value*> Values;
+  for (PHINode& PN : L.m_Header->phis())
+    Values.push_back(Copies.map(Copy, PN.getIncomingValueForBlock(L.getLatch())));
+  return Values;
+}
+
+/// Replace L by HeaderCount straight-line copies of its body. Each copy's exit
+/// test is resolved statically: only the last one leaves the loop.
+static void unrollFully(const UnitLoop& L, const UnitInduction& Ind, uint64_t HeaderCount) {
+  BasicBlock* Header = L.m_Header;
+  BasicBlock* Latch = L.getLatch();
+  BasicBlock* Preheader = L.getPreheader();
+
+  // Uses outside the loop observe the values of the last iteration
+  std::vector<Use*> OutsideUses;
+  for (BasicBlock* BB : L.m_Blocks) {
+    for (Instruction& I : *BB) {
+      for (Use& U : I.uses()) {
+        if (!L.contains(cast<Instruction>(U.getUser())->getParent()))
+          OutsideUses.push_back(&U);
+      }
+    }
+  }
+
+  // All copies are cloned from the untouched loop before the back edges are
+  // chained, so every copy's latch still branches to its own header
+  LoopCopies Copies(L);
+  for (uint64_t k = 1; k < HeaderCount; k++)
+    Copies.addCopy(getNextHeaderValues(L, Copies, k - 1), ".unroll" + Twine(k));
+  for (unsigned k = 1; k < Copies.size(); k++) {
+    Copies.map(k - 1, Latch)->getTerminator()->replaceSuccessorWith(Copies.map(k - 1, Header),
+                                                                      Copies.map(k, Header));
+  }
+
+  for (unsigned k = 0; k < Copies.size(); k++) {
+    BasicBlock* Exiting = Copies.map(k, Ind.m_ExitingBlock);
+    auto* BI = cast<BranchInst>(Exiting->getTerminator());
+    BasicBlock* Target = BI->getSuccessor(0) == Ind.m_ExitBlock ? BI->getSuccessor(1) : BI->getSuccessor(0);
+    if (k == Copies.size() - 1)
+      Target = Ind.m_ExitBlock;
+    BranchInst::Create(Target, Exiting);
+    BI->eraseFromParent();
+  }
+
+  unsigned Last = Copies.size() - 1;
+  for (Use* U : OutsideUses)
+    U->set(Copies.map(Last, U->get()));
+  for (PHINode& PN : Ind.m_ExitBlock->phis()) {
+    int Idx = PN.getBasicBlockIndex(Ind.m_ExitingBlock);
+    PN.setIncomingBlock(Idx, Copies.map(Last, Ind.m_ExitingBlock));
+  }
+  // The original header now only runs once, coming from the preheader
+  for (PHINode& PN : make_early_inc_range(Header->phis())) {
+    PN.replaceAllUsesWith(PN.getIncomingValueForBlock(Preheader));
+    PN.eraseFromParent();
+  }
+}
+
+// Build the test that at least Factor more iterations of a loop counted by
+// Ind run, starting with the induction variable at IV
+static Value* createEnoughIterationsCheck(const UnitInduction& Ind, Value* IV, unsigned Factor,
+                                          BasicBlock* InsertAtEnd) {
+  ICmpInst::Predicate ContinuePred = Ind.m_ExitOnTrue ? ICmpInst::getInversePredicate(Ind.m_Pred) : Ind.m_Pred;
+  bool Inclusive = false;
+  if (Ind.m_Step.isOne()) {
+    if (ContinuePred == ICmpInst::ICMP_SLE || ContinuePred == ICmpInst::ICMP_ULE)
+      Inclusive = true;
+    else if (ContinuePred != ICmpInst::ICMP_SLT && ContinuePred != ICmpInst::ICMP_ULT &&
+             ContinuePred != ICmpInst::ICMP_NE)
+      return nullptr;
+  } else if (Ind.m_Step.isAllOnes()) {
+    if (ContinuePred == ICmpInst::ICMP_SGE || ContinuePred == ICmpInst::ICMP_UGE)
+      Inclusive = true;
+    else if (ContinuePred != ICmpInst::ICMP_SGT && ContinuePred != ICmpInst::ICMP_UGT &&
+             ContinuePred != ICmpInst::ICMP_NE)
+      return nullptr;
+  } else {
+    return nullptr;
+  }
+
+  // Once the original test passes, the distance to the bound is the number of
+  // iterations left (minus one if the bound itself is included); computing it
+  // unsigned can't overflow
+  auto* InRange = new ICmpInst(*InsertAtEnd, ContinuePred, IV, Ind.m_Bound, "unroll.inrange");
+  Value* Distance = Ind.m_Step.isOne()
+                        ? BinaryOperator::CreateSub(Ind.m_Bound, IV, "unroll.distance", InsertAtEnd)
+                        : BinaryOperator::CreateSub(IV, Ind.m_Bound, "unroll.distance", InsertAtEnd);
+  auto* Needed = ConstantInt::get(IV->getType(), Inclusive ? Factor - 2 : Factor - 1);
+  auto* Enough = new ICmpInst(*InsertAtEnd, ICmpInst::ICMP_UGT, Distance, Needed, "unroll.enough");
+  return BinaryOperator::CreateAnd(InRange, Enough, "unroll.check", InsertAtEnd);
+}
+
+/// Put a loop running Factor copies of the body per iteration in front of L,
+/// as long as at least Factor iterations are left. L itself then runs the
+/// remaining iterations.
+static bool unrollPartially(const UnitLoop& L, const UnitInduction& Ind, unsigned Factor) {
+  BasicBlock* Header = L.m_Header;
+  BasicBlock* Preheader = L.getPreheader();
+  // The exit test has to be on the header PHI at the top of the loop, so the
+  // remainder loop can be entered with the header PHIs' current values
+  if (Ind.m_ExitingBlock != Header || Ind.m_ComparesNext)
+    return false;
+
+  Function* F = Header->getParent();
+  BasicBlock* MainHeader = BasicBlock::Create(F->getContext(), Header->getName() + ".unroll", F, Header);
+  std::vector<Value*> MainPHIs;
+  Value* MainIV = nullptr;
+  for (PHINode& PN : Header->phis()) {
+    PHINode* MainPN = PHINode::Create(PN.getType(), 2, PN.getName() + ".unroll", MainHeader);
+    MainPN->addIncoming(PN.getIncomingValueForBlock(Preheader), Preheader);
+    MainPHIs.push_back(MainPN);
+    if (&PN == Ind.m_IV)
+      MainIV = MainPN;
+  }
+  Value* Check = createEnoughIterationsCheck(Ind, MainIV, Factor, MainHeader);
+  if (!Check) {
+    for (Value* PN : MainPHIs)
+      cast<PHINode>(PN)->dropAllReferences();
+    MainHeader->eraseFromParent();
+    return false;
+  }
+
+  LoopCopies Copies(L);
+  std::vector<unsigned> CopyIds;
+  std::vector<Value*> HeaderValues = MainPHIs;
+  for (unsigned j = 0; j < Factor; j++) {
+    unsigned Copy = Copies.addCopy(HeaderValues, ".unroll" + Twine(j));
+    CopyIds.push_back(Copy);
+    HeaderValues = getNextHeaderValues(L, Copies, Copy);
+
+    // Enough iterations are left, so the copied exit test always stays in
+    BasicBlock* CopyHeader = Copies.map(Copy, Header);
+    auto* BI = cast<BranchInst>(CopyHeader->getTerminator());
+    BranchInst::Create(Copies.map(Copy, Ind.m_InLoopSucc), CopyHeader);
+    BI->eraseFromParent();
+    if (j > 0) {
+      Copies.map(Copy - 1, L.getLatch())->getTerminator()->replaceSuccessorWith(
+          Copies.map(Copy - 1, Header), CopyHeader);
+    }
+  }
+  unsigned Last = CopyIds.back();
+  BasicBlock* LastLatch = Copies.map(Last, L.getLatch());
+  LastLatch->getTerminator()->replaceSuccessorWith(Copies.map(Last, Header), MainHeader);
+  for (unsigned i = 0; i < MainPHIs.size(); i++)
+    cast<PHINode>(MainPHIs[i])->addIncoming(HeaderValues[i], LastLatch);
+  BranchInst::Create(Copies.map(CopyIds.front(), Header), Header, Check, MainHeader);
+
+  // The original loop is now the remainder loop, entered from the main loop
+  Preheader->getTerminator()->replaceSuccessorWith(Header, MainHeader);
+  unsigned i = 0;
+  for (PHINode& PN : Header->phis()) {
+    int Idx = PN.getBasicBlockIndex(Preheader);
+    PN.setIncomingBlock(Idx, MainHeader);
+    PN.setIncomingValue(Idx, MainPHIs[i++]);
+  }
+  return true;
+}
+
+/// Main function for running the unrolling
+PreservedAnalyses UnitUnroll::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitUnroll running on " << F.getName() << "\n";
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+
+  // Innermost loops don't overlap, so all of them can be unrolled based on
+  // the same loop information
+  bool Changed = false;
+  bool LeftUnreachable = false;
+  for (const UnitLoop& L : Loops.getLoops(F)) {
+    UnitInduction Ind;
+    if (!L.isInnermost() || !L.getPreheader() || !analyzeInduction(L, Ind) || !L.isSafeToClone())
+      continue;
+    unsigned Size = L.getSize();
+
+    Optional<uint64_t> HeaderCount = Ind.getConstantHeaderCount(m_FullThreshold / Size);
+    if (HeaderCount && *HeaderCount * Size <= m_FullThreshold) {
+      dbgs() << "[UnitUnroll] Fully unrolling loop " << L.m_Header->getName() << " (" << *HeaderCount
+             << " copies)\n";
+      unrollFully(L, Ind, *HeaderCount);
+      NumFullyUnrolled++;
+      Changed = LeftUnreachable = true;
+      continue;
+    }
+
+    // Innermost loops are where the time goes, give them a wider body
+    if (m_PartialFactor > 1 && Size * m_PartialFactor <= m_PartialThreshold &&
+        unrollPartially(L, Ind, m_PartialFactor)) {
+      dbgs() << "[UnitUnroll] Unrolled loop " << L.m_Header->getName() << " by " << m_PartialFactor << "\n";
+      NumPartiallyUnrolled++;
+      Changed = true;
+    }
+  }
+  // The exit tests resolved by full unrolling leave dead copies behind
+  if (LeftUnreachable)
+    removeUnreachableBlocks(F);
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  return PreservedAnalyses::none();
+}
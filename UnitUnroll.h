@@ -0,0 +1,26 @@
+#ifndef INCLUDE_UNIT_UNROLL_H
+#define INCLUDE_UNIT_UNROLL_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop Unrolling Pass. Fully unrolls innermost loops with a small constant
+/// trip count and partially unrolls the other innermost counted loops,
+/// leaving the original loop behind as the remainder loop.
+struct UnitUnroll : PassInfoMixin<UnitUnroll> {
+  UnitUnroll(unsigned FullThreshold = 256, unsigned PartialFactor = 4, unsigned PartialThreshold = 128)
+      : m_FullThreshold(FullThreshold), m_PartialFactor(PartialFactor), m_PartialThreshold(PartialThreshold) {}
+
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+
+  // Largest size (in instructions) of a fully unrolled loop
+  unsigned m_FullThreshold;
+  // Number of copies of the body per iteration of a partially unrolled loop
+  unsigned m_PartialFactor;
+  // Largest size (in instructions) of a partially unrolled body
+  unsigned m_PartialThreshold;
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_UNROLL_H
@@ -0,0 +1,264 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-unswitch"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include <algorithm>
+
+#include "UnitLoopInfo.h"
+#include "UnitUnswitch.h"
+
+#define DEBUG_TYPE "UnitUnswitch"
+// Define any statistics here
+STATISTIC(NumBranchesUnswitched, "Number of invariant branches unswitched");
+STATISTIC(NumSwitchesUnswitched, "Number of invariant switch cases unswitched");
+STATISTIC(NumSelectsUnswitched, "Number of invariant selects unswitched");
+STATISTIC(NumConditionsHoisted, "Number of condition instructions hoisted to a preheader");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// A branch, switch or select in a loop that decides on a loop-invariant value
+struct Candidate {
+  Instruction* m_Inst = nullptr;
+  Value* m_Cond = nullptr;
+  // The case split off a switch
+  ConstantInt* m_CaseValue = nullptr;
+  // Instructions of the loop computing m_Cond, operands first
+  std::vector<Instruction*> m_Hoist;
+};
+
+// How deep a condition computed inside the loop is followed to its invariant
+// operands
+const unsigned MaxHoistDepth = 4;
+} // namespace
+
+/// Whether V has the same value in every iteration of L. Conditions computed
+/// inside the loop count as long as they can be hoisted to the preheader,
+/// which is where the instructions collected in Hoist will go.
+static bool isInvariant(const UnitLoop& L, Value* V, std::vector<Instruction*>& Hoist, unsigned Depth = 0) {
+  auto* I = dyn_cast<Instruction>(V);
+  if (!I || !L.contains(I->getParent()))
+    return true;
+  if (std::find(Hoist.begin(), Hoist.end(), I) != Hoist.end())
+    return true;
+  if (Depth == MaxHoistDepth || isa<PHINode>(I) || I->mayReadFromMemory() || !isSafeToSpeculativelyExecute(I))
+    return false;
+  for (Value* Op : I->operands()) {
+    if (!isInvariant(L, Op, Hoist, Depth + 1))
+      return false;
+  }
+  Hoist.push_back(I);
+  return true;
+}
+
+static bool findCandidate(const UnitLoop& L, Candidate& C) {
+  for (BasicBlock* BB : L.m_Blocks) {
+    for (Instruction& I : *BB) {
+      Value* Cond = nullptr;
+      if (auto* BI = dyn_cast<BranchInst>(&I)) {
+        if (BI->isConditional() && BI->getSuccessor(0) != BI->getSuccessor(1))
+          Cond = BI->getCondition();
+      } else if (auto* SI = dyn_cast<SwitchInst>(&I)) {
+        if (SI->getNumCases() > 0)
+          Cond = SI->getCondition();
+      } else if (auto* Sel = dyn_cast<SelectInst>(&I)) {
+        if (Sel->getCondition()->getType()->isIntegerTy(1) && Sel->getTrueValue() != Sel->getFalseValue())
+          Cond = Sel->getCondition();
+      }
+      // Constant conditions are left to UnitSCCP
+      if (!Cond || isa<Constant>(Cond))
+        continue;
+
+      C.m_Hoist.clear();
+      if (!isInvariant(L, Cond, C.m_Hoist))
+        continue;
+      C.m_Inst = &I;
+      C.m_Cond = Cond;
+      if (auto* SI = dyn_cast<SwitchInst>(&I))
+        C.m_CaseValue = SI->case_begin()->getCaseValue();
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Replace the terminator Term by a branch to Target, dropping its other edges
+static void foldTerminator(Instruction* Term, BasicBlock* Target) {
+  BasicBlock* BB = Term->getParent();
+  bool KeptTarget = false;
+  for (BasicBlock* Succ : successors(BB)) {
+    if (Succ == Target && !KeptTarget)
+      KeptTarget = true;
+    else
+      Succ->removePredecessor(BB, /*KeepOneInputPHIs=*/true);
+  }
+  BranchInst::Create(Target, BB);
+  Term->eraseFromParent();
+}
+
+/// Clone L and branch from its preheader on Cond: the original loop runs when
+/// Cond is true, the clone when it is false. Both versions get a preheader of
+/// their own so they can be unswitched again later.
+static void versionLoop(const UnitLoop& L, Value* Cond, ValueToValueMapTy& VMap) {
+  BasicBlock* Header = L.m_Header;
+  BasicBlock* Preheader = L.getPreheader();
+  Function* F = Header->getParent();
+  LLVMContext& Ctx = F->getContext();
+
+  // Uses of loop values after the loop will see either version's value
+  std::vector<std::pair<Instruction*, std::vector<Use*>>> LiveOuts;
+  for (BasicBlock* BB : L.m_Blocks) {
+    for (Instruction& I : *BB) {
+      std::vector<Use*> Uses;
+      for (Use& U : I.uses()) {
+        auto* User = cast<Instruction>(U.getUser());
+        if (auto* PN = dyn_cast<PHINode>(User); PN && L.contains(PN->getIncomingBlock(U)))
+          continue;
+        if (!L.contains(User->getParent()))
+          Uses.push_back(&U);
+      }
+      if (!Uses.empty())
+        LiveOuts.push_back({&I, Uses});
+    }
+  }
+
+  std::vector<BasicBlock*> NewBlocks;
+  for (BasicBlock* BB : L.m_Blocks) {
+    BasicBlock* NewBB = CloneBasicBlock(BB, VMap, ".us", F);
+    VMap[BB] = NewBB;
+    NewBlocks.push_back(NewBB);
+  }
+  for (BasicBlock* BB : NewBlocks) {
+    for (Instruction& I : *BB)
+      RemapInstruction(&I, VMap, RF_NoModuleLevelChanges | RF_IgnoreMissingLocals);
+  }
+
+  for (BasicBlock* Exit : L.getExitBlocks()) {
+    for (PHINode& PN : Exit->phis()) {
+      for (unsigned i = 0, e = PN.getNumIncomingValues(); i < e; i++) {
+        BasicBlock* In = PN.getIncomingBlock(i);
+        if (!L.contains(In))
+          continue;
+        Value* V = PN.getIncomingValue(i);
+        if (Value* NewV = VMap.lookup(V))
+          V = NewV;
+        PN.addIncoming(V, cast<BasicBlock>(VMap[In]));
+      }
+    }
+  }
+  for (auto& [I, Uses] : LiveOuts) {
+    auto* NewI = cast<Instruction>(VMap[I]);
+    SSAUpdater SSA;
+    SSA.Initialize(I->getType(), I->getName());
+    SSA.AddAvailableValue(I->getParent(), I);
+    SSA.AddAvailableValue(NewI->getParent(), NewI);
+    for (Use* U : Uses)
+      SSA.RewriteUse(*U);
+  }
+
+  auto* NewHeader = cast<BasicBlock>(VMap[Header]);
+  BasicBlock* Entry = BasicBlock::Create(Ctx, Header->getName() + ".ph", F, Header);
+  BasicBlock* NewEntry = BasicBlock::Create(Ctx, NewHeader->getName() + ".ph", F, NewHeader);
+  BranchInst::Create(Header, Entry);
+  BranchInst::Create(NewHeader, NewEntry);
+  for (PHINode& PN : Header->phis())
+    PN.replaceIncomingBlockWith(Preheader, Entry);
+  for (PHINode& PN : NewHeader->phis())
+    PN.replaceIncomingBlockWith(Preheader, NewEntry);
+  Instruction* Term = Preheader->getTerminator();
+  BranchInst::Create(Entry, NewEntry, Cond, Term);
+  Term->eraseFromParent();
+}
+
+/// Move the candidate out of L, leaving a version of L for each outcome
+static void unswitch(const UnitLoop& L, Candidate& C) {
+  Instruction* PreheaderTerm = L.getPreheader()->getTerminator();
+  for (Instruction* I : C.m_Hoist) {
+    I->moveBefore(PreheaderTerm);
+    NumConditionsHoisted++;
+  }
+
+  // The loop may not have reached the condition, so branching on undef or
+  // poison up front would be undefined where the loop was not
+  Value* Cond = C.m_Cond;
+  if (!isGuaranteedNotToBeUndefOrPoison(Cond, nullptr, PreheaderTerm))
+    Cond = new FreezeInst(Cond, Cond->getName() + ".fr", PreheaderTerm);
+
+  // A switch is split into the case with the first value, taken by the
+  // original loop, and all the others, taken by the clone
+  if (C.m_CaseValue)
+    Cond = new ICmpInst(PreheaderTerm, ICmpInst::ICMP_EQ, Cond, C.m_CaseValue, "unswitch.case");
+
+  ValueToValueMapTy VMap;
+  versionLoop(L, Cond, VMap);
+  auto* NewInst = cast<Instruction>(VMap[C.m_Inst]);
+
+  if (auto* BI = dyn_cast<BranchInst>(C.m_Inst)) {
+    foldTerminator(BI, BI->getSuccessor(0));
+    foldTerminator(NewInst, cast<BranchInst>(NewInst)->getSuccessor(1));
+    NumBranchesUnswitched++;
+  } else if (auto* SI = dyn_cast<SwitchInst>(C.m_Inst)) {
+    foldTerminator(SI, SI->findCaseValue(C.m_CaseValue)->getCaseSuccessor());
+    auto* NewSI = cast<SwitchInst>(NewInst);
+    auto Case = NewSI->findCaseValue(C.m_CaseValue);
+    Case->getCaseSuccessor()->removePredecessor(NewSI->getParent(), /*KeepOneInputPHIs=*/true);
+    NewSI->removeCase(Case);
+    NumSwitchesUnswitched++;
+  } else {
+    auto* Sel = cast<SelectInst>(C.m_Inst);
+    auto* NewSel = cast<SelectInst>(NewInst);
+    Sel->replaceAllUsesWith(Sel->getTrueValue());
+    Sel->eraseFromParent();
+    NewSel->replaceAllUsesWith(NewSel->getFalseValue());
+    NewSel->eraseFromParent();
+    NumSelectsUnswitched++;
+  }
+}
+
+/// Main function for running the unswitching
+PreservedAnalyses UnitUnswitch::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitUnswitch running on " << F.getName() << "\n";
+
+  // Every unswitch changes the loop structure, so one condition is moved per
+  // round and the loops are identified again. Innermost loops come first,
+  // they are where the branches cost the most.
+  unsigned Budget = m_Budget;
+  bool Changed = false;
+  while (true) {
+    UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+    bool Unswitched = false;
+    for (const UnitLoop& L : Loops.getLoops(F)) {
+      unsigned Size = L.getSize();
+      if (Size > Budget || !L.getPreheader() || !L.isSafeToClone())
+        continue;
+      Candidate C;
+      if (!findCandidate(L, C))
+        continue;
+
+      dbgs() << "[UnitUnswitch] Unswitching " << *C.m_Inst << " out of loop " << L.m_Header->getName() << "\n";
+      unswitch(L, C);
+      Budget -= Size;
+      Unswitched = true;
+      break;
+    }
+    if (!Unswitched)
+      break;
+
+    // Each version still holds the blocks only the other one can reach
+    removeUnreachableBlocks(F);
+    FAM.invalidate(F, PreservedAnalyses::none());
+    Changed = true;
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  return PreservedAnalyses::none();
+}
@@ -0,0 +1,21 @@
+#ifndef INCLUDE_UNIT_UNSWITCH_H
+#define INCLUDE_UNIT_UNSWITCH_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop Unswitching Pass. Moves branches, switches and selects on
+/// loop-invariant conditions out of loops by keeping one version of the loop
+/// for each outcome of the condition.
+struct UnitUnswitch : PassInfoMixin<UnitUnswitch> {
+  UnitUnswitch(unsigned Budget = 400) : m_Budget(Budget) {}
+
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+
+  // Upper bound on the number of instructions all loop versions may add
+  unsigned m_Budget;
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_UNSWITCH_H
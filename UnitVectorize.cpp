@@ -0,0 +1,696 @@
+// Usage: opt -load-pass-plugin=libUnitProject.so -passes="unit-vectorize"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Analysis/VectorUtils.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#include "UnitLoopInfo.h"
+#include "UnitVectorize.h"
+
+#define DEBUG_TYPE "UnitVectorize"
+// Define any statistics here
+STATISTIC(NumLoopsVectorized, "Number of loops vectorized");
+STATISTIC(NumRuntimeChecks, "Number of runtime alias checks emitted");
+
+using namespace llvm;
+using namespace cs426;
+
+namespace {
+// Most iterations run by one vector iteration
+const unsigned MaxWidth = 16;
+// Most pairs of pointers checked for overlap before entering a vector loop
+const unsigned MaxRuntimeChecks = 8;
+
+/// How the lanes of a value of the vector loop relate to each other
+enum class Shape {
+  // The same value in every lane
+  Uniform,
+  // An integer that grows by one from lane to lane
+  Induction,
+  // A pointer that moves by one element from lane to lane
+  Consecutive,
+  // Anything else, computed with vector instructions
+  Vector,
+};
+
+struct ValueInfo {
+  Shape m_Shape = Shape::Uniform;
+  // For Induction, whether the lanes grow without signed/unsigned wrap
+  bool m_NSW = false;
+  bool m_NUW = false;
+};
+
+/// A header PHI accumulating m_Op over the iterations of the loop
+struct Reduction {
+  PHINode* m_Phi;
+  BinaryOperator* m_Op;
+  Value* m_Start;
+};
+
+/// A load or store of the loop that may take part in a runtime alias check
+struct MemAccess {
+  Value* m_Ptr;
+  bool m_IsWrite;
+  bool m_Consecutive;
+  uint64_t m_Size;
+};
+
+/// Vectorizes one loop. analyze() checks whether it can be done and
+/// collects what vectorize() needs.
+class LoopVectorizer {
+public:
+  LoopVectorizer(const UnitLoop& L, const UnitInduction& Ind, AAResults& AA, const DataLayout& DL)
+      : m_Loop(L), m_Ind(Ind), m_AA(AA), m_DL(DL) {}
+
+  bool analyze();
+
+  // Size in bits of the widest scalar the vector loop works on
+  unsigned getWidestType() const { return m_WidestType; }
+
+  // Put a loop running Width iterations at a time in front of the loop
+  void vectorize(unsigned Width);
+
+private:
+  bool collectBlocks(std::vector<BasicBlock*>& Blocks) const;
+  bool analyzeHeaderPHI(PHINode& Phi);
+  bool classify(Instruction* I);
+  bool addRuntimeChecks();
+
+  bool isInLoop(Value* V) const {
+    auto* I = dyn_cast<Instruction>(V);
+    return I && m_Loop.contains(I->getParent());
+  }
+  ValueInfo getInfo(Value* V) const {
+    auto it = m_Info.find(V);
+    return it == m_Info.end() ? ValueInfo() : it->second;
+  }
+  bool isSameAddress(Value* A, Value* B) const;
+  bool canExpand(Value* V) const;
+  Value* expandAt(Value* V, Value* IV, IRBuilder<>& Builder, DenseMap<Value*, Value*>& Expanded);
+
+  Value* getScalar(Value* V);
+  Value* getVector(Value* V);
+  void widen(Instruction* I);
+  Value* createReduce(const Reduction& R, Value* V);
+
+  const UnitLoop& m_Loop;
+  const UnitInduction& m_Ind;
+  AAResults& m_AA;
+  const DataLayout& m_DL;
+
+  ICmpInst::Predicate m_ContinuePred = ICmpInst::BAD_ICMP_PREDICATE;
+  // Instructions of the loop in execution order, except for the loop control
+  std::vector<Instruction*> m_Order;
+  DenseMap<Value*, ValueInfo> m_Info;
+  std::vector<Reduction> m_Reductions;
+  std::vector<MemAccess> m_Accesses;
+  // Pairs of m_Accesses that have to be checked for overlap
+  std::vector<std::pair<unsigned, unsigned>> m_Checks;
+  unsigned m_WidestType = 0;
+
+  // State of vectorize()
+  unsigned m_Width = 0;
+  IRBuilder<>* m_Builder = nullptr;
+  IRBuilder<>* m_PreBuilder = nullptr;
+  DenseMap<Value*, Value*> m_Scalars;
+  DenseMap<Value*, Value*> m_Vectors;
+};
+} // namespace
+
+/// The header followed by the other blocks of the loop, which have to form
+/// a straight line back to the header
+bool LoopVectorizer::collectBlocks(std::vector<BasicBlock*>& Blocks) const {
+  Blocks.push_back(m_Loop.m_Header);
+  for (BasicBlock* BB = m_Ind.m_InLoopSucc; BB != m_Loop.m_Header;) {
+    auto* BI = dyn_cast<BranchInst>(BB->getTerminator());
+    if (!BI || BI->isConditional() || !BB->getSinglePredecessor())
+      return false;
+    Blocks.push_back(BB);
+    BB = BI->getSuccessor(0);
+  }
+  return Blocks.size() == m_Loop.m_Blocks.size();
+}
+
+/// Accept the IV and reductions, PHIs the vector loop knows how to carry
+bool LoopVectorizer::analyzeHeaderPHI(PHINode& Phi) {
+  if (&Phi == m_Ind.m_IV) {
+    ValueInfo Info;
+    Info.m_Shape = Shape::Induction;
+    // The IV stays between its start and the bound while the loop runs
+    Info.m_NSW = m_ContinuePred == ICmpInst::ICMP_SLT || m_ContinuePred == ICmpInst::ICMP_SLE;
+    Info.m_NUW = m_ContinuePred == ICmpInst::ICMP_ULT || m_ContinuePred == ICmpInst::ICMP_ULE;
+    m_Info[&Phi] = Info;
+    return true;
+  }
+
+  auto* Op = dyn_cast<BinaryOperator>(Phi.getIncomingValueForBlock(m_Loop.getLatch()));
+  if (!Op || !isInLoop(Op) || (Op->getOperand(0) != &Phi) == (Op->getOperand(1) != &Phi))
+    return false;
+  switch (Op->getOpcode()) {
+  case Instruction::Add:
+  case Instruction::Mul:
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor:
+    break;
+  case Instruction::FAdd:
+  case Instruction::FMul:
+    // Accumulating in several lanes changes the order of the operations
+    if (!Op->hasAllowReassoc())
+      return false;
+    break;
+  default:
+    return false;
+  }
+  // Nothing else in the loop may look at the partial results
+  for (User* U : Phi.users()) {
+    if (U != Op && isInLoop(U))
+      return false;
+  }
+  for (User* U : Op->users()) {
+    if (U != &Phi)
+      return false;
+  }
+  ValueInfo Info;
+  Info.m_Shape = Shape::Vector;
+  m_Info[&Phi] = Info;
+  m_Reductions.push_back({&Phi, Op, Phi.getIncomingValueForBlock(m_Loop.getPreheader())});
+  return true;
+}
+
+/// Work out the shape of I in the vector loop, false if it can't be
+/// vectorized
+bool LoopVectorizer::classify(Instruction* I) {
+  ValueInfo Info;
+  bool AllUniform = true;
+  for (Value* Op : I->operands()) {
+    ValueInfo OpInfo = getInfo(Op);
+    // Consecutive pointers are only used as addresses of loads and stores
+    if (OpInfo.m_Shape == Shape::Consecutive && (!isa<LoadInst>(I) && !isa<StoreInst>(I)))
+      return false;
+    AllUniform &= OpInfo.m_Shape == Shape::Uniform;
+  }
+
+  if (auto* LI = dyn_cast<LoadInst>(I)) {
+    ValueInfo PtrInfo = getInfo(LI->getPointerOperand());
+    if (!LI->isSimple() || !VectorType::isValidElementType(LI->getType()))
+      return false;
+    uint64_t Size = m_DL.getTypeStoreSize(LI->getType());
+    m_Accesses.push_back({LI->getPointerOperand(), false, PtrInfo.m_Shape == Shape::Consecutive, Size});
+    if (PtrInfo.m_Shape == Shape::Uniform) {
+      m_Info[I] = Info;
+      return true;
+    }
+    if (PtrInfo.m_Shape != Shape::Consecutive)
+      return false;
+    Info.m_Shape = Shape::Vector;
+    m_Info[I] = Info;
+    return true;
+  }
+
+  if (auto* SI = dyn_cast<StoreInst>(I)) {
+    Type* Ty = SI->getValueOperand()->getType();
+    if (!SI->isSimple() || !VectorType::isValidElementType(Ty))
+      return false;
+    if (getInfo(SI->getPointerOperand()).m_Shape != Shape::Consecutive ||
+        getInfo(SI->getValueOperand()).m_Shape == Shape::Consecutive)
+      return false;
+    m_Accesses.push_back({SI->getPointerOperand(), true, true, m_DL.getTypeStoreSize(Ty)});
+    Info.m_Shape = Shape::Vector;
+    m_Info[I] = Info;
+    return true;
+  }
+
+  if (auto* GEP = dyn_cast<GetElementPtrInst>(I)) {
+    if (AllUniform) {
+      m_Info[I] = Info;
+      return true;
+    }
+    // Only the last index may move, by one element per iteration
+    for (unsigned i = 0; i + 1 < GEP->getNumOperands(); i++) {
+      if (getInfo(GEP->getOperand(i)).m_Shape != Shape::Uniform)
+        return false;
+    }
+    Value* Idx = GEP->getOperand(GEP->getNumOperands() - 1);
+    ValueInfo IdxInfo = getInfo(Idx);
+    if (GEP->getNumIndices() == 0 || IdxInfo.m_Shape != Shape::Induction)
+      return false;
+    // The index is sign extended to the width of the address
+    if (Idx->getType()->getIntegerBitWidth() < m_DL.getIndexTypeSizeInBits(GEP->getType()) && !IdxInfo.m_NSW)
+      return false;
+    Type* ElemTy = GEP->getResultElementType();
+    if (!ElemTy->isSized())
+      return false;
+    for (User* U : GEP->users()) {
+      Type* AccessTy = nullptr;
+      if (auto* LI = dyn_cast<LoadInst>(U))
+        AccessTy = LI->getType();
+      else if (auto* SI = dyn_cast<StoreInst>(U); SI && SI->getPointerOperand() == GEP)
+        AccessTy = SI->getValueOperand()->getType();
+      if (!AccessTy || m_DL.getTypeAllocSize(AccessTy) != m_DL.getTypeAllocSize(ElemTy) ||
+          m_DL.getTypeAllocSize(AccessTy) != m_DL.getTypeStoreSize(AccessTy))
+        return false;
+    }
+    Info.m_Shape = Shape::Consecutive;
+    m_Info[I] = Info;
+    return true;
+  }
+
+  // Simple arithmetic on the IV keeps lanes one apart
+  if (auto* Cast = dyn_cast<CastInst>(I)) {
+    ValueInfo OpInfo = getInfo(Cast->getOperand(0));
+    if (OpInfo.m_Shape == Shape::Induction) {
+      Info.m_Shape = Shape::Induction;
+      if (isa<TruncInst>(Cast)) {
+        m_Info[I] = Info;
+        return true;
+      }
+      if (isa<SExtInst>(Cast) && OpInfo.m_NSW) {
+        Info.m_NSW = true;
+        m_Info[I] = Info;
+        return true;
+      }
+      if (isa<ZExtInst>(Cast) && OpInfo.m_NUW) {
+        Info.m_NSW = Info.m_NUW = true;
+        m_Info[I] = Info;
+        return true;
+      }
+    }
+  }
+  if (I->getOpcode() == Instruction::Add || I->getOpcode() == Instruction::Sub) {
+    ValueInfo LHS = getInfo(I->getOperand(0));
+    ValueInfo RHS = getInfo(I->getOperand(1));
+    if (I->getOpcode() == Instruction::Add && LHS.m_Shape == Shape::Uniform)
+      std::swap(LHS, RHS);
+    if (LHS.m_Shape == Shape::Induction && RHS.m_Shape == Shape::Uniform) {
+      Info.m_Shape = Shape::Induction;
+      Info.m_NSW = LHS.m_NSW && I->hasNoSignedWrap();
+      Info.m_NUW = LHS.m_NUW && I->hasNoUnsignedWrap();
+      m_Info[I] = Info;
+      return true;
+    }
+  }
+
+  if (auto* Call = dyn_cast<IntrinsicInst>(I)) {
+    if (!isTriviallyVectorizable(Call->getIntrinsicID()) || !Call->doesNotAccessMemory())
+      return false;
+    for (Value* Arg : Call->args()) {
+      if (Arg->getType() != Call->getType())
+        return false;
+    }
+  } else if (!isa<BinaryOperator>(I) && !isa<CmpInst>(I) && !isa<SelectInst>(I) && !isa<CastInst>(I) &&
+             !isa<UnaryOperator>(I)) {
+    return false;
+  }
+  Type* Ty = isa<CmpInst>(I) ? I->getOperand(0)->getType() : I->getType();
+  if (!VectorType::isValidElementType(Ty) || !VectorType::isValidElementType(I->getType()))
+    return false;
+  if (!AllUniform)
+    Info.m_Shape = Shape::Vector;
+  m_Info[I] = Info;
+  return true;
+}
+
+/// Whether A and B compute the same address in every iteration
+bool LoopVectorizer::isSameAddress(Value* A, Value* B) const {
+  if (A == B)
+    return true;
+  auto* IA = dyn_cast<Instruction>(A);
+  auto* IB = dyn_cast<Instruction>(B);
+  if (!IA || !IB || !isInLoop(IA) || !isInLoop(IB) || IA->mayReadOrWriteMemory() || isa<PHINode>(IA) ||
+      !IA->isSameOperationAs(IB))
+    return false;
+  for (unsigned i = 0; i < IA->getNumOperands(); i++) {
+    if (!isSameAddress(IA->getOperand(i), IB->getOperand(i)))
+      return false;
+  }
+  return true;
+}
+
+/// Whether the value V takes for a given IV can be computed outside the loop
+bool LoopVectorizer::canExpand(Value* V) const {
+  if (!isInLoop(V) || V == m_Ind.m_IV)
+    return true;
+  auto* I = cast<Instruction>(V);
+  if ((!isa<GetElementPtrInst>(I) && !isa<CastInst>(I) && !isa<BinaryOperator>(I)) ||
+      !isSafeToSpeculativelyExecute(I))
+    return false;
+  return std::all_of(I->op_begin(), I->op_end(), [this](Value* Op) { return canExpand(Op); });
+}
+
+/// Compute the value V takes when the IV is IV at the builder's position
+Value* LoopVectorizer::expandAt(Value* V, Value* IV, IRBuilder<>& Builder, DenseMap<Value*, Value*>& Expanded) {
+  if (!isInLoop(V))
+    return V;
+  if (V == m_Ind.m_IV)
+    return IV;
+  if (Value* E = Expanded.lookup(V))
+    return E;
+  Instruction* I = cast<Instruction>(V)->clone();
+  for (Use& U : I->operands())
+    U.set(expandAt(U.get(), IV, Builder, Expanded));
+  // The expanded values are computed even when the vector loop doesn't run
+  I->dropPoisonGeneratingFlags();
+  Builder.Insert(I, V->getName() + ".vec.check");
+  Expanded[V] = I;
+  return I;
+}
+
+/// Find the pairs of accesses that may overlap unless checked at run time
+bool LoopVectorizer::addRuntimeChecks() {
+  for (unsigned i = 0; i < m_Accesses.size(); i++) {
+    for (unsigned j = 0; j < m_Accesses.size(); j++) {
+      const MemAccess& A = m_Accesses[i];
+      const MemAccess& B = m_Accesses[j];
+      if (i == j || !A.m_IsWrite || (B.m_IsWrite && j < i))
+        continue;
+      // Lane k of both accesses hits the same address, in program order
+      if (A.m_Consecutive && B.m_Consecutive && isSameAddress(A.m_Ptr, B.m_Ptr))
+        continue;
+      if (m_AA.isNoAlias(MemoryLocation::getBeforeOrAfter(A.m_Ptr), MemoryLocation::getBeforeOrAfter(B.m_Ptr)))
+        continue;
+      if (!canExpand(A.m_Ptr) || !canExpand(B.m_Ptr) || m_Checks.size() == MaxRuntimeChecks)
+        return false;
+      m_Checks.push_back({i, j});
+    }
+  }
+  return true;
+}
+
+bool LoopVectorizer::analyze() {
+  m_ContinuePred = m_Ind.m_ExitOnTrue ? ICmpInst::getInversePredicate(m_Ind.m_Pred) : m_Ind.m_Pred;
+  if (m_Ind.m_ExitingBlock != m_Loop.m_Header || m_Ind.m_ComparesNext || !m_Ind.m_Step.isOne() ||
+      !m_Ind.m_Cmp->hasOneUse())
+    return false;
+  switch (m_ContinuePred) {
+  case ICmpInst::ICMP_SLT:
+  case ICmpInst::ICMP_ULT:
+  case ICmpInst::ICMP_SLE:
+  case ICmpInst::ICMP_ULE:
+  case ICmpInst::ICMP_NE:
+    break;
+  default:
+    return false;
+  }
+
+  std::vector<BasicBlock*> Blocks;
+  if (!collectBlocks(Blocks))
+    return false;
+  for (PHINode& Phi : m_Loop.m_Header->phis()) {
+    if (!analyzeHeaderPHI(Phi))
+      return false;
+  }
+  for (BasicBlock* BB : Blocks) {
+    for (Instruction& I : *BB) {
+      // Only the header PHIs get vector versions
+      if (isa<PHINode>(I) && BB != m_Loop.m_Header)
+        return false;
+      if (isa<PHINode>(I) || I.isTerminator() || &I == m_Ind.m_Cmp)
+        continue;
+      if (!classify(&I))
+        return false;
+      m_Order.push_back(&I);
+    }
+  }
+
+  bool HasWork = false;
+  for (Instruction* I : m_Order) {
+    if (getInfo(I).m_Shape != Shape::Vector)
+      continue;
+    HasWork = true;
+    Type* Ty = I->getType();
+    if (auto* SI = dyn_cast<StoreInst>(I))
+      Ty = SI->getValueOperand()->getType();
+    else if (isa<CmpInst>(I))
+      Ty = I->getOperand(0)->getType();
+    m_WidestType = std::max<unsigned>(m_WidestType, m_DL.getTypeSizeInBits(Ty).getFixedSize());
+  }
+  return HasWork && addRuntimeChecks();
+}
+
+Value* LoopVectorizer::getScalar(Value* V) {
+  if (!isInLoop(V))
+    return V;
+  assert(m_Scalars.count(V) && "Used before it was widened");
+  return m_Scalars[V];
+}
+
+/// All lanes of V, computed for the iterations of the current vector
+/// iteration
+Value* LoopVectorizer::getVector(Value* V) {
+  if (Value* Vec = m_Vectors.lookup(V))
+    return Vec;
+  ValueInfo Info = getInfo(V);
+  Value* Vec = nullptr;
+  if (!isInLoop(V)) {
+    // Invariant values are splat once in front of the loop
+    Vec = m_PreBuilder->CreateVectorSplat(m_Width, V, V->getName() + ".splat");
+  } else if (Info.m_Shape == Shape::Uniform) {
+    Vec = m_Builder->CreateVectorSplat(m_Width, getScalar(V), V->getName() + ".splat");
+  } else {
+    assert(Info.m_Shape == Shape::Induction && "Vector values are created by widen()");
+    SmallVector<Constant*, MaxWidth> Steps;
+    for (unsigned k = 0; k < m_Width; k++)
+      Steps.push_back(ConstantInt::get(V->getType(), k));
+    Value* Splat = m_Builder->CreateVectorSplat(m_Width, getScalar(V), V->getName() + ".splat");
+    Vec = m_Builder->CreateAdd(Splat, ConstantVector::get(Steps), V->getName() + ".lanes");
+  }
+  m_Vectors[V] = Vec;
+  return Vec;
+}
+
+/// Emit the vector loop's version of I
+void LoopVectorizer::widen(Instruction* I) {
+  IRBuilder<>& Builder = *m_Builder;
+  ValueInfo Info = getInfo(I);
+  if (Info.m_Shape != Shape::Vector) {
+    Instruction* Scalar = I->clone();
+    for (Use& U : Scalar->operands())
+      U.set(getScalar(U.get()));
+    Builder.Insert(Scalar, I->getName() + ".vec");
+    m_Scalars[I] = Scalar;
+    return;
+  }
+
+  if (auto* LI = dyn_cast<LoadInst>(I)) {
+    auto* VecTy = FixedVectorType::get(LI->getType(), m_Width);
+    Value* Ptr = Builder.CreateBitCast(getScalar(LI->getPointerOperand()),
+                                       PointerType::get(VecTy, LI->getPointerAddressSpace()));
+    m_Vectors[I] = Builder.CreateAlignedLoad(VecTy, Ptr, LI->getAlign(), I->getName() + ".vec");
+    return;
+  }
+  if (auto* SI = dyn_cast<StoreInst>(I)) {
+    Value* Val = getVector(SI->getValueOperand());
+    Value* Ptr = Builder.CreateBitCast(getScalar(SI->getPointerOperand()),
+                                       PointerType::get(Val->getType(), SI->getPointerAddressSpace()));
+    Builder.CreateAlignedStore(Val, Ptr, SI->getAlign());
+    return;
+  }
+
+  auto* VecTy = FixedVectorType::get(I->getType(), m_Width);
+  if (auto* Call = dyn_cast<IntrinsicInst>(I)) {
+    Function* Decl = Intrinsic::getDeclaration(I->getModule(), Call->getIntrinsicID(), {VecTy});
+    SmallVector<Value*, 4> Args;
+    for (Value* Arg : Call->args())
+      Args.push_back(getVector(Arg));
+    CallInst* Vec = Builder.CreateCall(Decl, Args, I->getName() + ".vec");
+    if (isa<FPMathOperator>(Vec))
+      Vec->copyFastMathFlags(Call);
+    m_Vectors[I] = Vec;
+    return;
+  }
+  Instruction* Vec = I->clone();
+  for (Use& U : Vec->operands())
+    U.set(getVector(U.get()));
+  Vec->mutateType(VecTy);
+  Builder.Insert(Vec, I->getName() + ".vec");
+  m_Vectors[I] = Vec;
+}
+
+/// Combine the lanes of the accumulator V of R
+Value* LoopVectorizer::createReduce(const Reduction& R, Value* V) {
+  IRBuilder<>& Builder = *m_Builder;
+  switch (R.m_Op->getOpcode()) {
+  case Instruction::Add:
+    return Builder.CreateAddReduce(V);
+  case Instruction::Mul:
+    return Builder.CreateMulReduce(V);
+  case Instruction::And:
+    return Builder.CreateAndReduce(V);
+  case Instruction::Or:
+    return Builder.CreateOrReduce(V);
+  case Instruction::Xor:
+    return Builder.CreateXorReduce(V);
+  default:
+    break;
+  }
+  // The lanes may be combined in any order, like the original operations
+  Builder.setFastMathFlags(R.m_Op->getFastMathFlags());
+  Constant* Identity = ConstantExpr::getBinOpIdentity(R.m_Op->getOpcode(), R.m_Op->getType());
+  Value* Reduced = R.m_Op->getOpcode() == Instruction::FAdd ? Builder.CreateFAddReduce(Identity, V)
+                                                            : Builder.CreateFMulReduce(Identity, V);
+  Builder.clearFastMathFlags();
+  return Reduced;
+}
+
+void LoopVectorizer::vectorize(unsigned Width) {
+  m_Width = Width;
+  BasicBlock* Header = m_Loop.m_Header;
+  BasicBlock* Preheader = m_Loop.getPreheader();
+  Function* F = Header->getParent();
+  LLVMContext& Ctx = F->getContext();
+  PHINode* IV = m_Ind.m_IV;
+  Type* IVTy = IV->getType();
+
+  BasicBlock* Check = BasicBlock::Create(Ctx, Header->getName() + ".vec.check", F, Header);
+  BasicBlock* Body = BasicBlock::Create(Ctx, Header->getName() + ".vec.body", F, Header);
+  BasicBlock* Middle = BasicBlock::Create(Ctx, Header->getName() + ".vec.middle", F, Header);
+  BasicBlock* ScalarPreheader = BasicBlock::Create(Ctx, Header->getName() + ".vec.scalar", F, Header);
+  Preheader->getTerminator()->replaceSuccessorWith(Header, Check);
+
+  // Number of iterations the vector loop covers: the loop's iteration
+  // count rounded down to a multiple of Width. With an inclusive bound the
+  // count can wrap around to 0, leaving everything to the scalar loop.
+  IRBuilder<> Builder(Check);
+  Value* Start = m_Ind.m_Start;
+  Value* InRange = Builder.CreateICmp(m_ContinuePred, Start, m_Ind.m_Bound, "vec.inrange");
+  Value* Count = Builder.CreateSub(m_Ind.m_Bound, Start, "vec.count");
+  if (m_ContinuePred == ICmpInst::ICMP_SLE || m_ContinuePred == ICmpInst::ICMP_ULE)
+    Count = Builder.CreateAdd(Count, ConstantInt::get(IVTy, 1), "vec.count");
+  Count = Builder.CreateSelect(InRange, Count, ConstantInt::get(IVTy, 0), "vec.count");
+  Value* VecCount = Builder.CreateAnd(Count, ConstantInt::get(IVTy, -(int64_t)Width), "vec.count");
+  Value* VecEnd = Builder.CreateAdd(Start, VecCount, "vec.end");
+  Value* Enter = Builder.CreateICmpNE(VecCount, ConstantInt::get(IVTy, 0), "vec.enter");
+
+  // The address ranges of both accesses of a check must be disjoint
+  DenseMap<Value*, Value*> AtStart, AtEnd;
+  Type* IntPtrTy = m_DL.getIntPtrType(Ctx);
+  auto getRange = [&](const MemAccess& A) {
+    Value* Lo = expandAt(A.m_Ptr, Start, Builder, AtStart);
+    Value* Hi = nullptr;
+    if (A.m_Consecutive) {
+      Hi = expandAt(A.m_Ptr, VecEnd, Builder, AtEnd);
+    } else {
+      Type* BytePtrTy = Builder.getInt8PtrTy(A.m_Ptr->getType()->getPointerAddressSpace());
+      Hi = Builder.CreateGEP(Builder.getInt8Ty(), Builder.CreateBitCast(Lo, BytePtrTy), Builder.getInt64(A.m_Size));
+    }
+    return std::make_pair(Builder.CreatePtrToInt(Lo, IntPtrTy), Builder.CreatePtrToInt(Hi, IntPtrTy));
+  };
+  for (auto [i, j] : m_Checks) {
+    auto [LoA, HiA] = getRange(m_Accesses[i]);
+    auto [LoB, HiB] = getRange(m_Accesses[j]);
+    Value* Overlap = Builder.CreateAnd(Builder.CreateICmpULT(LoA, HiB), Builder.CreateICmpULT(LoB, HiA), "vec.overlap");
+    // A select rather than an and: the expanded addresses may be poison when
+    // the vector loop doesn't run
+    Enter = Builder.CreateSelect(Enter, Builder.CreateNot(Overlap), Builder.getFalse(), "vec.enter");
+    NumRuntimeChecks++;
+  }
+
+  // Accumulators start with the identity in all lanes but the first
+  std::vector<Value*> Inits;
+  for (const Reduction& R : m_Reductions) {
+    Constant* Identity = ConstantExpr::getBinOpIdentity(R.m_Op->getOpcode(), R.m_Phi->getType());
+    Value* Splat = ConstantVector::getSplat(ElementCount::getFixed(Width), Identity);
+    Inits.push_back(Builder.CreateInsertElement(Splat, R.m_Start, (uint64_t)0, R.m_Phi->getName() + ".vec.init"));
+  }
+  BranchInst* CheckBr = Builder.CreateCondBr(Enter, Body, ScalarPreheader);
+  IRBuilder<> PreBuilder(CheckBr);
+
+  // The vector loop
+  Builder.SetInsertPoint(Body);
+  m_Builder = &Builder;
+  m_PreBuilder = &PreBuilder;
+  PHINode* VecIV = Builder.CreatePHI(IVTy, 2, IV->getName() + ".vec");
+  VecIV->addIncoming(Start, Check);
+  m_Scalars[IV] = VecIV;
+  std::vector<PHINode*> Accumulators;
+  for (unsigned r = 0; r < m_Reductions.size(); r++) {
+    PHINode* Acc = Builder.CreatePHI(Inits[r]->getType(), 2, m_Reductions[r].m_Phi->getName() + ".vec");
+    Acc->addIncoming(Inits[r], Check);
+    m_Vectors[m_Reductions[r].m_Phi] = Acc;
+    Accumulators.push_back(Acc);
+  }
+  for (Instruction* I : m_Order)
+    widen(I);
+  Value* NextIV = Builder.CreateAdd(VecIV, ConstantInt::get(IVTy, Width), IV->getName() + ".vec.next");
+  VecIV->addIncoming(NextIV, Body);
+  for (unsigned r = 0; r < m_Reductions.size(); r++) {
+    // Each lane now sums a different subset of the values, so the partial
+    // sums may wrap where the scalar one did not
+    auto* VecOp = cast<Instruction>(getVector(m_Reductions[r].m_Op));
+    VecOp->dropPoisonGeneratingFlags();
+    Accumulators[r]->addIncoming(VecOp, Body);
+  }
+  Builder.CreateCondBr(Builder.CreateICmpNE(NextIV, VecEnd, "vec.continue"), Body, Middle);
+
+  // The scalar loop picks up where the vector loop stopped
+  Builder.SetInsertPoint(Middle);
+  std::vector<Value*> Results;
+  for (unsigned r = 0; r < m_Reductions.size(); r++)
+    Results.push_back(createReduce(m_Reductions[r], getVector(m_Reductions[r].m_Op)));
+  Builder.CreateBr(ScalarPreheader);
+
+  Builder.SetInsertPoint(ScalarPreheader);
+  PHINode* Resume = Builder.CreatePHI(IVTy, 2, IV->getName() + ".resume");
+  Resume->addIncoming(Start, Check);
+  Resume->addIncoming(VecEnd, Middle);
+  IV->setIncomingBlock(IV->getBasicBlockIndex(Preheader), ScalarPreheader);
+  IV->setIncomingValueForBlock(ScalarPreheader, Resume);
+  for (unsigned r = 0; r < m_Reductions.size(); r++) {
+    PHINode* Phi = m_Reductions[r].m_Phi;
+    PHINode* ResumeAcc = Builder.CreatePHI(Phi->getType(), 2, Phi->getName() + ".resume");
+    ResumeAcc->addIncoming(m_Reductions[r].m_Start, Check);
+    ResumeAcc->addIncoming(Results[r], Middle);
+    Phi->setIncomingBlock(Phi->getBasicBlockIndex(Preheader), ScalarPreheader);
+    Phi->setIncomingValueForBlock(ScalarPreheader, ResumeAcc);
+  }
+  Builder.CreateBr(Header);
+
+  // Scalar copies of the loop control aren't needed by the vector loop
+  for (Instruction& I : make_early_inc_range(reverse(*Body))) {
+    if (isInstructionTriviallyDead(&I))
+      I.eraseFromParent();
+  }
+}
+
+/// Main function for running the vectorization
+PreservedAnalyses UnitVectorize::run(Function& F, FunctionAnalysisManager& FAM) {
+  dbgs() << "UnitVectorize running on " << F.getName() << "\n";
+  UnitLoopInfo& Loops = FAM.getResult<UnitLoopAnalysis>(F);
+  AAResults& AA = FAM.getResult<AAManager>(F);
+  TargetTransformInfo& TTI = FAM.getResult<TargetIRAnalysis>(F);
+  const DataLayout& DL = F.getParent()->getDataLayout();
+  unsigned RegisterBits = TTI.getRegisterBitWidth(TargetTransformInfo::RGK_FixedWidthVector).getFixedSize();
+
+  bool Changed = false;
+  for (const UnitLoop& L : Loops.getLoops(F)) {
+    UnitInduction Ind;
+    if (!L.isInnermost() || !L.getPreheader() || !analyzeInduction(L, Ind))
+      continue;
+    LoopVectorizer Vectorizer(L, Ind, AA, DL);
+    if (!Vectorizer.analyze())
+      continue;
+
+    unsigned Width = m_Width ? m_Width : RegisterBits / Vectorizer.getWidestType();
+    Width = std::min(Width, MaxWidth);
+    if (Width < 2 || !isPowerOf2_32(Width))
+      continue;
+    dbgs() << "[UnitVectorize] Vectorizing loop " << L.m_Header->getName() << " with width " << Width << "\n";
+    Vectorizer.vectorize(Width);
+    NumLoopsVectorized++;
+    Changed = true;
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+  return PreservedAnalyses::none();
+}
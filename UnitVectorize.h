@@ -0,0 +1,24 @@
+#ifndef INCLUDE_UNIT_VECTORIZE_H
+#define INCLUDE_UNIT_VECTORIZE_H
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace cs426 {
+/// Loop Vectorization Pass. Runs innermost counted loops without control
+/// flow in their body several iterations at a time with vector instructions,
+/// as many as fit in a vector register of the target. Reductions are kept
+/// in vector accumulators, pointers that may overlap are checked at run
+/// time and the original loop runs the remaining iterations.
+struct UnitVectorize : PassInfoMixin<UnitVectorize> {
+  UnitVectorize(unsigned Width = 0) : m_Width(Width) {}
+
+  PreservedAnalyses run(Function& F, FunctionAnalysisManager& FAM);
+
+  // Number of iterations per vector iteration, 0 to size the vectors after
+  // the target's vector registers
+  unsigned m_Width;
+};
+} // namespace
+
+#endif // INCLUDE_UNIT_VECTORIZE_H
@@ -0,0 +1,43 @@
+// Loops accessing an int array through 8-byte stores, which cover two of
+// its elements at once. unit-fuse and unit-parallelize must see that the
+// stores of one iteration reach the elements read by another; the program
+// returns 0 as long as the passes keep it correct.
+#include <stdio.h>
+
+#define N 64
+
+int a[2 * N + 4];
+int c[N];
+
+// Fusing the loops would read a[2 * j + 3] before the store of iteration
+// j + 1 of the first loop wrote it
+void fill_then_copy(int* restrict p, int* restrict q, int n) {
+  for (int i = 0; i < n; i++)
+    *(long long*)&p[2 * i] = -1;
+  for (int j = 0; j < n; j++)
+    q[j] = p[2 * j + 3];
+}
+
+// Every iteration reads the upper half of the previous iteration's store,
+// which is -1 from the second iteration on
+void shift(int* restrict p, int* restrict q, int n) {
+  for (int i = 1; i < n; i++) {
+    *(long long*)&p[2 * i] = -i;
+    q[i] = p[2 * i - 1];
+  }
+}
+
+int main() {
+  int errors = 0;
+  fill_then_copy(a, c, N);
+  for (int j = 0; j < N - 1; j++)
+    errors += c[j] != -1;
+
+  for (int i = 0; i < 2 * N + 4; i++)
+    a[i] = 0;
+  shift(a, c, N);
+  for (int i = 2; i < N; i++)
+    errors += c[i] != -1;
+  printf("%d\n", errors);
+  return errors != 0;
+}
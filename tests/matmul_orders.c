@@ -0,0 +1,80 @@
+// Matrix multiplication in all six loop orders. Each kernel is a perfect
+// nest, so unit-interchange should bring every order to the i-k-j one and
+// the timings reported below should end up close to each other.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define N 400
+
+void matmul_ijk(int n, int A[restrict n][n], int B[restrict n][n], int C[restrict n][n]) {
+  for (int i = 0; i < n; i++)
+    for (int j = 0; j < n; j++)
+      for (int k = 0; k < n; k++)
+        C[i][j] += A[i][k] * B[k][j];
+}
+
+void matmul_ikj(int n, int A[restrict n][n], int B[restrict n][n], int C[restrict n][n]) {
+  for (int i = 0; i < n; i++)
+    for (int k = 0; k < n; k++)
+      for (int j = 0; j < n; j++)
+        C[i][j] += A[i][k] * B[k][j];
+}
+
+void matmul_jik(int n, int A[restrict n][n], int B[restrict n][n], int C[restrict n][n]) {
+  for (int j = 0; j < n; j++)
+    for (int i = 0; i < n; i++)
+      for (int k = 0; k < n; k++)
+        C[i][j] += A[i][k] * B[k][j];
+}
+
+void matmul_jki(int n, int A[restrict n][n], int B[restrict n][n], int C[restrict n][n]) {
+  for (int j = 0; j < n; j++)
+    for (int k = 0; k < n; k++)
+      for (int i = 0; i < n; i++)
+        C[i][j] += A[i][k] * B[k][j];
+}
+
+void matmul_kij(int n, int A[restrict n][n], int B[restrict n][n], int C[restrict n][n]) {
+  for (int k = 0; k < n; k++)
+    for (int i = 0; i < n; i++)
+      for (int j = 0; j < n; j++)
+        C[i][j] += A[i][k] * B[k][j];
+}
+
+void matmul_kji(int n, int A[restrict n][n], int B[restrict n][n], int C[restrict n][n]) {
+  for (int k = 0; k < n; k++)
+    for (int j = 0; j < n; j++)
+      for (int i = 0; i < n; i++)
+        C[i][j] += A[i][k] * B[k][j];
+}
+
+typedef void (*kernel)(int n, int A[restrict n][n], int B[restrict n][n], int C[restrict n][n]);
+
+int main() {
+  static int A[N][N], B[N][N], C[N][N];
+  const char* names[] = {"ijk", "ikj", "jik", "jki", "kij", "kji"};
+  kernel kernels[] = {matmul_ijk, matmul_ikj, matmul_jik, matmul_jki, matmul_kij, matmul_kji};
+
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      A[i][j] = rand() % 100;
+      B[i][j] = rand() % 100;
+    }
+  }
+  for (int v = 0; v < 6; v++) {
+    for (int i = 0; i < N; i++)
+      for (int j = 0; j < N; j++)
+        C[i][j] = 0;
+    clock_t start = clock();
+    kernels[v](N, A, B, C);
+    clock_t end = clock();
+
+    long checksum = 0;
+    for (int i = 0; i < N; i++)
+      for (int j = 0; j < N; j++)
+        checksum += C[i][j] * (long)(i + j);
+    printf("%s: %ld (%.3fs)\n", names[v], checksum, (double)(end - start) / CLOCKS_PER_SEC);
+  }
+  return 0;
+}
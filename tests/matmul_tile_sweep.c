@@ -0,0 +1,44 @@
+// Matrix multiplication over a sweep of matrix sizes. The nest is perfect
+// and fully permutable, so unit-tile should block it once the matrices
+// outgrow the caches; compare the timings below with and without the pass
+// (and with different l1=/l2= options).
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+void matmul(int n, double A[restrict n][n], double B[restrict n][n], double C[restrict n][n]) {
+  for (int i = 0; i < n; i++)
+    for (int k = 0; k < n; k++)
+      for (int j = 0; j < n; j++)
+        C[i][j] += A[i][k] * B[k][j];
+}
+
+int main() {
+  const int sizes[] = {64, 128, 256, 512, 768, 1024};
+
+  for (int v = 0; v < 6; v++) {
+    int n = sizes[v];
+    double(*A)[n] = malloc(sizeof(double[n][n]));
+    double(*B)[n] = malloc(sizeof(double[n][n]));
+    double(*C)[n] = calloc(n, sizeof(double[n]));
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; j < n; j++) {
+        A[i][j] = rand() % 100;
+        B[i][j] = rand() % 100;
+      }
+    }
+    clock_t start = clock();
+    matmul(n, A, B, C);
+    clock_t end = clock();
+
+    double checksum = 0;
+    for (int i = 0; i < n; i++)
+      for (int j = 0; j < n; j++)
+        checksum += C[i][j] * (i + j);
+    printf("%4d: %.0f (%.3fs)\n", n, checksum, (double)(end - start) / CLOCKS_PER_SEC);
+    free(A);
+    free(B);
+    free(C);
+  }
+  return 0;
+}
@@ -0,0 +1,19 @@
+// A recursive function whose self calls are followed by arithmetic that
+// doesn't use their results but feeds the sum that does. unit-par-recurse
+// has to keep that arithmetic in front of the sum when it moves the sum
+// behind the wait for the spawned call.
+#include <stdio.h>
+
+int g(int n) {
+  if (n < 2)
+    return n;
+  int a = g(n - 1);
+  int b = g(n - 2);
+  int c = n * 3;
+  return a + b + c;
+}
+
+int main() {
+  printf("%d\n", g(30));
+  return 0;
+}
@@ -0,0 +1,69 @@
+// Simple counted inner loops for unit-vectorize: an update through pointers
+// that may overlap (runtime alias check), a dot product (a reduction that is
+// only vectorized when compiled with -ffast-math) and an integer reduction
+// with an inclusive bound. The output must not change when the pass runs;
+// compare the timings for SSE (-mattr=+sse2) and AVX2 (-mattr=+avx2).
+#include <stdio.h>
+#include <time.h>
+
+#define N 4099
+#define REPS 20000
+
+void saxpy(float* a, float* b, float s, int n) {
+  for (int i = 0; i < n; i++)
+    a[i] += s * b[i];
+}
+
+double dot(double* restrict u, double* restrict v, int n) {
+  double sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += u[i] * v[i];
+  return sum;
+}
+
+int squares(int* out, int n) {
+  int sum = 0;
+  for (int k = 1; k <= n; k++) {
+    out[k - 1] = k * k;
+    sum += k * k;
+  }
+  return sum;
+}
+
+int main() {
+  static float a[N + 1], b[N];
+  static double u[N], v[N];
+  static int out[N];
+  for (int i = 0; i < N; i++) {
+    a[i] = i % 17;
+    b[i] = i % 5;
+    u[i] = 1.0 / (i + 1);
+    v[i] = i % 3;
+  }
+
+  clock_t start = clock();
+  for (int r = 0; r < REPS; r++)
+    saxpy(a, b, 0.5f, N);
+  // Overlapping pointers, has to run the scalar loop
+  saxpy(a + 1, a, 0.5f, N);
+  clock_t end = clock();
+  double checksum = 0;
+  for (int i = 0; i < N; i++)
+    checksum += a[i] * (i % 7);
+  printf("saxpy: %.6g (%.3fs)\n", checksum, (double)(end - start) / CLOCKS_PER_SEC);
+
+  start = clock();
+  double d = 0;
+  for (int r = 0; r < REPS; r++)
+    d += dot(u, v, N - r % 8);
+  end = clock();
+  printf("dot: %.6g (%.3fs)\n", d, (double)(end - start) / CLOCKS_PER_SEC);
+
+  start = clock();
+  int s = 0;
+  for (int r = 0; r < REPS; r++)
+    s ^= squares(out, N - r % 8);
+  end = clock();
+  printf("squares: %d %d (%.3fs)\n", s, out[N / 2], (double)(end - start) / CLOCKS_PER_SEC);
+  return 0;
+}